@@ -9,33 +9,125 @@
 
   Observações:
     - Usei "passagem por valor" nas funções de exibição (ex.: exibirLivro(Livro l)).
+      As listagens (menus 1, 3 e 13) não copiam registros: o gerador de relatórios formata
+      direto do vetor no buffer de saída, com filtro, paginação e formato texto, CSV ou JSON.
     - Usei "passagem por referência" nas funções que atualizam estado (ex.: realizarEmprestimo(...)).
     - Todos os vetores são dinâmicos com crescimento por realocação.
+    - Títulos, autores e nomes moram no pool de textos da biblioteca (blocos que não se movem,
+      sem limite de tamanho); os registros guardam só ponteiros e autores repetidos são
+      internados, então Livro cabe em 32 bytes e Usuario em 16.
+    - Empréstimos em aberto ficam num pool de blocos com lista de livres; ao devolver, o
+      registro migra para um histórico compactado (só cresce), fora do caminho das consultas.
+    - Cargas grandes (menu 8) usam o importador CSV: lê o arquivo em blocos, pré-dimensiona os
+      vetores pela estimativa de linhas e monta os índices de ID uma única vez no final.
+    - A Biblioteca aceita várias threads: trava de leitura/escrita no acervo, trava dos
+      empréstimos e disponíveis lidos de forma atômica (recusa sem exemplar não espera ninguém).
+      O modo --estresse mede esse caminho real e o motor de fragmentos com compare-and-swap.
+
+    - Livro sem exemplar aceita reserva (fila FIFO por livro); a devolução entrega o exemplar
+      ao primeiro da fila na mesma operação.
+    - O acervo também é indexado em ordem de título, autor e ano (B+-tree raso, atualizado a
+      cada cadastro): o menu 17 e o comando NAVEGAR percorrem faixas como "1990 a 2000" ou
+      "autores com K" em O(log n + k), paginando pelo último id sem reordenar nada.
+    - Totais (exemplares, disponíveis, ativos, devolvidos, reservas, cota por usuário) são
+      mantidos a cada alteração: a foto do menu 16 e do comando TOTAIS não varre nada, e a
+      conferência recalcula tudo para comparar com os contadores.
+    - Vários empréstimos e devoluções podem ir num lote atômico (menu 15, comando LOTE): tudo é
+      validado antes, a memória do lote é reservada de uma vez e só então o estado muda.
+    - Cada empréstimo alimenta o painel de circulação (menu 14): contagem aproximada por livro
+      e por usuário (count-min), os mais frequentes de cada um (heap sobre o count-min) e
+      empréstimos por hora, tudo em memória fixa e consultável sem varrer o histórico.
+    - O modo --benchmark monta um acervo sintético (1M livros, 100k usuários, 10M devolvidos),
+      reproduz uma mistura de consultas, empréstimos, devoluções e listagens e mede p50/p99/p999
+      por tipo; os resultados podem ser anexados a um CSV para comparar builds.
+
+    - Integrações usam o servidor de comandos (--servidor ou --servidor-socket): comandos em
+      pipeline, em linhas de texto ou em quadros binários com tamanho, processados em lote, sem
+      o menu; o socket atende vários clientes ao mesmo tempo, em várias threads.
+    - Os ativos também ficam encadeados por hora do empréstimo (baldes ordenados), então atrasos
+      e períodos saem sem varrer o pool; o relatório noturno só olha o que venceu desde o último.
+
+  Compilação: gcc -O2 -pthread sistema-de-biblioteca.c -o biblioteca
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 /* ---------------------- Constantes ---------------------- */
-#define TITULO_MAX 80
-#define AUTOR_MAX  60
-#define NOME_MAX   60
+#define CAP_INICIAL 4
+#define TEXTO_BLOCO (1 << 16)      /* bytes por bloco do pool de textos */
+
+/* Pool de empréstimos ativos: blocos fixos que nunca se movem */
+#define EMP_BLOCO_BITS  12
+#define EMP_BLOCO       (1 << EMP_BLOCO_BITS)
+#define EMP_MAX_BLOCOS  16384      /* até 64M empréstimos em aberto */
+#define LIMITE_EMPRESTIMOS 5       /* empréstimos em aberto por usuário */
+#define PRAZO_EMPRESTIMO (14 * 24 * 3600) /* segundos até o empréstimo ficar em atraso */
+#define TEMPO_BALDE     3600       /* granularidade do índice por data (1 hora) */
+
+/* Importação CSV */
+#define CSV_BLOCO        (1 << 16) /* bytes lidos por fread */
+#define CSV_MAX_CAMPOS   8
+#define CSV_MAX_AVISOS   5         /* linhas rejeitadas detalhadas no relatório */
+
+/* Relatórios */
+#define SAIDA_TAM     (1 << 16)    /* buffer de escrita das listagens */
+#define CACHE_DATAS   256          /* datas formatadas por minuto (mapeamento direto) */
+
+/* Motor concorrente */
+#define MOTOR_FRAGMENTOS 64        /* travas independentes; fragmento = id do empréstimo % N */
+#define ESTRESSE_RETIDOS 32        /* empréstimos que cada thread mantém em aberto no teste */
+
+/* Benchmark de latência (modo --benchmark) */
+#define BENCH_LIVROS     1000000
+#define BENCH_USUARIOS   100000
+#define BENCH_HISTORICO  10000000L
+#define BENCH_RETIDOS    (BENCH_USUARIOS * 2) /* ativos que o benchmark mantém para devolver */
+
+/* Análise de circulação */
+#define ANALISE_TOP      64        /* mais frequentes guardados (livros e usuários) */
+#define CM_LARGURA       4096      /* colunas do count-min (potência de 2) */
+#define CM_PROFUNDIDADE  4
+#define ANALISE_HORAS    168       /* janela de empréstimos por hora (7 dias) */
+
+/* Índices ordenados do acervo */
+#define ORDEM_FOLHA      256       /* posições por folha (split ao encher) */
+
+/* Servidor de comandos */
+#define SERVIDOR_BLOCO  (1 << 16)  /* bytes lidos por vez; cada leitura é um lote */
+#define SERVIDOR_CLIENTES 64       /* conexões simultâneas por thread do --servidor-socket */
+#define SERVIDOR_PENDENTE (4 << 20) /* respostas não lidas acima disso: para de ler o cliente */
+#define QUADRO_CABECALHO 5         /* quadro binário: byte 0 + tamanho em 4 bytes big-endian */
 
 /* ---------------------- Structs ---------------------- */
+/* Os textos de Livro e Usuario apontam para o pool da Biblioteca quando cadastrados;
+   antes do cadastro podem apontar para qualquer texto (cadastrar copia). */
 typedef struct {
     int id;
-    char titulo[TITULO_MAX];
-    char autor[AUTOR_MAX];
     int ano;
     int exemplares;   /* total cadastrados */
     int disponiveis;  /* quantos ainda podem ser emprestados */
+    const char* titulo;
+    const char* autor;  /* internado: o mesmo autor é o mesmo ponteiro */
 } Livro;
 
 typedef struct {
     int id;
-    char nome[NOME_MAX];
+    const char* nome;
 } Usuario;
 
 typedef struct {
@@ -46,233 +138,4026 @@ typedef struct {
     int ativo;   /* 1 = empréstimo em aberto, 0 = devolvido */
 } Emprestimo;
 
-/* ---------------------- Protótipos ---------------------- */
-/* Inicialização e memória */
-void inicializar(Livro** livros, int* nLiv, int* capLiv,
-                 Usuario** usuarios, int* nUsu, int* capUsu,
-                 Emprestimo** emps, int* nEmp, int* capEmp);
-void liberarMemoria(Livro* livros, Usuario* usuarios, Emprestimo* emps);
+/* Índice hash (endereçamento aberto, sondagem linear) de ID -> posição no vetor.
+   IDs válidos são > 0; a chave 0 marca posição vazia. */
+typedef struct {
+    int* chaves;
+    int* valores;
+    int cap;      /* potência de 2 (0 = ainda não alocado) */
+    int n;
+} IndiceId;
+
+/* Pool de textos: cópias em blocos de TEXTO_BLOCO que nunca são movidos nem liberados
+   antes do fim (textos maiores que meio bloco ganham bloco próprio). Os internados
+   ficam numa tabela hash de ponteiros (NULL = posição vazia). */
+typedef struct {
+    char** blocos;
+    int nBlocos, capBlocos;
+    char* livre;            /* próximo byte livre do bloco corrente */
+    size_t restante;        /* bytes livres do bloco corrente */
+    const char** internados;
+    int capInternados, nInternados;
+    size_t bytes;           /* total de texto guardado (estatística) */
+} PoolTextos;
+
+/* Histórico de empréstimos devolvidos: sequência de registros codificados em varint,
+   com id e data guardados como diferença (zigzag) em relação ao registro anterior. */
+typedef struct {
+    unsigned char* dados;
+    size_t tam, cap;
+    long n;
+    int ultimoId;       /* base dos deltas do próximo registro */
+    time_t ultimaData;
+} HistoricoEmprestimos;
+
+/* Posição de leitura no histórico (carrega o estado da decodificação por delta) */
+typedef struct {
+    size_t pos;
+    int ultimoId;
+    time_t ultimaData;
+} CursorHistorico;
+
+/* Slot do pool: o empréstimo e seus elos nas listas do usuário e do livro (-1 = fim) */
+typedef struct {
+    Emprestimo e;
+    int antUsu, proxUsu;
+    int antLiv, proxLiv;
+    int antData, proxData; /* lista do balde de hora do empréstimo */
+} SlotEmprestimo;
+
+/* Balde do índice por data: ativos emprestados na mesma hora (data / TEMPO_BALDE) */
+typedef struct {
+    long hora;
+    int primeiro; /* slot do início da lista */
+} BaldeTempo;
+
+/* Posição numa consulta por período [ini, fim) no índice por data */
+typedef struct {
+    time_t ini, fim;
+    int balde;
+    int slot;     /* próximo slot a examinar no balde atual (-1 = fim do balde) */
+} CursorPeriodo;
+
+/* Empréstimos: ativos no pool (slot = posição estável), devolvidos no histórico */
+typedef struct {
+    SlotEmprestimo** blocos; /* diretório fixo com EMP_MAX_BLOCOS entradas */
+    int nBlocos;
+    int usados;            /* slots já entregues alguma vez (marca d'água) */
+    int* livres;           /* pilha de slots liberados por devoluções */
+    int nLivres, capLivres;
+    int nAtivos;
+    int maiorId;
+    IndiceId idxAtivos;    /* id do empréstimo -> slot */
+    IndiceId porUsuario;   /* id do usuário -> primeiro slot da sua lista de ativos */
+    IndiceId porLivro;     /* id do livro -> primeiro slot da sua lista de ativos */
+    IndiceId ativosUsuario; /* id do usuário -> quantos ativos ele tem (cota em O(1)) */
+    BaldeTempo* baldes;    /* em ordem crescente de hora; vazios (primeiro = -1) ficam até a compactação */
+    int nBaldes, capBaldes;
+    int nBaldesVazios;
+    HistoricoEmprestimos hist;
+} RegistroEmprestimos;
+
+/* Nó da fila de reservas. Cada fila é circular e guardada pela cauda, que aponta para a
+   cabeça: entrar e sair são O(1) e só livros com fila ocupam entrada no índice. Os nós de
+   um mesmo usuário também formam uma lista dupla, para conferir duplicatas em O(k). */
+typedef struct {
+    int idUsuario;
+    int idLivro;
+    int prox;
+    int proxUsu, antUsu; /* lista do usuário (-1 = fim) */
+} NoReserva;
+
+typedef struct {
+    NoReserva* nos;
+    int nNos, capNos;  /* nNos = marca d'água; nós liberados voltam por livre */
+    int livre;         /* pilha de nós livres encadeada por prox (-1 = vazia) */
+    IndiceId caudas;   /* id do livro -> nó da cauda da sua fila */
+    IndiceId porUsuario; /* id do usuário -> primeiro nó da sua lista de reservas */
+    long total;        /* reservas em espera em todas as filas */
+} Reservas;
+
+/* Contagem estimada pelo count-min: nunca abaixo da real */
+typedef struct {
+    int id;
+    long contagem;
+} ContadorTop;
+
+/* Frequências aproximadas de ids: count-min com atualização conservadora e um
+   min-heap com os ANALISE_TOP ids de maior estimativa */
+typedef struct {
+    unsigned* cm;                  /* CM_PROFUNDIDADE linhas de CM_LARGURA */
+    ContadorTop heap[ANALISE_TOP]; /* raiz = menor estimativa entre os guardados */
+    int n;
+    IndiceId pos;                  /* id -> posição no heap */
+} TopFrequentes;
+
+/* Estatísticas de circulação atualizadas a cada empréstimo, em memória limitada */
+typedef struct {
+    TopFrequentes livros, usuarios;
+    long horaBalde[ANALISE_HORAS]; /* hora (t / 3600) que o balde representa */
+    long porHora[ANALISE_HORAS];
+    long total;
+} AnaliseCirculacao;
+
+/* Totais do acervo mantidos em O(1) por cada caminho que altera o estado. O que o
+   registro e as reservas já contam (ativos, devolvidos, filas) não é repetido aqui. */
+typedef struct {
+    long exemplares;
+    long disponiveis;
+} Agregados;
+
+/* Foto dos totais para monitoramento: montada sem varrer nenhum vetor */
+typedef struct {
+    long livros, usuarios;
+    long exemplares, disponiveis;
+    long ativos, devolvidos;
+    long usuariosComEmprestimo, livrosEmprestados;
+    long reservas;
+} FotoAgregados;
+
+/* Índice ordenado do acervo: B+-tree raso de dois níveis. O diretório guarda as folhas
+   em ordem e cada folha guarda até ORDEM_FOLHA posições de livros, ordenadas pela chave
+   (título ou autor sem diferenciar maiúsculas, ou ano) com a posição como desempate.
+   Busca: binária no diretório + binária na folha; inserção move no máximo uma folha. */
+enum { ORDEM_TITULO, ORDEM_AUTOR, ORDEM_ANO, ORDEM_CHAVES };
+
+typedef struct {
+    int n;
+    int pos[ORDEM_FOLHA];
+} FolhaOrdem;
+
+typedef struct {
+    FolhaOrdem** folhas;
+    int nFolhas, capFolhas;
+    FolhaOrdem* reserva;   /* folha pré-alocada para o próximo split: inserir não falha */
+    int chave;
+    long n;
+} IndiceOrdenado;
+
+/* Faixa de uma navegação ordenada. Ano: [anoDe, anoAte]. Texto: de textoDe em diante
+   até os que começam com textoAte ("K".."K" = começa com K); NULL ou "" = sem limite. */
+typedef struct {
+    int chave;
+    const char* textoDe;
+    const char* textoAte;
+    int anoDe, anoAte;
+} FaixaOrdem;
+
+/* Posição na navegação (não sobrevive a inserções; entre páginas use ordemDepoisDe) */
+typedef struct {
+    int folha, i;
+    long escritas;
+    int fim;
+} CursorOrdem;
+
+/* Marca de lote: valor válido só quando epoca é a do lote corrente */
+typedef struct {
+    unsigned epoca;
+    int valor;
+} MarcaLote;
+
+/* Memória de trabalho de executarLote, mantida entre lotes. As marcas são indexadas pela
+   posição do livro, do usuário e do slot, então um lote novo só avança a época em vez de
+   limpar ou alocar alguma coisa. */
+typedef struct {
+    unsigned epoca;
+    MarcaLote* livros;   int capLivros;   /* valor: disponíveis depois das ops já vistas */
+    MarcaLote* usuarios; int capUsuarios; /* valor: ativos depois das ops já vistas */
+    MarcaLote* slots;    int capSlots;    /* só a marca: empréstimo já devolvido no lote */
+    int* porOp;          int capPorOp;    /* 3 por operação: posição, livro, usuário tocado */
+} TrabalhoLote;
+
+/* Estado completo da biblioteca: vetores dinâmicos e seus índices.
+   Várias threads podem usá-la ao mesmo tempo (servidor por socket, estresse):
+   - travaAcervo (leitura/escrita) protege a forma do acervo: vetores de livros e usuários,
+     índices de ID e ordenados, pool de textos. Quem cadastra ou importa com outras
+     threads ativas a segura para escrita, o que exclui todo o resto; as demais
+     operações a seguram para leitura;
+   - travaEmprestimos protege registro, reservas, análise, agregados e o trabalho do lote.
+     É sempre tomada depois de travaAcervo, nunca antes;
+   - Livro.disponiveis só muda com travaEmprestimos (ou com o acervo para escrita) e por
+     operação atômica, então consultas e a recusa de empréstimo sem exemplar o leem sem ela.
+   realizarEmprestimo, devolverEmprestimo, executarLote e reservarLivro tomam as travas
+   sozinhas; o servidor toma as dos demais comandos. O menu roda numa thread só. */
+typedef struct {
+    Livro* livros;     int nLiv, capLiv;
+    Usuario* usuarios; int nUsu, capUsu;
+    RegistroEmprestimos emps;
+    IndiceId idxLivros;   /* id do livro -> posição em livros */
+    IndiceId idxUsuarios; /* id do usuário -> posição em usuarios */
+    int maiorIdLivro, maiorIdUsuario; /* próximos IDs sem varrer os vetores */
+    PoolTextos textos;    /* títulos, autores e nomes apontados pelos registros */
+    Reservas reservas;
+    AnaliseCirculacao analise;
+    Agregados agregados;
+    IndiceOrdenado ordem[ORDEM_CHAVES]; /* acervo por título, autor e ano */
+    time_t corteAtrasos;  /* vencimentos até aqui já saíram no relatório incremental */
+    TrabalhoLote lote;
+    pthread_rwlock_t travaAcervo;
+    pthread_mutex_t travaEmprestimos;
+} Biblioteca;
+
+/* Leitura de CSV em blocos: a linha é devolvida direto do bloco quando cabe nele
+   e só é copiada para o buffer auxiliar quando atravessa a fronteira entre blocos. */
+typedef struct {
+    FILE* f;
+    char* bloco;  size_t tamBloco, pos;
+    char* linha;  size_t tamLinha, capLinha;
+    long numLinha;
+    int erro;     /* 1 = falha de memória */
+} LeitorCSV;
+
+/* Resultado das operações sem interação: >= 0 é sucesso, negativo é o motivo da recusa */
+enum {
+    OP_OK = 0,
+    OP_LIVRO_INEXISTENTE = -1,
+    OP_USUARIO_INEXISTENTE = -2,
+    OP_SEM_EXEMPLARES = -3,
+    OP_LIMITE_USUARIO = -4,
+    OP_EMPRESTIMO_INEXISTENTE = -5,
+    OP_SEM_MEMORIA = -6,
+    OP_LIVRO_DISPONIVEL = -7,
+    OP_OPERACAO_INVALIDA = -8,
+    OP_JA_NA_FILA = -9,
+    OP_JA_TEM_LIVRO = -10
+};
+
+/* Operação de um lote atômico (executarLote) */
+enum { LOTE_EMPRESTAR = 1, LOTE_DEVOLVER = 2 };
+
+typedef struct {
+    int tipo;
+    int id;         /* LOTE_EMPRESTAR: id do livro; LOTE_DEVOLVER: id do empréstimo */
+    int idUsuario;  /* só em LOTE_EMPRESTAR */
+} OperacaoLote;
+
+/* Fragmento do motor: um registro de empréstimos protegido por sua própria trava */
+typedef struct {
+    pthread_mutex_t trava;
+    RegistroEmprestimos reg;
+} FragmentoEmprestimos;
+
+/* Motor concorrente sobre o acervo de uma Biblioteca. O acervo (livros, usuários e
+   índices de ID) é só lido durante o uso e não pode ser realocado enquanto houver threads. */
+typedef struct {
+    Livro* livros;              /* disponiveis alterado apenas por CAS */
+    const IndiceId* idxLivros;
+    const IndiceId* idxUsuarios;
+    int nUsu;
+    int* ativosPorUsuario;      /* cota em uso, por posição do usuário (CAS) */
+    int proximoId;              /* incremento atômico */
+    FragmentoEmprestimos frag[MOTOR_FRAGMENTOS];
+} MotorEmprestimos;
+
+/* Destino em memória da Saida (respostas de um cliente do servidor ainda não enviadas) */
+typedef struct {
+    char* dados;
+    size_t tam, cap;
+    int erro;     /* faltou memória: parte da saída se perdeu */
+} BufferMemoria;
+
+/* Escrita bufferizada: as linhas são montadas no buffer e vão ao FILE* (ou à memória) em blocos */
+typedef struct {
+    FILE* f;
+    BufferMemoria* mem; /* usado quando f == NULL */
+    size_t usado;
+    char buf[SAIDA_TAM];
+} Saida;
+
+/* Leitura de comandos de um cliente: linhas de texto e quadros binários misturados */
+typedef struct {
+    char* buf;          /* SERVIDOR_BLOCO + 1 bytes (o extra recebe o \0 do último quadro) */
+    size_t pendente;    /* bytes de um comando incompleto no início do buffer */
+    int descartando;    /* linha longa demais: ignora até o próximo \n */
+    int continuar;      /* 0 depois de SAIR ou de um quadro inválido */
+    long comandos;
+} LeitorComandos;
+
+/* Datas formatadas reaproveitadas para o mesmo minuto (o formato não mostra segundos) */
+typedef struct {
+    long minuto[CACHE_DATAS];
+    char texto[CACHE_DATAS][20];
+} CacheDatas;
+
+/* Posição da listagem de empréstimos: slots do pool e depois o histórico */
+typedef struct {
+    int slot;
+    int noHistorico;
+    CursorHistorico hist;
+} CursorEmprestimos;
+
+/* Listagem do acervo (livros ou usuários) */
+typedef enum { FORMATO_TEXTO, FORMATO_CSV, FORMATO_JSON } FormatoRelatorio;
+
+typedef struct {
+    FormatoRelatorio formato;
+    const char* trecho;      /* só linhas cujo título/autor/nome contém o trecho (NULL = todas) */
+    int apenasDisponiveis;   /* livros: só os com exemplar disponível */
+} FiltroRelatorio;
+
+/* Posição da listagem: próximo índice do vetor e linhas já escritas (cabeçalho/vírgulas) */
+typedef struct {
+    int pos;
+    long escritas;
+    int fim;                 /* rodapé já escrito */
+} CursorAcervo;
+
+/* Tipos de operação medidos pelo benchmark (mesma ordem de OPS_BENCH) */
+enum {
+    BENCH_CONSULTA, BENCH_BUSCA_EMPRESTIMO, BENCH_BUSCA_LINEAR, BENCH_EMPRESTAR,
+    BENCH_DEVOLVER, BENCH_LISTAR_USUARIO, BENCH_PAGINA_LIVROS, BENCH_TIPOS
+};
+
+typedef struct {
+    long lidas;
+    long aceitas;
+    long rejeitadas;
+    double segundos;
+} RelatorioImportacao;
+
+/* ---------------------- Protótipos ---------------------- */
+/* Inicialização e memória */
+void inicializar(Biblioteca* b);
+void liberarMemoria(Biblioteca* b);
+void* reservarVetor(void* v, int* cap, int minimo, size_t tamElem);
+
+/* Pool de textos */
+const char* poolGuardar(PoolTextos* p, const char* s);
+const char* poolInternar(PoolTextos* p, const char* s);
+void poolLiberar(PoolTextos* p);
+
+/* Índice de IDs */
+int indiceIdReservar(IndiceId* ix, int n);
+int indiceIdInserir(IndiceId* ix, int id, int pos);
+int indiceIdBuscar(const IndiceId* ix, int id);
+int indiceIdRemover(IndiceId* ix, int id);
+int indiceIdDefinir(IndiceId* ix, int id, int valor);
+void indiceIdLiberar(IndiceId* ix);
+
+/* Registro de empréstimos (pool de ativos + histórico) */
+int registroIniciar(RegistroEmprestimos* r);
+void registroLiberar(RegistroEmprestimos* r);
+Emprestimo* slotEmprestimo(const RegistroEmprestimos* r, int slot);
+int registroInserir(RegistroEmprestimos* r, Emprestimo e);
+int registroFechar(RegistroEmprestimos* r, int slot);
+int registroReservar(RegistroEmprestimos* r, int insercoes, int fechamentos);
+int historicoAnexar(HistoricoEmprestimos* h, const Emprestimo* e);
+int historicoLer(const HistoricoEmprestimos* h, CursorHistorico* c, Emprestimo* e);
+
+/* Consultas pelos índices secundários: O(k) no número de empréstimos em aberto.
+   Uso: for (int s = primeiroDoUsuario(r, id); s >= 0; s = proximoDoUsuario(r, s)) */
+int primeiroDoUsuario(const RegistroEmprestimos* r, int idUsuario);
+int proximoDoUsuario(const RegistroEmprestimos* r, int slot);
+int primeiroDoLivro(const RegistroEmprestimos* r, int idLivro);
+int proximoDoLivro(const RegistroEmprestimos* r, int slot);
+int contarEmprestimosDoUsuario(const RegistroEmprestimos* r, int idUsuario);
+
+/* Consulta por data no índice de baldes: O(log B + k), em ordem crescente de hora.
+   Uso: periodoIniciar(r, &c, ini, fim); while ((s = periodoProximo(r, &c)) >= 0) ...
+   O cursor não sobrevive a inserções ou devoluções no registro. */
+void periodoIniciar(const RegistroEmprestimos* r, CursorPeriodo* c, time_t ini, time_t fim);
+int periodoProximo(const RegistroEmprestimos* r, CursorPeriodo* c);
+
+/* Helpers de ID/Busca */
+int proximoIdLivro(const Livro* v, int n);
+int proximoIdUsuario(const Usuario* v, int n);
+int buscarLivroPorId(const Livro* v, int n, int id);
+int buscarUsuarioPorId(const Usuario* v, int n, int id);
+int buscarEmprestimoAtivo(const RegistroEmprestimos* r, int idEmp);
+
+/* Cadastro (atualizam por referência) */
+int adicionarLivro(Livro** v, int* n, int* cap, Livro novo);
+int adicionarUsuario(Usuario** v, int* n, int* cap, Usuario novo);
+int cadastrarLivro(Biblioteca* b, Livro novo);
+int cadastrarUsuario(Biblioteca* b, Usuario novo);
+
+/* Importação em massa (CSV) */
+int importarLivrosCSV(Biblioteca* b, const char* caminho, long dicaLinhas, RelatorioImportacao* rel);
+int importarUsuariosCSV(Biblioteca* b, const char* caminho, long dicaLinhas, RelatorioImportacao* rel);
+int importarEmprestimosCSV(Biblioteca* b, const char* caminho, long dicaLinhas, RelatorioImportacao* rel);
+void exibirRelatorioImportacao(const char* tipo, RelatorioImportacao r);
+
+/* Empréstimo e Devolução (atualizam por referência) */
+int realizarEmprestimo(Biblioteca* b, int idLivro, int idUsuario);
+int devolverEmprestimo(Biblioteca* b, int idEmprestimo);
+int executarLote(Biblioteca* b, const OperacaoLote* ops, int n, int* resultados, int* posFalha);
+
+/* Reservas: fila FIFO por livro, atendida nas devoluções */
+int reservarLivro(Biblioteca* b, int idLivro, int idUsuario);
+int filaReservas(const Reservas* r, int idLivro, int* usuarios, int max);
+void reservasLiberar(Reservas* r);
+
+/* Análise de circulação (count-min + heap dos mais frequentes, janela por hora) */
+int analiseIniciar(AnaliseCirculacao* a);
+void analiseLiberar(AnaliseCirculacao* a);
+void analiseRegistrar(AnaliseCirculacao* a, const Emprestimo* e);
+int analiseTop(const TopFrequentes* t, ContadorTop* saida, int k);
+long analiseEstimativa(const TopFrequentes* t, int id);
+long analiseNaHora(const AnaliseCirculacao* a, time_t t);
+void exibirPainelCirculacao(const Biblioteca* b, time_t agora);
+
+/* Índices ordenados: navegação e faixas em O(log n + k) */
+int ordemInserir(IndiceOrdenado* ix, const Livro* v, int pos);
+void ordemLiberar(IndiceOrdenado* ix);
+int indexarLivroOrdenado(Biblioteca* b, int pos);
+void descartarOrdemDesde(Biblioteca* b, int n0);
+void ordemIniciar(const Biblioteca* b, const FaixaOrdem* f, CursorOrdem* c);
+int ordemDepoisDe(const Biblioteca* b, const FaixaOrdem* f, int idLivro, CursorOrdem* c);
+int ordemProximo(const Biblioteca* b, const FaixaOrdem* f, CursorOrdem* c);
+int relatorioLivrosOrdenado(Saida* out, const Biblioteca* b, const FaixaOrdem* fx, const FiltroRelatorio* f,
+                            CursorOrdem* c, int tamPagina);
+void navegarAcervo(const Biblioteca* b, const FaixaOrdem* fx, int tamPagina);
+
+/* Agregados: foto em O(1) e conferência contra uma recontagem completa */
+void agregadosFoto(const Biblioteca* b, FotoAgregados* f);
+long agregadosConferir(const Biblioteca* b, FotoAgregados* recontagem);
+void exibirAgregados(const Biblioteca* b, int conferir);
+
+/* Exibição (passagem por valor) */
+void exibirLivro(Livro l);
+void exibirUsuario(Usuario u);
+void listarLivros(const Livro* v, int n);
+void listarUsuarios(const Usuario* v, int n);
+void listarEmprestimos(const Biblioteca* b, int tamPagina);
+void listarEmprestimosDoUsuario(const Biblioteca* b, int idUsuario);
+void listarEmprestimosDoLivro(const Biblioteca* b, int idLivro);
+void listarEmprestimosNoPeriodo(const Biblioteca* b, time_t ini, time_t fim);
+void listarAtrasados(Biblioteca* b, time_t agora, int apenasNovos);
+void exportarAcervo(const Biblioteca* b, int livros, const FiltroRelatorio* f, const char* caminho, int tamPagina);
+
+/* Relatório de empréstimos (junções pelos índices, saída bufferizada, paginação) */
+void saidaIniciar(Saida* out, FILE* f);
+void saidaIniciarMemoria(Saida* out, BufferMemoria* m);
+void saidaPrintf(Saida* out, const char* fmt, ...);
+void saidaDescarregar(Saida* out);
+void saidaTexto(Saida* out, const char* s, size_t n);
+void saidaInteiro(Saida* out, long v);
+void cacheDatasIniciar(CacheDatas* c);
+const char* dataEmCache(CacheDatas* c, time_t t);
+void escreverEmprestimo(Saida* out, const Biblioteca* b, const Emprestimo* e, CacheDatas* datas);
+int relatorioEmprestimos(Saida* out, const Biblioteca* b, CursorEmprestimos* c, CacheDatas* datas, int tamPagina);
+int relatorioPeriodo(Saida* out, const Biblioteca* b, time_t ini, time_t fim, CacheDatas* datas);
+int relatorioLivros(Saida* out, const Livro* v, int n, const FiltroRelatorio* f, CursorAcervo* c, int tamPagina);
+int relatorioUsuarios(Saida* out, const Usuario* v, int n, const FiltroRelatorio* f, CursorAcervo* c, int tamPagina);
+
+/* Motor concorrente */
+const char* descreverResultado(int codigo);
+int motorIniciar(MotorEmprestimos* m, Biblioteca* b);
+void motorLiberar(MotorEmprestimos* m);
+int motorEmprestar(MotorEmprestimos* m, int idLivro, int idUsuario);
+int motorDevolver(MotorEmprestimos* m, int idEmprestimo);
+long motorVerificar(const MotorEmprestimos* m, const Biblioteca* b);
+int executarEstresse(int maxThreads, long opsPorThread);
+int executarBenchmark(long ops, const char* arquivo, const char* rotulo);
+
+/* Servidor de comandos (sem menu) */
+int executarComando(Biblioteca* b, char* linha, Saida* out);
+long servirFluxo(Biblioteca* b, int fdEntrada, FILE* saida);
+int servirSocket(Biblioteca* b, const char* caminho, int nThreads);
+
+/* Utilitários */
+void limparBufferEntrada(void);
+void titulo(const char* s);
+void linha(void);
+void formatarData(time_t t, char* buf, size_t tam);
+int lerDataBR(const char* s, time_t* t, int fimDoDia);
+char* lerLinhaEntrada(char** buf, size_t* cap);
+double agoraSegundos(void);
+
+/* ---------------------- Implementações ---------------------- */
+
+void inicializar(Biblioteca* b) {
+    memset(b, 0, sizeof(*b));
+    b->capLiv = b->capUsu = CAP_INICIAL;
+
+    b->livros = (Livro*)calloc(b->capLiv, sizeof(Livro));
+    b->usuarios = (Usuario*)calloc(b->capUsu, sizeof(Usuario));
+
+    b->reservas.livre = -1;
+    for (int k = 0; k < ORDEM_CHAVES; k++) b->ordem[k].chave = k;
+    pthread_rwlock_init(&b->travaAcervo, NULL);
+    pthread_mutex_init(&b->travaEmprestimos, NULL);
+    if (!b->livros || !b->usuarios || !registroIniciar(&b->emps) || !analiseIniciar(&b->analise) ||
+        !indiceIdReservar(&b->idxLivros, b->capLiv) ||
+        !indiceIdReservar(&b->idxUsuarios, b->capUsu)) {
+        fprintf(stderr, "Falha ao alocar memória inicial.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void liberarMemoria(Biblioteca* b) {
+    free(b->livros);
+    free(b->usuarios);
+    registroLiberar(&b->emps);
+    indiceIdLiberar(&b->idxLivros);
+    indiceIdLiberar(&b->idxUsuarios);
+    poolLiberar(&b->textos);
+    reservasLiberar(&b->reservas);
+    analiseLiberar(&b->analise);
+    for (int k = 0; k < ORDEM_CHAVES; k++) ordemLiberar(&b->ordem[k]);
+    free(b->lote.livros);
+    free(b->lote.usuarios);
+    free(b->lote.slots);
+    free(b->lote.porOp);
+    pthread_rwlock_destroy(&b->travaAcervo);
+    pthread_mutex_destroy(&b->travaEmprestimos);
+}
+
+/* Garante capacidade >= minimo de uma só vez (sem passar pelas duplicações).
+   Retorna o vetor (possivelmente movido) ou NULL se faltar memória. */
+void* reservarVetor(void* v, int* cap, int minimo, size_t tamElem) {
+    if (minimo <= *cap) return v;
+    void* temp = realloc(v, (size_t)minimo * tamElem);
+    if (!temp) return NULL;
+    *cap = minimo;
+    return temp;
+}
+
+/* ---------------------- Pool de textos ---------------------- */
+/* Copia s para o pool. Retorna o endereço estável da cópia ou NULL sem memória. */
+const char* poolGuardar(PoolTextos* p, const char* s) {
+    size_t n = strlen(s) + 1;
+    if (n == 1) return "";
+    if (p->nBlocos == p->capBlocos) {
+        int novoCap = p->capBlocos ? p->capBlocos * 2 : 16;
+        char** temp = (char**)realloc(p->blocos, novoCap * sizeof(char*));
+        if (!temp) return NULL;
+        p->blocos = temp;
+        p->capBlocos = novoCap;
+    }
+    char* destino;
+    if (n > TEXTO_BLOCO / 2) { /* bloco próprio; o corrente continua aberto */
+        destino = (char*)malloc(n);
+        if (!destino) return NULL;
+        p->blocos[p->nBlocos++] = destino;
+    } else {
+        if (n > p->restante) {
+            char* bloco = (char*)malloc(TEXTO_BLOCO);
+            if (!bloco) return NULL;
+            p->blocos[p->nBlocos++] = bloco;
+            p->livre = bloco;
+            p->restante = TEXTO_BLOCO;
+        }
+        destino = p->livre;
+        p->livre += n;
+        p->restante -= n;
+    }
+    memcpy(destino, s, n);
+    p->bytes += n;
+    return destino;
+}
+
+static unsigned hashTexto(const char* s) {
+    unsigned h = 2166136261u; /* FNV-1a */
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+/* Devolve o exemplar único de s no pool (guarda na primeira vez) ou NULL sem memória */
+const char* poolInternar(PoolTextos* p, const char* s) {
+    if (s[0] == '\0') return "";
+    if ((p->nInternados + 1) * 10 > p->capInternados * 7) {
+        int novoCap = p->capInternados ? p->capInternados * 2 : 256;
+        const char** nova = (const char**)calloc(novoCap, sizeof(const char*));
+        if (!nova) return NULL;
+        for (int i = 0; i < p->capInternados; i++) {
+            const char* t = p->internados[i];
+            if (!t) continue;
+            unsigned j = hashTexto(t) & (unsigned)(novoCap - 1);
+            while (nova[j]) j = (j + 1) & (unsigned)(novoCap - 1);
+            nova[j] = t;
+        }
+        free(p->internados);
+        p->internados = nova;
+        p->capInternados = novoCap;
+    }
+    unsigned mask = (unsigned)(p->capInternados - 1);
+    unsigned j = hashTexto(s) & mask;
+    for (; p->internados[j]; j = (j + 1) & mask)
+        if (strcmp(p->internados[j], s) == 0) return p->internados[j];
+    const char* copia = poolGuardar(p, s);
+    if (!copia) return NULL;
+    p->internados[j] = copia;
+    p->nInternados++;
+    return copia;
+}
+
+void poolLiberar(PoolTextos* p) {
+    for (int i = 0; i < p->nBlocos; i++) free(p->blocos[i]);
+    free(p->blocos);
+    free(p->internados);
+    memset(p, 0, sizeof(*p));
+}
+
+/* ---------------------- Índice de IDs ---------------------- */
+static unsigned hashId(int id) {
+    return (unsigned)id * 2654435761u;
+}
+
+/* Dimensiona a tabela para n chaves com carga <= 70% (reinsere tudo se crescer). */
+int indiceIdReservar(IndiceId* ix, int n) {
+    int novoCap = ix->cap ? ix->cap : 16;
+    while ((long)n * 10 > (long)novoCap * 7) novoCap *= 2;
+    if (novoCap == ix->cap) return 1;
+
+    int* chaves = (int*)calloc(novoCap, sizeof(int));
+    int* valores = (int*)malloc(novoCap * sizeof(int));
+    if (!chaves || !valores) { free(chaves); free(valores); return 0; }
+
+    unsigned mask = (unsigned)novoCap - 1;
+    for (int i = 0; i < ix->cap; i++) {
+        if (ix->chaves[i] == 0) continue;
+        unsigned h = hashId(ix->chaves[i]) & mask;
+        while (chaves[h] != 0) h = (h + 1) & mask;
+        chaves[h] = ix->chaves[i];
+        valores[h] = ix->valores[i];
+    }
+    free(ix->chaves);
+    free(ix->valores);
+    ix->chaves = chaves;
+    ix->valores = valores;
+    ix->cap = novoCap;
+    return 1;
+}
+
+/* Retorna 1 se inseriu, 0 se o ID já existe, -1 se faltou memória. */
+int indiceIdInserir(IndiceId* ix, int id, int pos) {
+    if (!indiceIdReservar(ix, ix->n + 1)) return -1;
+    unsigned mask = (unsigned)ix->cap - 1;
+    unsigned h = hashId(id) & mask;
+    while (ix->chaves[h] != 0) {
+        if (ix->chaves[h] == id) return 0;
+        h = (h + 1) & mask;
+    }
+    ix->chaves[h] = id;
+    ix->valores[h] = pos;
+    ix->n++;
+    return 1;
+}
+
+int indiceIdBuscar(const IndiceId* ix, int id) {
+    if (ix->cap == 0 || id <= 0) return -1;
+    unsigned mask = (unsigned)ix->cap - 1;
+    unsigned h = hashId(id) & mask;
+    while (ix->chaves[h] != 0) {
+        if (ix->chaves[h] == id) return ix->valores[h];
+        h = (h + 1) & mask;
+    }
+    return -1;
+}
+
+/* Remoção com deslocamento para trás (mantém as cadeias de sondagem sem lápides).
+   Retorna 1 se removeu, 0 se o ID não estava no índice. */
+int indiceIdRemover(IndiceId* ix, int id) {
+    if (ix->cap == 0 || id <= 0) return 0;
+    unsigned mask = (unsigned)ix->cap - 1;
+    unsigned i = hashId(id) & mask;
+    while (ix->chaves[i] != id) {
+        if (ix->chaves[i] == 0) return 0;
+        i = (i + 1) & mask;
+    }
+    unsigned j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (ix->chaves[j] == 0) break;
+        unsigned k = hashId(ix->chaves[j]) & mask;
+        /* a chave em j só pode ocupar o buraco i se sua posição ideal k não estiver em (i, j] */
+        int fica = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (fica) continue;
+        ix->chaves[i] = ix->chaves[j];
+        ix->valores[i] = ix->valores[j];
+        i = j;
+    }
+    ix->chaves[i] = 0;
+    ix->n--;
+    return 1;
+}
+
+/* Insere ou sobrescreve. Retorna 1 em sucesso, 0 se faltou memória. */
+int indiceIdDefinir(IndiceId* ix, int id, int valor) {
+    if (!indiceIdReservar(ix, ix->n + 1)) return 0;
+    unsigned mask = (unsigned)ix->cap - 1;
+    unsigned h = hashId(id) & mask;
+    while (ix->chaves[h] != 0 && ix->chaves[h] != id) h = (h + 1) & mask;
+    if (ix->chaves[h] == 0) { ix->chaves[h] = id; ix->n++; }
+    ix->valores[h] = valor;
+    return 1;
+}
+
+void indiceIdLiberar(IndiceId* ix) {
+    free(ix->chaves);
+    free(ix->valores);
+    ix->chaves = ix->valores = NULL;
+    ix->cap = ix->n = 0;
+}
+
+/* ---------------------- Registro de empréstimos ---------------------- */
+int registroIniciar(RegistroEmprestimos* r) {
+    memset(r, 0, sizeof(*r));
+    r->blocos = (SlotEmprestimo**)calloc(EMP_MAX_BLOCOS, sizeof(SlotEmprestimo*));
+    return r->blocos != NULL && indiceIdReservar(&r->idxAtivos, CAP_INICIAL) &&
+           indiceIdReservar(&r->porUsuario, CAP_INICIAL) && indiceIdReservar(&r->porLivro, CAP_INICIAL) &&
+           indiceIdReservar(&r->ativosUsuario, CAP_INICIAL);
+}
+
+void registroLiberar(RegistroEmprestimos* r) {
+    for (int i = 0; i < r->nBlocos; i++) free(r->blocos[i]);
+    free(r->blocos);
+    free(r->livres);
+    free(r->hist.dados);
+    indiceIdLiberar(&r->idxAtivos);
+    indiceIdLiberar(&r->porUsuario);
+    indiceIdLiberar(&r->porLivro);
+    indiceIdLiberar(&r->ativosUsuario);
+    free(r->baldes);
+    memset(r, 0, sizeof(*r));
+}
+
+static SlotEmprestimo* slotDe(const RegistroEmprestimos* r, int slot) {
+    return &r->blocos[slot >> EMP_BLOCO_BITS][slot & (EMP_BLOCO - 1)];
+}
+
+Emprestimo* slotEmprestimo(const RegistroEmprestimos* r, int slot) {
+    return &slotDe(r, slot)->e;
+}
+
+/* Primeiro balde com hora >= hora (busca binária; nBaldes se não houver) */
+static int baldeLimiteInferior(const RegistroEmprestimos* r, long hora) {
+    int lo = 0, hi = r->nBaldes;
+    while (lo < hi) {
+        int meio = lo + (hi - lo) / 2;
+        if (r->baldes[meio].hora < hora) lo = meio + 1;
+        else hi = meio;
+    }
+    return lo;
+}
+
+/* Tira os baldes vazios do vetor em O(B). Só roda quando eles passam dos ocupados,
+   então cada balde esvaziado paga O(1) amortizado. */
+static void compactarBaldes(RegistroEmprestimos* r) {
+    if (r->nBaldesVazios < 64 || r->nBaldesVazios <= r->nBaldes - r->nBaldesVazios) return;
+    int n = 0;
+    for (int i = 0; i < r->nBaldes; i++)
+        if (r->baldes[i].primeiro >= 0) r->baldes[n++] = r->baldes[i];
+    r->nBaldes = n;
+    r->nBaldesVazios = 0;
+}
+
+/* Garante espaço para mais um balde (dobrando a capacidade) */
+static int reservarBalde(RegistroEmprestimos* r) {
+    if (r->nBaldes < r->capBaldes) return 1;
+    int novoCap = r->capBaldes ? r->capBaldes * 2 : 64;
+    BaldeTempo* temp = (BaldeTempo*)realloc(r->baldes, novoCap * sizeof(BaldeTempo));
+    if (!temp) return 0;
+    r->baldes = temp;
+    r->capBaldes = novoCap;
+    return 1;
+}
+
+/* Guarda um empréstimo em aberto reaproveitando slots livres.
+   Retorna o slot ou -1 (sem memória, pool cheio ou id repetido).
+   Com contarCota = 0 a contagem por usuário fica com quem chama (o lote a grava uma
+   vez por usuário no fim). */
+static int inserirAtivo(RegistroEmprestimos* r, Emprestimo e, int contarCota) {
+    int slot;
+    if (r->nLivres > 0) {
+        slot = r->livres[r->nLivres - 1];
+    } else {
+        slot = r->usados;
+        if ((slot >> EMP_BLOCO_BITS) >= r->nBlocos) {
+            if (r->nBlocos == EMP_MAX_BLOCOS) return -1;
+            SlotEmprestimo* bloco = (SlotEmprestimo*)calloc(EMP_BLOCO, sizeof(SlotEmprestimo));
+            if (!bloco) return -1;
+            r->blocos[r->nBlocos++] = bloco;
+        }
+    }
+    /* reserva os índices antes de mexer em qualquer um: daqui em diante não falha */
+    compactarBaldes(r);
+    if (!indiceIdReservar(&r->porUsuario, r->porUsuario.n + 1) ||
+        !indiceIdReservar(&r->porLivro, r->porLivro.n + 1) ||
+        !indiceIdReservar(&r->ativosUsuario, r->ativosUsuario.n + 1) || !reservarBalde(r) ||
+        indiceIdInserir(&r->idxAtivos, e.id, slot) != 1) return -1;
+
+    if (r->nLivres > 0) r->nLivres--;
+    else r->usados++;
+    e.ativo = 1;
+
+    /* insere no início das listas do usuário e do livro */
+    SlotEmprestimo* sl = slotDe(r, slot);
+    sl->e = e;
+    sl->antUsu = sl->antLiv = -1;
+    sl->proxUsu = indiceIdBuscar(&r->porUsuario, e.idUsuario);
+    sl->proxLiv = indiceIdBuscar(&r->porLivro, e.idLivro);
+    if (sl->proxUsu >= 0) slotDe(r, sl->proxUsu)->antUsu = slot;
+    if (sl->proxLiv >= 0) slotDe(r, sl->proxLiv)->antLiv = slot;
+    indiceIdDefinir(&r->porUsuario, e.idUsuario, slot);
+    indiceIdDefinir(&r->porLivro, e.idLivro, slot);
+    if (contarCota) {
+        int ativos = indiceIdBuscar(&r->ativosUsuario, e.idUsuario);
+        indiceIdDefinir(&r->ativosUsuario, e.idUsuario, ativos > 0 ? ativos + 1 : 1);
+    }
+
+    /* e no início da lista do balde da sua hora. Hora nova depois da última (o caso normal,
+       datas crescentes) entra no fim em O(1); só uma hora nova fora de ordem desloca o vetor. */
+    long hora = (long)(e.data / TEMPO_BALDE);
+    int ib = r->nBaldes;
+    if (ib > 0 && r->baldes[ib - 1].hora >= hora) ib = baldeLimiteInferior(r, hora);
+    if (ib == r->nBaldes || r->baldes[ib].hora != hora) {
+        memmove(&r->baldes[ib + 1], &r->baldes[ib], (size_t)(r->nBaldes - ib) * sizeof(BaldeTempo));
+        r->baldes[ib].hora = hora;
+        r->baldes[ib].primeiro = -1;
+        r->nBaldes++;
+        r->nBaldesVazios++;
+    }
+    if (r->baldes[ib].primeiro < 0) r->nBaldesVazios--;
+    sl->antData = -1;
+    sl->proxData = r->baldes[ib].primeiro;
+    if (sl->proxData >= 0) slotDe(r, sl->proxData)->antData = slot;
+    r->baldes[ib].primeiro = slot;
+
+    r->nAtivos++;
+    if (e.id > r->maiorId) r->maiorId = e.id;
+    return slot;
+}
+
+int registroInserir(RegistroEmprestimos* r, Emprestimo e) {
+    return inserirAtivo(r, e, 1);
+}
+
+/* Tira o slot dos índices e das listas de usuário, livro e data (não aloca).
+   Não devolve o slot aos livres: isso fica com quem chama. contarCota como em inserirAtivo. */
+static void desencadearSlot(RegistroEmprestimos* r, int slot, int contarCota) {
+    Emprestimo* e = slotEmprestimo(r, slot);
+    indiceIdRemover(&r->idxAtivos, e->id);
+
+    /* lista vazia sai do índice */
+    SlotEmprestimo* sl = slotDe(r, slot);
+    if (sl->antUsu >= 0) slotDe(r, sl->antUsu)->proxUsu = sl->proxUsu;
+    else if (sl->proxUsu >= 0) indiceIdDefinir(&r->porUsuario, e->idUsuario, sl->proxUsu);
+    else indiceIdRemover(&r->porUsuario, e->idUsuario);
+    if (sl->proxUsu >= 0) slotDe(r, sl->proxUsu)->antUsu = sl->antUsu;
+    if (contarCota) {
+        int ativos = indiceIdBuscar(&r->ativosUsuario, e->idUsuario);
+        if (ativos > 1) indiceIdDefinir(&r->ativosUsuario, e->idUsuario, ativos - 1);
+        else indiceIdRemover(&r->ativosUsuario, e->idUsuario);
+    }
+
+    if (sl->antLiv >= 0) slotDe(r, sl->antLiv)->proxLiv = sl->proxLiv;
+    else if (sl->proxLiv >= 0) indiceIdDefinir(&r->porLivro, e->idLivro, sl->proxLiv);
+    else indiceIdRemover(&r->porLivro, e->idLivro);
+    if (sl->proxLiv >= 0) slotDe(r, sl->proxLiv)->antLiv = sl->antLiv;
+
+    if (sl->antData >= 0) {
+        slotDe(r, sl->antData)->proxData = sl->proxData;
+    } else {
+        int ib = baldeLimiteInferior(r, (long)(e->data / TEMPO_BALDE));
+        r->baldes[ib].primeiro = sl->proxData;
+        if (sl->proxData < 0) r->nBaldesVazios++; /* balde vazio fica; compactarBaldes o recolhe */
+    }
+    if (sl->proxData >= 0) slotDe(r, sl->proxData)->antData = sl->antData;
+    r->nAtivos--;
+}
+
+/* Move o empréstimo do slot para o histórico e devolve o slot à lista de livres. */
+static int fecharSlot(RegistroEmprestimos* r, int slot, int contarCota) {
+    Emprestimo* e = slotEmprestimo(r, slot);
+    if (r->nLivres >= r->capLivres) {
+        int novoCap = r->capLivres ? r->capLivres * 2 : 64;
+        int* temp = (int*)realloc(r->livres, novoCap * sizeof(int));
+        if (!temp) return 0;
+        r->livres = temp;
+        r->capLivres = novoCap;
+    }
+    e->ativo = 0;
+    if (!historicoAnexar(&r->hist, e)) { e->ativo = 1; return 0; }
+    desencadearSlot(r, slot, contarCota);
+    r->livres[r->nLivres++] = slot;
+    return 1;
+}
+
+int registroFechar(RegistroEmprestimos* r, int slot) {
+    return fecharSlot(r, slot, 1);
+}
+
+/* Garante de uma vez a memória para mais `insercoes` ativos e `fechamentos` devoluções.
+   Depois disso registroInserir e registroFechar não alocam, então não falham. */
+int registroReservar(RegistroEmprestimos* r, int insercoes, int fechamentos) {
+    long livres = (long)r->nBlocos * EMP_BLOCO - r->usados + r->nLivres;
+    while (livres < insercoes) {
+        if (r->nBlocos == EMP_MAX_BLOCOS) return 0;
+        SlotEmprestimo* bloco = (SlotEmprestimo*)calloc(EMP_BLOCO, sizeof(SlotEmprestimo));
+        if (!bloco) return 0;
+        r->blocos[r->nBlocos++] = bloco;
+        livres += EMP_BLOCO;
+    }
+    if (!indiceIdReservar(&r->idxAtivos, r->idxAtivos.n + insercoes) ||
+        !indiceIdReservar(&r->porUsuario, r->porUsuario.n + insercoes + 1) ||
+        !indiceIdReservar(&r->porLivro, r->porLivro.n + insercoes + 1) ||
+        !indiceIdReservar(&r->ativosUsuario, r->ativosUsuario.n + insercoes + 1)) return 0;
+    if (r->nBaldes + insercoes > r->capBaldes) {
+        BaldeTempo* temp = (BaldeTempo*)realloc(r->baldes, (size_t)(r->nBaldes + insercoes) * sizeof(BaldeTempo));
+        if (!temp) return 0;
+        r->baldes = temp;
+        r->capBaldes = r->nBaldes + insercoes;
+    }
+    if (r->nLivres + fechamentos > r->capLivres) {
+        int* temp = (int*)realloc(r->livres, (size_t)(r->nLivres + fechamentos) * sizeof(int));
+        if (!temp) return 0;
+        r->livres = temp;
+        r->capLivres = r->nLivres + fechamentos;
+    }
+    HistoricoEmprestimos* h = &r->hist;
+    size_t desejado = h->tam + (size_t)(fechamentos + 1) * 40; /* 40 = folga de historicoAnexar */
+    if (desejado > h->cap) {
+        unsigned char* temp = (unsigned char*)realloc(h->dados, desejado);
+        if (!temp) return 0;
+        h->dados = temp;
+        h->cap = desejado;
+    }
+    return 1;
+}
+
+int primeiroDoUsuario(const RegistroEmprestimos* r, int idUsuario) {
+    return indiceIdBuscar(&r->porUsuario, idUsuario);
+}
+int proximoDoUsuario(const RegistroEmprestimos* r, int slot) {
+    return slotDe(r, slot)->proxUsu;
+}
+int primeiroDoLivro(const RegistroEmprestimos* r, int idLivro) {
+    return indiceIdBuscar(&r->porLivro, idLivro);
+}
+int proximoDoLivro(const RegistroEmprestimos* r, int slot) {
+    return slotDe(r, slot)->proxLiv;
+}
+int contarEmprestimosDoUsuario(const RegistroEmprestimos* r, int idUsuario) {
+    int n = indiceIdBuscar(&r->ativosUsuario, idUsuario);
+    return n > 0 ? n : 0;
+}
+
+void periodoIniciar(const RegistroEmprestimos* r, CursorPeriodo* c, time_t ini, time_t fim) {
+    c->ini = ini;
+    c->fim = fim;
+    c->balde = baldeLimiteInferior(r, (long)(ini / TEMPO_BALDE));
+    c->slot = c->balde < r->nBaldes ? r->baldes[c->balde].primeiro : -1;
+}
+
+/* Próximo slot com ini <= data < fim, ou -1. Só os baldes das pontas têm
+   empréstimos fora do período; os do meio são entregues inteiros. */
+int periodoProximo(const RegistroEmprestimos* r, CursorPeriodo* c) {
+    if (c->fim <= c->ini) return -1;
+    long ultimaHora = (long)((c->fim - 1) / TEMPO_BALDE);
+    while (c->balde < r->nBaldes && r->baldes[c->balde].hora <= ultimaHora) {
+        while (c->slot >= 0) {
+            const SlotEmprestimo* sl = slotDe(r, c->slot);
+            int s = c->slot;
+            c->slot = sl->proxData;
+            if (sl->e.data >= c->ini && sl->e.data < c->fim) return s;
+        }
+        if (++c->balde < r->nBaldes) c->slot = r->baldes[c->balde].primeiro;
+    }
+    return -1;
+}
+
+static unsigned char* escreverVarint(unsigned char* p, unsigned long long v) {
+    while (v >= 0x80) { *p++ = (unsigned char)(v | 0x80); v >>= 7; }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+static const unsigned char* lerVarint(const unsigned char* p, unsigned long long* v) {
+    unsigned long long x = 0;
+    int desloc = 0;
+    while (*p & 0x80) { x |= (unsigned long long)(*p++ & 0x7f) << desloc; desloc += 7; }
+    x |= (unsigned long long)*p++ << desloc;
+    *v = x;
+    return p;
+}
+
+static unsigned long long zigzag(long long v) {
+    return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+static long long dezigzag(unsigned long long v) {
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+/* Registro = varint(zigzag(Δid)) varint(idLivro) varint(idUsuario) varint(zigzag(Δdata)):
+   em geral 6 a 10 bytes contra os 24+ do Emprestimo. */
+int historicoAnexar(HistoricoEmprestimos* h, const Emprestimo* e) {
+    if (h->tam + 40 > h->cap) {
+        size_t novoCap = h->cap ? h->cap * 2 : 4096;
+        unsigned char* temp = (unsigned char*)realloc(h->dados, novoCap);
+        if (!temp) return 0;
+        h->dados = temp;
+        h->cap = novoCap;
+    }
+    unsigned char* p = h->dados + h->tam;
+    p = escreverVarint(p, zigzag((long long)e->id - h->ultimoId));
+    p = escreverVarint(p, (unsigned)e->idLivro);
+    p = escreverVarint(p, (unsigned)e->idUsuario);
+    p = escreverVarint(p, zigzag((long long)(e->data - h->ultimaData)));
+    h->tam = (size_t)(p - h->dados);
+    h->ultimoId = e->id;
+    h->ultimaData = e->data;
+    h->n++;
+    return 1;
+}
+
+/* Decodifica o próximo registro; retorna 0 no fim do histórico.
+   Comece com o cursor zerado (memset) para ler desde o início. */
+int historicoLer(const HistoricoEmprestimos* h, CursorHistorico* c, Emprestimo* e) {
+    if (c->pos >= h->tam) return 0;
+    unsigned long long v;
+    const unsigned char* p = h->dados + c->pos;
+    p = lerVarint(p, &v); c->ultimoId += (int)dezigzag(v);
+    p = lerVarint(p, &v); e->idLivro = (int)v;
+    p = lerVarint(p, &v); e->idUsuario = (int)v;
+    p = lerVarint(p, &v); c->ultimaData += (time_t)dezigzag(v);
+    e->id = c->ultimoId;
+    e->data = c->ultimaData;
+    e->ativo = 0;
+    c->pos = (size_t)(p - h->dados);
+    return 1;
+}
+
+int proximoIdLivro(const Livro* v, int n) {
+    int max = 0;
+    for (int i = 0; i < n; i++) if (v[i].id > max) max = v[i].id;
+    return max + 1;
+}
+int proximoIdUsuario(const Usuario* v, int n) {
+    int max = 0;
+    for (int i = 0; i < n; i++) if (v[i].id > max) max = v[i].id;
+    return max + 1;
+}
+
+int buscarLivroPorId(const Livro* v, int n, int id) {
+    for (int i = 0; i < n; i++) if (v[i].id == id) return i;
+    return -1;
+}
+int buscarUsuarioPorId(const Usuario* v, int n, int id) {
+    for (int i = 0; i < n; i++) if (v[i].id == id) return i;
+    return -1;
+}
+/* Retorna o slot do empréstimo em aberto ou -1 */
+int buscarEmprestimoAtivo(const RegistroEmprestimos* r, int idEmp) {
+    return indiceIdBuscar(&r->idxAtivos, idEmp);
+}
+
+int adicionarLivro(Livro** v, int* n, int* cap, Livro novo) {
+    if (*n >= *cap) {
+        int novoCap = (*cap) * 2;
+        Livro* temp = (Livro*)realloc(*v, novoCap * sizeof(Livro));
+        if (!temp) return 0;
+        *v = temp;
+        *cap = novoCap;
+    }
+    (*v)[*n] = novo;
+    (*n)++;
+    return 1;
+}
+
+int adicionarUsuario(Usuario** v, int* n, int* cap, Usuario novo) {
+    if (*n >= *cap) {
+        int novoCap = (*cap) * 2;
+        Usuario* temp = (Usuario*)realloc(*v, novoCap * sizeof(Usuario));
+        if (!temp) return 0;
+        *v = temp;
+        *cap = novoCap;
+    }
+    (*v)[*n] = novo;
+    (*n)++;
+    return 1;
+}
+
+/* Cadastro com manutenção dos índices (caminho usado pelo menu).
+   Os textos de novo são copiados para o pool; o chamador continua dono dos seus. */
+int cadastrarLivro(Biblioteca* b, Livro novo) {
+    if (novo.id <= 0 || indiceIdBuscar(&b->idxLivros, novo.id) >= 0) return 0;
+    novo.titulo = poolGuardar(&b->textos, novo.titulo ? novo.titulo : "");
+    novo.autor = poolInternar(&b->textos, novo.autor ? novo.autor : "");
+    if (!novo.titulo || !novo.autor) return 0;
+    if (!adicionarLivro(&b->livros, &b->nLiv, &b->capLiv, novo)) return 0;
+    if (indiceIdInserir(&b->idxLivros, novo.id, b->nLiv - 1) != 1) {
+        b->nLiv--;
+        return 0;
+    }
+    if (!indexarLivroOrdenado(b, b->nLiv - 1)) {
+        indiceIdRemover(&b->idxLivros, novo.id);
+        b->nLiv--;
+        return 0;
+    }
+    if (novo.id > b->maiorIdLivro) b->maiorIdLivro = novo.id;
+    b->agregados.exemplares += novo.exemplares;
+    b->agregados.disponiveis += novo.disponiveis;
+    return 1;
+}
+
+int cadastrarUsuario(Biblioteca* b, Usuario novo) {
+    if (novo.id <= 0 || indiceIdBuscar(&b->idxUsuarios, novo.id) >= 0) return 0;
+    novo.nome = poolGuardar(&b->textos, novo.nome ? novo.nome : "");
+    if (!novo.nome) return 0;
+    if (!adicionarUsuario(&b->usuarios, &b->nUsu, &b->capUsu, novo)) return 0;
+    if (indiceIdInserir(&b->idxUsuarios, novo.id, b->nUsu - 1) != 1) {
+        b->nUsu--;
+        return 0;
+    }
+    if (novo.id > b->maiorIdUsuario) b->maiorIdUsuario = novo.id;
+    return 1;
+}
+
+static int atenderReserva(Biblioteca* b, int idLivro, time_t data);
+static int emprestarNaData(Biblioteca* b, int idLivro, int idUsuario, time_t data);
+static int efetivarEmprestimo(Biblioteca* b, int idxL, int idUsuario, time_t data);
+static int fecharEmprestimo(Biblioteca* b, int slot);
+static int aplicarLote(Biblioteca* b, const OperacaoLote* ops, int n, int* resultados, int* posFalha);
+static int entrarNaFila(Biblioteca* b, int idLivro, int idUsuario);
+
+/* Não imprime nada (usada pelo menu e pelo servidor). Segura para várias threads: livro
+   sem exemplar é recusado só com a trava do acervo (leitura atômica); o resto é conferido
+   de novo e registrado com travaEmprestimos.
+   Retorna o id do novo empréstimo ou um OP_* negativo com o motivo da recusa. */
+int realizarEmprestimo(Biblioteca* b, int idLivro, int idUsuario) {
+    int r;
+    pthread_rwlock_rdlock(&b->travaAcervo);
+    int idxL = indiceIdBuscar(&b->idxLivros, idLivro);
+    if (idxL < 0) {
+        r = OP_LIVRO_INEXISTENTE;
+    } else if (__atomic_load_n(&b->livros[idxL].disponiveis, __ATOMIC_ACQUIRE) <= 0) {
+        r = indiceIdBuscar(&b->idxUsuarios, idUsuario) < 0 ? OP_USUARIO_INEXISTENTE : OP_SEM_EXEMPLARES;
+    } else {
+        pthread_mutex_lock(&b->travaEmprestimos);
+        r = emprestarNaData(b, idLivro, idUsuario, time(NULL));
+        pthread_mutex_unlock(&b->travaEmprestimos);
+    }
+    pthread_rwlock_unlock(&b->travaAcervo);
+    return r;
+}
+
+/* Mesmas regras de realizarEmprestimo, com a data dada (o lote usa uma só para tudo) */
+static int emprestarNaData(Biblioteca* b, int idLivro, int idUsuario, time_t data) {
+    int idxL = indiceIdBuscar(&b->idxLivros, idLivro);
+    if (idxL < 0) return OP_LIVRO_INEXISTENTE;
+    if (indiceIdBuscar(&b->idxUsuarios, idUsuario) < 0) return OP_USUARIO_INEXISTENTE;
+    if (b->livros[idxL].disponiveis <= 0) return OP_SEM_EXEMPLARES;
+    if (contarEmprestimosDoUsuario(&b->emps, idUsuario) >= LIMITE_EMPRESTIMOS) return OP_LIMITE_USUARIO;
+    return efetivarEmprestimo(b, idxL, idUsuario, data);
+}
+
+/* Registra o empréstimo já validado do livro na posição idxL */
+static int efetivarEmprestimo(Biblioteca* b, int idxL, int idUsuario, time_t data) {
+    Emprestimo e;
+    e.id = b->emps.maiorId + 1;
+    e.idLivro = b->livros[idxL].id;
+    e.idUsuario = idUsuario;
+    e.data = data;
+    e.ativo = 1;
+
+    if (registroInserir(&b->emps, e) < 0) return OP_SEM_MEMORIA;
+
+    /* Atualização por referência: reduz disponíveis do livro (lido sem trava por outras threads) */
+    __atomic_sub_fetch(&b->livros[idxL].disponiveis, 1, __ATOMIC_RELEASE);
+    b->agregados.disponiveis--;
+    analiseRegistrar(&b->analise, &e);
+    return e.id;
+}
+
+/* Não imprime nada. Retorna OP_OK (ou, se o exemplar foi repassado à fila de reservas, o id
+   do novo empréstimo) ou um OP_* negativo. Depois de registrada, a devolução não falha mais.
+   Segura para várias threads: devolução e repasse à fila vão juntos em travaEmprestimos,
+   então ninguém pega de passagem o exemplar que a fila vai receber. */
+int devolverEmprestimo(Biblioteca* b, int idEmprestimo) {
+    int r = OP_EMPRESTIMO_INEXISTENTE;
+    pthread_rwlock_rdlock(&b->travaAcervo);
+    pthread_mutex_lock(&b->travaEmprestimos);
+    int slot = buscarEmprestimoAtivo(&b->emps, idEmprestimo);
+    if (slot >= 0) {
+        int idLivro = slotEmprestimo(&b->emps, slot)->idLivro;
+        r = fecharEmprestimo(b, slot);
+        if (r == OP_OK) r = atenderReserva(b, idLivro, time(NULL));
+    }
+    pthread_mutex_unlock(&b->travaEmprestimos);
+    pthread_rwlock_unlock(&b->travaAcervo);
+    return r;
+}
+
+/* Atualização por referência: arquiva o empréstimo do slot e devolve o exemplar */
+static int fecharEmprestimo(Biblioteca* b, int slot) {
+    int idxL = indiceIdBuscar(&b->idxLivros, slotEmprestimo(&b->emps, slot)->idLivro);
+    if (idxL < 0) return OP_LIVRO_INEXISTENTE;
+    if (!registroFechar(&b->emps, slot)) return OP_SEM_MEMORIA;
+    __atomic_add_fetch(&b->livros[idxL].disponiveis, 1, __ATOMIC_RELEASE);
+    b->agregados.disponiveis++;
+    return OP_OK;
+}
+
+/* ---------------------- Transações em lote ---------------------- */
+/* Garante n marcas; o trecho novo fica zerado (a época 0 nunca é a de um lote) */
+static int loteMarcas(MarcaLote** v, int* cap, int n) {
+    if (n <= *cap) return 1;
+    int novoCap = *cap > 64 ? *cap : 64;
+    while (novoCap < n) novoCap = novoCap > 0x3fffffff ? n : novoCap * 2;
+    MarcaLote* temp = (MarcaLote*)realloc(*v, (size_t)novoCap * sizeof(MarcaLote));
+    if (!temp) return 0;
+    memset(temp + *cap, 0, (size_t)(novoCap - *cap) * sizeof(MarcaLote));
+    *v = temp;
+    *cap = novoCap;
+    return 1;
+}
+
+/* Prepara a memória de trabalho para n operações e começa uma época nova */
+static int loteIniciar(Biblioteca* b, int n) {
+    TrabalhoLote* t = &b->lote;
+    if (n > 0x7fffffff / 3 || !loteMarcas(&t->livros, &t->capLivros, b->nLiv) ||
+        !loteMarcas(&t->usuarios, &t->capUsuarios, b->nUsu) ||
+        !loteMarcas(&t->slots, &t->capSlots, b->emps.usados)) return 0;
+    int* temp = (int*)reservarVetor(t->porOp, &t->capPorOp, 3 * (n > 0 ? n : 1), sizeof(int));
+    if (!temp) return 0;
+    t->porOp = temp;
+    if (++t->epoca == 0) { /* deu a volta: marcas antigas poderiam parecer atuais */
+        memset(t->livros, 0, (size_t)t->capLivros * sizeof(MarcaLote));
+        memset(t->usuarios, 0, (size_t)t->capUsuarios * sizeof(MarcaLote));
+        memset(t->slots, 0, (size_t)t->capSlots * sizeof(MarcaLote));
+        t->epoca = 1;
+    }
+    return 1;
+}
+
+/* Executa empréstimos e devoluções como uma unidade: tudo ou nada.
+   1) valida em ordem contra o estado atual mais o efeito das operações anteriores do
+      lote (exemplares por livro, cota por usuário, empréstimo devolvido uma vez só). O
+      estado de cada livro e usuário é lido uma vez e acompanhado em marcas por posição;
+   2) reserva de uma vez a memória do lote inteiro (pool, índices, histórico);
+   3) aplica sem mais verificações, com uma única leitura do relógio; a cota de cada
+      usuário no índice é gravada uma vez no fim, não a cada operação.
+   A memória de trabalho fica na Biblioteca e é reaproveitada: um lote não aloca nada
+   enquanto acervo e lote não crescem.
+   Devolução de livro com fila não libera exemplar para o próprio lote: ele vai para a
+   fila depois que o lote termina. Devoluções só valem para empréstimos abertos antes do lote.
+   Retorna OP_OK e preenche resultados[i] (id do empréstimo criado; nas devoluções,
+   OP_OK ou o id repassado à reserva), ou o motivo da recusa com *posFalha = índice da
+   operação e nenhum efeito no estado. Segura para várias threads: o lote inteiro, da
+   validação ao fim, fica sob travaEmprestimos. */
+int executarLote(Biblioteca* b, const OperacaoLote* ops, int n, int* resultados, int* posFalha) {
+    pthread_rwlock_rdlock(&b->travaAcervo);
+    pthread_mutex_lock(&b->travaEmprestimos);
+    int r = aplicarLote(b, ops, n, resultados, posFalha);
+    pthread_mutex_unlock(&b->travaEmprestimos);
+    pthread_rwlock_unlock(&b->travaAcervo);
+    return r;
+}
+
+/* executarLote com as travas já tomadas */
+static int aplicarLote(Biblioteca* b, const OperacaoLote* ops, int n, int* resultados, int* posFalha) {
+    TrabalhoLote* t = &b->lote;
+    RegistroEmprestimos* reg = &b->emps;
+    int nEmprestar = 0, nDevolver = 0, nComFila = 0, nTocados = 0;
+    int r = OP_OK;
+    *posFalha = 0;
+    if (!loteIniciar(b, n)) {
+        if (n > 0) resultados[0] = OP_SEM_MEMORIA;
+        return OP_SEM_MEMORIA;
+    }
+    unsigned ep = t->epoca;
+    int* pos = t->porOp;           /* livro a emprestar ou slot a devolver */
+    int* livroOp = t->porOp + n;   /* posição do livro da operação */
+    int* tocados = t->porOp + 2 * n; /* usuários cuja cota o lote muda */
+
+    for (int i = 0; i < n && r == OP_OK; i++) {
+        const OperacaoLote* op = &ops[i];
+        int idxL, idxU;
+        *posFalha = i;
+        if (op->tipo == LOTE_EMPRESTAR) {
+            idxL = indiceIdBuscar(&b->idxLivros, op->id);
+            if (idxL < 0) { r = OP_LIVRO_INEXISTENTE; break; }
+            idxU = indiceIdBuscar(&b->idxUsuarios, op->idUsuario);
+            if (idxU < 0) { r = OP_USUARIO_INEXISTENTE; break; }
+            pos[i] = idxL;
+        } else if (op->tipo == LOTE_DEVOLVER) {
+            int slot = buscarEmprestimoAtivo(reg, op->id);
+            if (slot < 0 || t->slots[slot].epoca == ep) { r = OP_EMPRESTIMO_INEXISTENTE; break; }
+            const Emprestimo* e = slotEmprestimo(reg, slot);
+            idxL = indiceIdBuscar(&b->idxLivros, e->idLivro);
+            if (idxL < 0) { r = OP_LIVRO_INEXISTENTE; break; }
+            idxU = indiceIdBuscar(&b->idxUsuarios, e->idUsuario);
+            if (idxU < 0) { r = OP_USUARIO_INEXISTENTE; break; }
+            t->slots[slot].epoca = ep;
+            pos[i] = slot;
+        } else {
+            r = OP_OPERACAO_INVALIDA;
+            break;
+        }
+        MarcaLote* mL = &t->livros[idxL];
+        MarcaLote* mU = &t->usuarios[idxU];
+        if (mL->epoca != ep) { mL->epoca = ep; mL->valor = b->livros[idxL].disponiveis; }
+        if (mU->epoca != ep) {
+            mU->epoca = ep;
+            mU->valor = contarEmprestimosDoUsuario(reg, b->usuarios[idxU].id);
+            tocados[nTocados++] = idxU;
+        }
+        livroOp[i] = idxL;
+        if (op->tipo == LOTE_EMPRESTAR) {
+            if (mL->valor <= 0) { r = OP_SEM_EXEMPLARES; break; }
+            if (mU->valor >= LIMITE_EMPRESTIMOS) { r = OP_LIMITE_USUARIO; break; }
+            mL->valor--;
+            mU->valor++;
+            nEmprestar++;
+        } else {
+            if (indiceIdBuscar(&b->reservas.caudas, b->livros[idxL].id) < 0) mL->valor++;
+            else nComFila++;
+            mU->valor--;
+            nDevolver++;
+        }
+    }
+    if (r != OP_OK) {
+        if (*posFalha < n) resultados[*posFalha] = r;
+        return r;
+    }
+    /* as reservas atendidas no fim também criam empréstimos */
+    if (!registroReservar(reg, nEmprestar + nComFila, nDevolver)) {
+        *posFalha = 0;
+        if (n > 0) resultados[0] = OP_SEM_MEMORIA;
+        return OP_SEM_MEMORIA;
+    }
+    *posFalha = -1;
+
+    time_t agora = time(NULL);
+    for (int i = 0; i < n; i++) {
+        Livro* l = &b->livros[livroOp[i]];
+        if (ops[i].tipo == LOTE_EMPRESTAR) {
+            Emprestimo e;
+            e.id = reg->maiorId + 1;
+            e.idLivro = l->id;
+            e.idUsuario = ops[i].idUsuario;
+            e.data = agora;
+            e.ativo = 1;
+            inserirAtivo(reg, e, 0);
+            __atomic_sub_fetch(&l->disponiveis, 1, __ATOMIC_RELEASE);
+            analiseRegistrar(&b->analise, &e);
+            resultados[i] = e.id;
+        } else {
+            fecharSlot(reg, pos[i], 0);
+            __atomic_add_fetch(&l->disponiveis, 1, __ATOMIC_RELEASE);
+            resultados[i] = OP_OK;
+        }
+    }
+    b->agregados.disponiveis += nDevolver - nEmprestar;
+    for (int k = 0; k < nTocados; k++) { /* cota: uma escrita por usuário tocado */
+        int idU = b->usuarios[tocados[k]].id, ativos = t->usuarios[tocados[k]].valor;
+        if (ativos > 0) indiceIdDefinir(&reg->ativosUsuario, idU, ativos);
+        else indiceIdRemover(&reg->ativosUsuario, idU);
+    }
+    for (int i = 0; nComFila > 0 && i < n; i++) {
+        int idLivro = b->livros[livroOp[i]].id;
+        if (ops[i].tipo == LOTE_DEVOLVER && indiceIdBuscar(&b->reservas.caudas, idLivro) >= 0)
+            resultados[i] = atenderReserva(b, idLivro, agora);
+    }
+    return OP_OK;
+}
+
+/* ---------------------- Reservas ---------------------- */
+/* O usuário está com algum exemplar do livro? Percorre só os ativos dele (no máximo
+   LIMITE_EMPRESTIMOS). */
+static int usuarioComLivro(const RegistroEmprestimos* r, int idUsuario, int idLivro) {
+    for (int s = primeiroDoUsuario(r, idUsuario); s >= 0; s = proximoDoUsuario(r, s))
+        if (slotEmprestimo(r, s)->idLivro == idLivro) return 1;
+    return 0;
+}
+
+/* O usuário já espera por este livro? Percorre só as reservas dele. */
+static int usuarioNaFila(const Reservas* r, int idLivro, int idUsuario) {
+    for (int no = indiceIdBuscar(&r->porUsuario, idUsuario); no >= 0; no = r->nos[no].proxUsu)
+        if (r->nos[no].idLivro == idLivro) return 1;
+    return 0;
+}
+
+/* Entra no fim da fila do livro. Só vale para livro sem exemplar disponível
+   (senão é empréstimo direto), para quem ainda não está na fila e para quem não está
+   com um exemplar dele. Retorna OP_OK ou um OP_* negativo. Segura para várias threads. */
+int reservarLivro(Biblioteca* b, int idLivro, int idUsuario) {
+    pthread_rwlock_rdlock(&b->travaAcervo);
+    pthread_mutex_lock(&b->travaEmprestimos);
+    int r = entrarNaFila(b, idLivro, idUsuario);
+    pthread_mutex_unlock(&b->travaEmprestimos);
+    pthread_rwlock_unlock(&b->travaAcervo);
+    return r;
+}
+
+/* reservarLivro com as travas já tomadas */
+static int entrarNaFila(Biblioteca* b, int idLivro, int idUsuario) {
+    Reservas* r = &b->reservas;
+    int idxL = indiceIdBuscar(&b->idxLivros, idLivro);
+    if (idxL < 0) return OP_LIVRO_INEXISTENTE;
+    if (indiceIdBuscar(&b->idxUsuarios, idUsuario) < 0) return OP_USUARIO_INEXISTENTE;
+    if (b->livros[idxL].disponiveis > 0) return OP_LIVRO_DISPONIVEL;
+    if (b->livros[idxL].exemplares == 0) return OP_SEM_EXEMPLARES; /* nunca seria atendida */
+    if (usuarioComLivro(&b->emps, idUsuario, idLivro)) return OP_JA_TEM_LIVRO;
+    if (usuarioNaFila(r, idLivro, idUsuario)) return OP_JA_NA_FILA;
+
+    int no = r->livre;
+    if (no < 0) {
+        if (r->nNos == r->capNos) {
+            int novoCap = r->capNos ? r->capNos * 2 : 64;
+            NoReserva* temp = (NoReserva*)realloc(r->nos, novoCap * sizeof(NoReserva));
+            if (!temp) return OP_SEM_MEMORIA;
+            r->nos = temp;
+            r->capNos = novoCap;
+        }
+        no = r->nNos;
+    }
+    if (!indiceIdReservar(&r->caudas, r->caudas.n + 1) ||
+        !indiceIdReservar(&r->porUsuario, r->porUsuario.n + 1)) return OP_SEM_MEMORIA;
+    if (no == r->livre) r->livre = r->nos[no].prox;
+    else r->nNos++;
+
+    int cauda = indiceIdBuscar(&r->caudas, idLivro);
+    r->nos[no].idUsuario = idUsuario;
+    r->nos[no].idLivro = idLivro;
+    if (cauda < 0) {
+        r->nos[no].prox = no; /* fila de um só: ele é cabeça e cauda */
+    } else {
+        r->nos[no].prox = r->nos[cauda].prox;
+        r->nos[cauda].prox = no;
+    }
+    indiceIdDefinir(&r->caudas, idLivro, no);
+
+    int primeiro = indiceIdBuscar(&r->porUsuario, idUsuario);
+    r->nos[no].antUsu = -1;
+    r->nos[no].proxUsu = primeiro;
+    if (primeiro >= 0) r->nos[primeiro].antUsu = no;
+    indiceIdDefinir(&r->porUsuario, idUsuario, no);
+    r->total++;
+    return OP_OK;
+}
+
+/* Tira o nó no (que vem logo depois de ant) da fila do livro e da lista do usuário.
+   Com folga de uma entrada nos dois índices (ver atenderReserva), não aloca. */
+static void tirarDaFila(Reservas* r, int idLivro, int ant, int no) {
+    NoReserva* n = &r->nos[no];
+    if (ant == no) {
+        indiceIdRemover(&r->caudas, idLivro); /* era o único */
+    } else {
+        r->nos[ant].prox = n->prox;
+        if (indiceIdBuscar(&r->caudas, idLivro) == no) indiceIdDefinir(&r->caudas, idLivro, ant);
+    }
+    if (n->antUsu >= 0) r->nos[n->antUsu].proxUsu = n->proxUsu;
+    else if (n->proxUsu >= 0) indiceIdDefinir(&r->porUsuario, n->idUsuario, n->proxUsu);
+    else indiceIdRemover(&r->porUsuario, n->idUsuario);
+    if (n->proxUsu >= 0) r->nos[n->proxUsu].antUsu = n->antUsu;
+    n->prox = r->livre;
+    r->livre = no;
+    r->total--;
+}
+
+/* Entrega o exemplar que acabou de voltar ao primeiro da fila que pode levá-lo. Quem está
+   no limite de empréstimos é pulado e continua na fila, na mesma posição; quem já está
+   com um exemplar (pegou direto quando sobrou um) tem a reserva dada por cumprida. No
+   pior caso (todos no limite) a fila inteira é percorrida e o exemplar volta ao acervo.
+   A memória do empréstimo e a folga dos índices são reservadas antes de mexer na fila;
+   se faltar, a fila fica intacta e o exemplar simplesmente volta ao acervo (a devolução
+   já foi registrada e não é desfeita). O empréstimo leva a data dada.
+   Retorna o id do novo empréstimo ou OP_OK. */
+static int atenderReserva(Biblioteca* b, int idLivro, time_t data) {
+    Reservas* rs = &b->reservas;
+    int cauda = indiceIdBuscar(&rs->caudas, idLivro);
+    if (cauda < 0 || !registroReservar(&b->emps, 1, 0) || !indiceIdReservar(&rs->caudas, rs->caudas.n + 1) ||
+        !indiceIdReservar(&rs->porUsuario, rs->porUsuario.n + 1)) return OP_OK;
+    int ant = cauda, ultimo = 0;
+    while (!ultimo && indiceIdBuscar(&rs->caudas, idLivro) >= 0) {
+        int no = rs->nos[ant].prox;
+        int idUsuario = rs->nos[no].idUsuario;
+        ultimo = no == cauda;
+        if (usuarioComLivro(&b->emps, idUsuario, idLivro)) {
+            tirarDaFila(rs, idLivro, ant, no);
+            continue;
+        }
+        int r = emprestarNaData(b, idLivro, idUsuario, data);
+        if (r > 0) {
+            tirarDaFila(rs, idLivro, ant, no);
+            return r;
+        }
+        if (r != OP_LIMITE_USUARIO) break; /* não deveria ocorrer; a fila fica como está */
+        ant = no;
+    }
+    return OP_OK;
+}
+
+/* Copia até max ids da fila do livro, na ordem de atendimento. Retorna o tamanho da fila. */
+int filaReservas(const Reservas* r, int idLivro, int* usuarios, int max) {
+    int cauda = indiceIdBuscar(&r->caudas, idLivro);
+    if (cauda < 0) return 0;
+    int n = 0, no = cauda;
+    do {
+        no = r->nos[no].prox;
+        if (n < max) usuarios[n] = r->nos[no].idUsuario;
+        n++;
+    } while (no != cauda);
+    return n;
+}
+
+void reservasLiberar(Reservas* r) {
+    free(r->nos);
+    indiceIdLiberar(&r->caudas);
+    indiceIdLiberar(&r->porUsuario);
+    memset(r, 0, sizeof(*r));
+    r->livre = -1;
+}
+
+/* ---------------------- Análise de circulação ---------------------- */
+/* Min-heap por contagem: a raiz é o candidato a sair quando chega um id novo */
+static void topTrocar(TopFrequentes* t, int i, int j) {
+    ContadorTop tmp = t->heap[i];
+    t->heap[i] = t->heap[j];
+    t->heap[j] = tmp;
+    indiceIdDefinir(&t->pos, t->heap[i].id, i);
+    indiceIdDefinir(&t->pos, t->heap[j].id, j);
+}
+
+static void topDescer(TopFrequentes* t, int i) {
+    for (;;) {
+        int menor = i, e = 2 * i + 1, d = e + 1;
+        if (e < t->n && t->heap[e].contagem < t->heap[menor].contagem) menor = e;
+        if (d < t->n && t->heap[d].contagem < t->heap[menor].contagem) menor = d;
+        if (menor == i) return;
+        topTrocar(t, i, menor);
+        i = menor;
+    }
+}
+
+static void topSubir(TopFrequentes* t, int i) {
+    while (i > 0 && t->heap[(i - 1) / 2].contagem > t->heap[i].contagem) {
+        topTrocar(t, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/* Uma linha do count-min por semente; a largura é potência de 2 */
+static unsigned cmColuna(int id, int linhaCm) {
+    static const unsigned sementes[CM_PROFUNDIDADE] = { 0x9e3779b1u, 0x85ebca77u, 0xc2b2ae3du, 0x27d4eb2fu };
+    unsigned h = (unsigned)id * sementes[linhaCm];
+    return (h ^ (h >> 15)) & (CM_LARGURA - 1);
+}
+
+/* Conta uma ocorrência: só sobem os contadores que estão no mínimo (atualização
+   conservadora) e o id entra no heap se passar a menor estimativa guardada.
+   Custo O(CM_PROFUNDIDADE + log ANALISE_TOP), independente do volume. */
+static void topRegistrar(TopFrequentes* t, int id) {
+    unsigned* c[CM_PROFUNDIDADE];
+    unsigned menor = 0xffffffffu;
+    for (int l = 0; l < CM_PROFUNDIDADE; l++) {
+        c[l] = &t->cm[l * CM_LARGURA + cmColuna(id, l)];
+        if (*c[l] < menor) menor = *c[l];
+    }
+    for (int l = 0; l < CM_PROFUNDIDADE; l++) if (*c[l] == menor) (*c[l])++;
+    long est = (long)menor + 1;
+
+    int i = indiceIdBuscar(&t->pos, id);
+    if (i >= 0) {
+        t->heap[i].contagem = est;
+        topDescer(t, i);
+    } else if (t->n < ANALISE_TOP) {
+        i = t->n++;
+        t->heap[i].id = id;
+        t->heap[i].contagem = est;
+        indiceIdInserir(&t->pos, id, i);
+        topSubir(t, i);
+    } else if (est > t->heap[0].contagem) {
+        indiceIdRemover(&t->pos, t->heap[0].id);
+        t->heap[0].id = id;
+        t->heap[0].contagem = est;
+        indiceIdInserir(&t->pos, id, 0);
+        topDescer(t, 0);
+    }
+}
+
+static int compararContadorDesc(const void* a, const void* b) {
+    long x = ((const ContadorTop*)a)->contagem, y = ((const ContadorTop*)b)->contagem;
+    return (x < y) - (x > y);
+}
+
+/* Copia os k mais frequentes em ordem decrescente. Retorna quantos copiou. */
+int analiseTop(const TopFrequentes* t, ContadorTop* saida, int k) {
+    ContadorTop copia[ANALISE_TOP];
+    memcpy(copia, t->heap, (size_t)t->n * sizeof(ContadorTop));
+    qsort(copia, (size_t)t->n, sizeof(ContadorTop), compararContadorDesc);
+    if (k > t->n) k = t->n;
+    memcpy(saida, copia, (size_t)k * sizeof(ContadorTop));
+    return k;
+}
+
+static int topIniciar(TopFrequentes* t) {
+    t->cm = (unsigned*)calloc((size_t)CM_PROFUNDIDADE * CM_LARGURA, sizeof(unsigned));
+    return t->cm != NULL && indiceIdReservar(&t->pos, ANALISE_TOP);
+}
+
+int analiseIniciar(AnaliseCirculacao* a) {
+    memset(a, 0, sizeof(*a));
+    return topIniciar(&a->livros) && topIniciar(&a->usuarios);
+}
+
+void analiseLiberar(AnaliseCirculacao* a) {
+    free(a->livros.cm);
+    free(a->usuarios.cm);
+    indiceIdLiberar(&a->livros.pos);
+    indiceIdLiberar(&a->usuarios.pos);
+    memset(a, 0, sizeof(*a));
+}
+
+/* Chamado a cada empréstimo: memória e custo fixos, independentes do histórico */
+void analiseRegistrar(AnaliseCirculacao* a, const Emprestimo* e) {
+    a->total++;
+    topRegistrar(&a->livros, e->idLivro);
+    topRegistrar(&a->usuarios, e->idUsuario);
+
+    /* anel de horas: o balde é reaproveitado quando chega uma hora mais nova */
+    long hora = (long)(e->data / 3600);
+    int i = (int)(hora % ANALISE_HORAS);
+    if (a->horaBalde[i] < hora) {
+        a->horaBalde[i] = hora;
+        a->porHora[i] = 0;
+    }
+    if (a->horaBalde[i] == hora) a->porHora[i]++;
+}
+
+/* Ocorrências do id desde o início (nunca subestima; excesso típico <= total * e / CM_LARGURA) */
+long analiseEstimativa(const TopFrequentes* t, int id) {
+    unsigned menor = 0xffffffffu;
+    for (int i = 0; i < CM_PROFUNDIDADE; i++) {
+        unsigned v = t->cm[i * CM_LARGURA + cmColuna(id, i)];
+        if (v < menor) menor = v;
+    }
+    return (long)menor;
+}
+
+/* Empréstimos na hora que contém t (0 se ela já saiu da janela) */
+long analiseNaHora(const AnaliseCirculacao* a, time_t t) {
+    long hora = (long)(t / 3600);
+    int i = (int)(hora % ANALISE_HORAS);
+    return a->horaBalde[i] == hora ? a->porHora[i] : 0;
+}
+
+void exibirPainelCirculacao(const Biblioteca* b, time_t agora) {
+    const AnaliseCirculacao* a = &b->analise;
+    ContadorTop top[10];
+    titulo("PAINEL DE CIRCULACAO");
+    printf("Emprestimos registrados: %ld\n", a->total);
+
+    int n = analiseTop(&a->livros, top, 10);
+    puts("Livros mais emprestados (contagem estimada):");
+    for (int i = 0; i < n; i++) {
+        int iL = indiceIdBuscar(&b->idxLivros, top[i].id);
+        printf("  %2d. #%d %s - %ld\n", i + 1, top[i].id, iL >= 0 ? b->livros[iL].titulo : "<removido>", top[i].contagem);
+    }
+    n = analiseTop(&a->usuarios, top, 10);
+    puts("Usuarios mais ativos:");
+    for (int i = 0; i < n; i++) {
+        int iU = indiceIdBuscar(&b->idxUsuarios, top[i].id);
+        printf("  %2d. #%d %s - %ld\n", i + 1, top[i].id, iU >= 0 ? b->usuarios[iU].nome : "<removido>", top[i].contagem);
+    }
+    puts("Emprestimos nas ultimas 24 horas:");
+    long soma = 0;
+    for (int h = 23; h >= 0; h--) {
+        time_t t = agora - (time_t)h * 3600;
+        long q = analiseNaHora(a, t);
+        soma += q;
+        if (q == 0) continue;
+        char quando[20];
+        formatarData(t - t % 3600, quando, sizeof(quando));
+        printf("  %s  %ld\n", quando, q);
+    }
+    printf("  total: %ld\n", soma);
+}
+
+/* ---------------------- Índices ordenados ---------------------- */
+/* Compara até max bytes sem diferenciar maiúsculas (ASCII; UTF-8 pelo valor do byte) */
+static int compararSemCaixa(const char* a, const char* b, size_t max) {
+    for (size_t i = 0; i < max; i++) {
+        int ca = tolower((unsigned char)a[i]), cb = tolower((unsigned char)b[i]);
+        if (ca != cb || ca == 0) return ca - cb;
+    }
+    return 0;
+}
+
+/* O que se procura no índice: um livro exato (pos >= 0, inclui o desempate) ou só a chave
+   (texto ou ano). Com prefixo, o texto do livro é cortado no tamanho da sonda. */
+typedef struct {
+    int pos;
+    const char* texto;
+    int ano;
+    int prefixo;
+} SondaOrdem;
+
+/* Compara a chave da entrada com a sonda: < 0 se a entrada vem antes */
+static int ordemComparar(int chave, const Livro* v, int entrada, const SondaOrdem* s) {
+    const Livro* l = &v[entrada];
+    int c;
+    if (s->pos >= 0) {
+        const Livro* o = &v[s->pos];
+        if (chave == ORDEM_ANO) c = (l->ano > o->ano) - (l->ano < o->ano);
+        else c = chave == ORDEM_TITULO ? compararSemCaixa(l->titulo, o->titulo, (size_t)-1)
+                                       : compararSemCaixa(l->autor, o->autor, (size_t)-1);
+        return c ? c : (entrada > s->pos) - (entrada < s->pos);
+    }
+    if (chave == ORDEM_ANO) return (l->ano > s->ano) - (l->ano < s->ano);
+    return compararSemCaixa(chave == ORDEM_TITULO ? l->titulo : l->autor, s->texto,
+                            s->prefixo ? strlen(s->texto) : (size_t)-1);
+}
+
+/* Primeira entrada >= sonda. folha == nFolhas quando todas vêm antes. */
+static void ordemLimiteInferior(const IndiceOrdenado* ix, const Livro* v, const SondaOrdem* s, CursorOrdem* c) {
+    int lo = 0, hi = ix->nFolhas;
+    while (lo < hi) { /* primeira folha cuja última entrada não vem antes da sonda */
+        int meio = lo + (hi - lo) / 2;
+        const FolhaOrdem* f = ix->folhas[meio];
+        if (ordemComparar(ix->chave, v, f->pos[f->n - 1], s) < 0) lo = meio + 1;
+        else hi = meio;
+    }
+    c->folha = lo;
+    c->i = 0;
+    if (lo == ix->nFolhas) return;
+    const FolhaOrdem* f = ix->folhas[lo];
+    int a = 0, z = f->n;
+    while (a < z) {
+        int meio = a + (z - a) / 2;
+        if (ordemComparar(ix->chave, v, f->pos[meio], s) < 0) a = meio + 1;
+        else z = meio;
+    }
+    c->i = a;
+}
+
+/* Garante espaço para uma inserção (diretório e folha de split) */
+static int ordemPreparar(IndiceOrdenado* ix) {
+    if (ix->nFolhas + 1 > ix->capFolhas) {
+        int novoCap = ix->capFolhas ? ix->capFolhas * 2 : 16;
+        FolhaOrdem** temp = (FolhaOrdem**)realloc(ix->folhas, novoCap * sizeof(FolhaOrdem*));
+        if (!temp) return 0;
+        ix->folhas = temp;
+        ix->capFolhas = novoCap;
+    }
+    if (!ix->reserva) ix->reserva = (FolhaOrdem*)malloc(sizeof(FolhaOrdem));
+    return ix->reserva != NULL;
+}
+
+/* Insere a posição do livro mantendo a ordem; com ordemPreparar já feito, não falha */
+static void ordemColocar(IndiceOrdenado* ix, const Livro* v, int pos) {
+    SondaOrdem s = { pos, NULL, 0, 0 };
+    CursorOrdem c;
+    if (ix->nFolhas == 0) {
+        ix->folhas[ix->nFolhas++] = ix->reserva;
+        ix->reserva = NULL;
+        ix->folhas[0]->n = 0;
+    }
+    ordemLimiteInferior(ix, v, &s, &c);
+    if (c.folha == ix->nFolhas) { /* depois de todas: fim da última folha */
+        c.folha = ix->nFolhas - 1;
+        c.i = ix->folhas[c.folha]->n;
+    }
+    FolhaOrdem* f = ix->folhas[c.folha];
+    if (f->n == ORDEM_FOLHA) { /* split: metade de cima vai para a folha reservada */
+        FolhaOrdem* nova = ix->reserva;
+        ix->reserva = NULL;
+        int metade = ORDEM_FOLHA / 2;
+        nova->n = ORDEM_FOLHA - metade;
+        memcpy(nova->pos, f->pos + metade, (size_t)nova->n * sizeof(int));
+        f->n = metade;
+        memmove(&ix->folhas[c.folha + 2], &ix->folhas[c.folha + 1],
+                (size_t)(ix->nFolhas - c.folha - 1) * sizeof(FolhaOrdem*));
+        ix->folhas[c.folha + 1] = nova;
+        ix->nFolhas++;
+        if (c.i > metade) { f = nova; c.i -= metade; }
+    }
+    memmove(&f->pos[c.i + 1], &f->pos[c.i], (size_t)(f->n - c.i) * sizeof(int));
+    f->pos[c.i] = pos;
+    f->n++;
+    ix->n++;
+}
+
+/* Retorna 0 sem memória (índice intacto) */
+int ordemInserir(IndiceOrdenado* ix, const Livro* v, int pos) {
+    if (!ordemPreparar(ix)) return 0;
+    ordemColocar(ix, v, pos);
+    return 1;
+}
+
+void ordemLiberar(IndiceOrdenado* ix) {
+    for (int i = 0; i < ix->nFolhas; i++) free(ix->folhas[i]);
+    free(ix->folhas);
+    free(ix->reserva);
+    int chave = ix->chave;
+    memset(ix, 0, sizeof(*ix));
+    ix->chave = chave;
+}
+
+/* Coloca o livro da posição pos nos três índices, ou em nenhum */
+int indexarLivroOrdenado(Biblioteca* b, int pos) {
+    for (int k = 0; k < ORDEM_CHAVES; k++)
+        if (!ordemPreparar(&b->ordem[k])) return 0;
+    for (int k = 0; k < ORDEM_CHAVES; k++) ordemColocar(&b->ordem[k], b->livros, pos);
+    return 1;
+}
+
+/* Tira dos índices as posições >= n0 (carga desfeita). Só filtra as folhas, sem
+   alocar, então não falha; folha que esvazia sai do diretório. */
+void descartarOrdemDesde(Biblioteca* b, int n0) {
+    for (int k = 0; k < ORDEM_CHAVES; k++) {
+        IndiceOrdenado* ix = &b->ordem[k];
+        int wf = 0;
+        for (int fi = 0; fi < ix->nFolhas; fi++) {
+            FolhaOrdem* f = ix->folhas[fi];
+            int w = 0;
+            for (int i = 0; i < f->n; i++)
+                if (f->pos[i] < n0) f->pos[w++] = f->pos[i];
+            ix->n -= f->n - w;
+            f->n = w;
+            if (w > 0) ix->folhas[wf++] = f;
+            else if (!ix->reserva) ix->reserva = f;
+            else free(f);
+        }
+        ix->nFolhas = wf;
+    }
+}
+
+/* Posiciona no primeiro livro da faixa */
+void ordemIniciar(const Biblioteca* b, const FaixaOrdem* f, CursorOrdem* c) {
+    SondaOrdem s = { -1, f->textoDe ? f->textoDe : "", f->anoDe, 0 };
+    memset(c, 0, sizeof(*c));
+    ordemLimiteInferior(&b->ordem[f->chave], b->livros, &s, c);
+}
+
+/* Paginação estável: posiciona logo depois do livro idLivro (último da página anterior).
+   Retorna 0 se o livro não existe. */
+int ordemDepoisDe(const Biblioteca* b, const FaixaOrdem* f, int idLivro, CursorOrdem* c) {
+    int pos = indiceIdBuscar(&b->idxLivros, idLivro);
+    if (pos < 0) return 0;
+    SondaOrdem s = { pos, NULL, 0, 0 };
+    memset(c, 0, sizeof(*c));
+    ordemLimiteInferior(&b->ordem[f->chave], b->livros, &s, c);
+    ordemProximo(b, f, c); /* consome o próprio livro */
+    return 1;
+}
+
+/* Posição do próximo livro da faixa em livros, ou -1 no fim */
+int ordemProximo(const Biblioteca* b, const FaixaOrdem* f, CursorOrdem* c) {
+    const IndiceOrdenado* ix = &b->ordem[f->chave];
+    if (c->fim) return -1;
+    if (c->folha < ix->nFolhas && c->i == ix->folhas[c->folha]->n) { c->folha++; c->i = 0; }
+    if (c->folha >= ix->nFolhas) { c->fim = 1; return -1; }
+    int pos = ix->folhas[c->folha]->pos[c->i++];
+    SondaOrdem s = { -1, f->textoAte, f->anoAte, 1 };
+    if (f->chave != ORDEM_ANO && (!f->textoAte || !f->textoAte[0])) return pos;
+    if (ordemComparar(f->chave, b->livros, pos, &s) > 0) { c->fim = 1; return -1; }
+    return pos;
+}
+
+/* ---------------------- Agregados ---------------------- */
+/* Só lê contadores: pode ser chamada a cada comando de monitoramento */
+void agregadosFoto(const Biblioteca* b, FotoAgregados* f) {
+    f->livros = b->nLiv;
+    f->usuarios = b->nUsu;
+    f->exemplares = b->agregados.exemplares;
+    f->disponiveis = b->agregados.disponiveis;
+    f->ativos = b->emps.nAtivos;
+    f->devolvidos = b->emps.hist.n;
+    f->usuariosComEmprestimo = b->emps.porUsuario.n;
+    f->livrosEmprestados = b->emps.porLivro.n;
+    f->reservas = b->reservas.total;
+}
+
+/* Recalcula tudo do zero (vetores, pool de ativos, histórico e filas) e compara com a foto.
+   Também confere a cota de cada usuário e, por livro, disponíveis + ativos = exemplares.
+   Retorna quantas divergências achou (0 = contadores consistentes). O(n + histórico). */
+long agregadosConferir(const Biblioteca* b, FotoAgregados* rc) {
+    const RegistroEmprestimos* r = &b->emps;
+    FotoAgregados f;
+    long erros = 0;
+    agregadosFoto(b, &f);
+    memset(rc, 0, sizeof(*rc));
+    rc->livros = b->nLiv;
+    rc->usuarios = b->nUsu;
+
+    int* porLivro = (int*)calloc(b->nLiv > 0 ? b->nLiv : 1, sizeof(int));
+    int* porUsuario = (int*)calloc(b->nUsu > 0 ? b->nUsu : 1, sizeof(int));
+    if (!porLivro || !porUsuario) { free(porLivro); free(porUsuario); return -1; }
+    for (int s = 0; s < r->usados; s++) {
+        const Emprestimo* e = slotEmprestimo(r, s);
+        if (!e->ativo) continue;
+        rc->ativos++;
+        int iL = indiceIdBuscar(&b->idxLivros, e->idLivro);
+        int iU = indiceIdBuscar(&b->idxUsuarios, e->idUsuario);
+        if (iL >= 0 && porLivro[iL]++ == 0) rc->livrosEmprestados++;
+        if (iU >= 0 && porUsuario[iU]++ == 0) rc->usuariosComEmprestimo++;
+    }
+    for (int i = 0; i < b->nLiv; i++) {
+        const Livro* l = &b->livros[i];
+        rc->exemplares += l->exemplares;
+        rc->disponiveis += l->disponiveis;
+        if (l->disponiveis + porLivro[i] != l->exemplares) erros++;
+    }
+    for (int i = 0; i < b->nUsu; i++)
+        if (contarEmprestimosDoUsuario(r, b->usuarios[i].id) != porUsuario[i]) erros++;
+    free(porLivro);
+    free(porUsuario);
+
+    CursorHistorico c;
+    Emprestimo e;
+    memset(&c, 0, sizeof(c));
+    while (historicoLer(&r->hist, &c, &e)) rc->devolvidos++;
+
+    const IndiceId* caudas = &b->reservas.caudas;
+    for (int i = 0; i < caudas->cap; i++)
+        if (caudas->chaves[i] != 0) rc->reservas += filaReservas(&b->reservas, caudas->chaves[i], NULL, 0);
+
+    erros += (f.exemplares != rc->exemplares) + (f.disponiveis != rc->disponiveis) +
+             (f.ativos != rc->ativos) + (f.devolvidos != rc->devolvidos) +
+             (f.usuariosComEmprestimo != rc->usuariosComEmprestimo) +
+             (f.livrosEmprestados != rc->livrosEmprestados) + (f.reservas != rc->reservas);
+    return erros;
+}
+
+void exibirAgregados(const Biblioteca* b, int conferir) {
+    FotoAgregados f, rc;
+    agregadosFoto(b, &f);
+    titulo("TOTAIS DA BIBLIOTECA");
+    printf("Livros: %ld (%ld exemplares, %ld disponiveis, %ld emprestados)\n",
+           f.livros, f.exemplares, f.disponiveis, f.exemplares - f.disponiveis);
+    printf("Usuarios: %ld (%ld com emprestimo em aberto)\n", f.usuarios, f.usuariosComEmprestimo);
+    printf("Emprestimos: %ld em aberto (%ld livros distintos), %ld devolvidos\n",
+           f.ativos, f.livrosEmprestados, f.devolvidos);
+    printf("Reservas em espera: %ld\n", f.reservas);
+    if (!conferir) return;
+
+    long erros = agregadosConferir(b, &rc);
+    if (erros < 0) puts("Conferencia: memoria insuficiente.");
+    else if (erros == 0) puts("Conferencia: recontagem completa confere com os contadores.");
+    else printf("Conferencia: %ld divergencia(s)! Recontado: %ld exemplares, %ld disponiveis, "
+                "%ld ativos, %ld devolvidos, %ld reservas.\n",
+                erros, rc.exemplares, rc.disponiveis, rc.ativos, rc.devolvidos, rc.reservas);
+}
+
+/* ---------------------- Importação CSV ---------------------- */
+static int leitorAbrir(LeitorCSV* lc, const char* caminho) {
+    memset(lc, 0, sizeof(*lc));
+    lc->f = fopen(caminho, "rb");
+    if (!lc->f) return 0;
+    lc->bloco = (char*)malloc(CSV_BLOCO);
+    if (!lc->bloco) { fclose(lc->f); return 0; }
+    return 1;
+}
+
+static void leitorFechar(LeitorCSV* lc) {
+    if (lc->f) fclose(lc->f);
+    free(lc->bloco);
+    free(lc->linha);
+}
+
+static int leitorAnexar(LeitorCSV* lc, const char* p, size_t tam) {
+    if (lc->tamLinha + tam + 1 > lc->capLinha) {
+        size_t novoCap = lc->capLinha ? lc->capLinha : 256;
+        while (novoCap < lc->tamLinha + tam + 1) novoCap *= 2;
+        char* temp = (char*)realloc(lc->linha, novoCap);
+        if (!temp) { lc->erro = 1; return 0; }
+        lc->linha = temp;
+        lc->capLinha = novoCap;
+    }
+    memcpy(lc->linha + lc->tamLinha, p, tam);
+    lc->tamLinha += tam;
+    lc->linha[lc->tamLinha] = '\0';
+    return 1;
+}
+
+/* Próxima linha sem o terminador (\n ou \r\n); NULL no fim do arquivo ou em erro.
+   O ponteiro só é válido até a chamada seguinte. */
+static char* leitorProximaLinha(LeitorCSV* lc) {
+    char* resultado = NULL;
+    lc->tamLinha = 0;
+    for (;;) {
+        if (lc->pos >= lc->tamBloco) {
+            lc->tamBloco = fread(lc->bloco, 1, CSV_BLOCO, lc->f);
+            lc->pos = 0;
+            if (lc->tamBloco == 0) {
+                if (lc->tamLinha > 0) resultado = lc->linha; /* última linha sem \n */
+                break;
+            }
+        }
+        char* ini = lc->bloco + lc->pos;
+        size_t resta = lc->tamBloco - lc->pos;
+        char* nl = (char*)memchr(ini, '\n', resta);
+        if (nl && lc->tamLinha == 0) {
+            /* caso comum: linha inteira dentro do bloco, sem cópia */
+            *nl = '\0';
+            lc->pos += (size_t)(nl - ini) + 1;
+            resultado = ini;
+            break;
+        }
+        size_t pedaco = nl ? (size_t)(nl - ini) : resta;
+        if (!leitorAnexar(lc, ini, pedaco)) return NULL;
+        lc->pos += pedaco + (nl ? 1 : 0);
+        if (nl) { resultado = lc->linha; break; }
+    }
+    if (resultado) {
+        size_t tam = strlen(resultado);
+        if (tam > 0 && resultado[tam - 1] == '\r') resultado[tam - 1] = '\0';
+        lc->numLinha++;
+    }
+    return resultado;
+}
+
+/* Divide a linha no lugar. Aceita campos entre aspas com "" como escape.
+   Retorna o número de campos ou -1 se a linha estiver malformada. */
+static int dividirCampos(char* s, char** campos, int max) {
+    int n = 0;
+    for (;;) {
+        if (n == max) return -1;
+        if (*s == '"') {
+            char* w = ++s;
+            campos[n++] = w;
+            for (;;) {
+                if (*s == '\0') return -1;
+                if (*s == '"') {
+                    if (s[1] == '"') { *w++ = '"'; s += 2; continue; }
+                    s++;
+                    break;
+                }
+                *w++ = *s++;
+            }
+            char c = *s;
+            *w = '\0';
+            if (c == '\0') return n;
+            if (c != ',') return -1;
+            s++;
+        } else {
+            campos[n++] = s;
+            char* v = strchr(s, ',');
+            if (!v) return n;
+            *v = '\0';
+            s = v + 1;
+        }
+    }
+}
+
+static int lerInteiro(const char* s, long min, long max, long* out) {
+    char* fim;
+    errno = 0;
+    long v = strtol(s, &fim, 10);
+    if (fim == s || *fim != '\0' || errno != 0 || v < min || v > max) return 0;
+    *out = v;
+    return 1;
+}
+
+/* Cabeçalho: primeira linha cujo primeiro caractere não é dígito nem vazio */
+static int ehCabecalho(const LeitorCSV* lc, const char* linha) {
+    return lc->numLinha == 1 && linha[0] != '\0' && !isdigit((unsigned char)linha[0]);
+}
+
+/* Linhas estimadas pelo tamanho do arquivo, para pré-dimensionar os vetores */
+static long estimarLinhas(FILE* f, long bytesPorLinha) {
+    long tam = 0;
+    if (fseek(f, 0, SEEK_END) == 0) tam = ftell(f);
+    rewind(f);
+    return tam > 0 ? tam / bytesPorLinha + 1 : 0;
+}
+
+static int limitarDica(long dica, int atual) {
+    if (dica <= 0) return atual;
+    if (dica > 0x7fffffffL - atual) return 0x7fffffff;
+    return atual + (int)dica;
+}
+
+/* numLinha <= 0: rejeição detectada na montagem do índice, após a leitura */
+static void rejeitarLinha(RelatorioImportacao* rel, long numLinha, const char* motivo) {
+    if (rel->rejeitadas < CSV_MAX_AVISOS) {
+        if (numLinha > 0) fprintf(stderr, "Linha %ld ignorada: %s\n", numLinha, motivo);
+        else fprintf(stderr, "Registro ignorado: %s\n", motivo);
+    }
+    rel->rejeitadas++;
+}
+
+/* Formato: id,titulo,autor,ano,exemplares  (id vazio = gerado automaticamente) */
+int importarLivrosCSV(Biblioteca* b, const char* caminho, long dicaLinhas, RelatorioImportacao* rel) {
+    LeitorCSV lc;
+    memset(rel, 0, sizeof(*rel));
+    double inicio = agoraSegundos();
+    if (!leitorAbrir(&lc, caminho)) return 0;
+
+    if (dicaLinhas <= 0) dicaLinhas = estimarLinhas(lc.f, 48);
+    Livro* temp = (Livro*)reservarVetor(b->livros, &b->capLiv, limitarDica(dicaLinhas, b->nLiv), sizeof(Livro));
+    if (temp) b->livros = temp; /* sem memória para a dica: segue crescendo sob demanda */
+
+    int n0 = b->nLiv;
+    int maior0 = b->maiorIdLivro;
+    char* linha;
+    char* campos[CSV_MAX_CAMPOS];
+    while ((linha = leitorProximaLinha(&lc)) != NULL) {
+        if (ehCabecalho(&lc, linha) || linha[0] == '\0') continue;
+        rel->lidas++;
+        long id = 0, ano, ex;
+        if (dividirCampos(linha, campos, CSV_MAX_CAMPOS) != 5) { rejeitarLinha(rel, lc.numLinha, "esperados 5 campos"); continue; }
+        if (campos[0][0] != '\0' && !lerInteiro(campos[0], 1, 0x7fffffffL, &id)) { rejeitarLinha(rel, lc.numLinha, "id inválido"); continue; }
+        if (campos[1][0] == '\0') { rejeitarLinha(rel, lc.numLinha, "título vazio"); continue; }
+        if (!lerInteiro(campos[3], -9999, 9999, &ano)) { rejeitarLinha(rel, lc.numLinha, "ano inválido"); continue; }
+        if (!lerInteiro(campos[4], 0, 1000000, &ex)) { rejeitarLinha(rel, lc.numLinha, "exemplares inválidos"); continue; }
+
+        Livro novo;
+        memset(&novo, 0, sizeof(novo));
+        novo.id = (int)id;
+        novo.titulo = poolGuardar(&b->textos, campos[1]);
+        novo.autor = poolInternar(&b->textos, campos[2]);
+        novo.ano = (int)ano;
+        novo.exemplares = novo.disponiveis = (int)ex;
+        if (!novo.titulo || !novo.autor || !adicionarLivro(&b->livros, &b->nLiv, &b->capLiv, novo)) { lc.erro = 1; break; }
+    }
+
+    /* Índice montado uma única vez, já dimensionado para o total.
+       1a passada: IDs explícitos (descarta duplicados); 2a: gera IDs para os vazios. */
+    int nLidos = b->nLiv;
+    int ok = !lc.erro && indiceIdReservar(&b->idxLivros, b->nLiv);
+    int maior = b->maiorIdLivro;
+    int w = n0;
+    for (int i = n0; ok && i < b->nLiv; i++) {
+        Livro* l = &b->livros[i];
+        if (l->id != 0) {
+            int r = indiceIdInserir(&b->idxLivros, l->id, w);
+            if (r == 0) { rejeitarLinha(rel, 0, "id de livro duplicado"); continue; }
+            if (r < 0) { ok = 0; break; }
+            if (l->id > maior) maior = l->id;
+        }
+        b->livros[w++] = *l;
+    }
+    if (ok) {
+        /* ids gerados seguem o maior; esgotado o int, a linha é rejeitada (e as
+           seguintes descem uma posição, com o índice acompanhando) */
+        int fim = w;
+        w = n0;
+        for (int i = n0; i < fim; i++) {
+            Livro l = b->livros[i];
+            if (l.id == 0) {
+                if (maior == 0x7fffffff) { rejeitarLinha(rel, 0, "não há id livre para gerar"); continue; }
+                l.id = ++maior;
+                if (indiceIdInserir(&b->idxLivros, l.id, w) < 0) { ok = 0; break; }
+            } else if (w != i) {
+                indiceIdDefinir(&b->idxLivros, l.id, w);
+            }
+            b->livros[w++] = l;
+        }
+        b->nLiv = w;
+        b->maiorIdLivro = maior;
+    }
+    for (int i = n0; ok && i < b->nLiv; i++) ok = indexarLivroOrdenado(b, i);
+    for (int i = n0; ok && i < b->nLiv; i++) { /* só os livros que entraram agora */
+        b->agregados.exemplares += b->livros[i].exemplares;
+        b->agregados.disponiveis += b->livros[i].disponiveis;
+    }
+    if (!ok) {
+        /* desfaz a carga parcial: toda chave inserida aqui aponta para >= n0 e continua
+           em livros[n0..nLidos), e remover não aloca, então o desfazer não falha */
+        for (int i = n0; i < nLidos; i++) {
+            int id = b->livros[i].id;
+            if (id != 0 && indiceIdBuscar(&b->idxLivros, id) >= n0) indiceIdRemover(&b->idxLivros, id);
+        }
+        descartarOrdemDesde(b, n0);
+        b->nLiv = n0;
+        b->maiorIdLivro = maior0;
+    }
+
+    rel->aceitas = ok ? b->nLiv - n0 : 0;
+    rel->segundos = agoraSegundos() - inicio;
+    leitorFechar(&lc);
+    return ok;
+}
+
+/* Formato: id,nome  (id vazio = gerado automaticamente) */
+int importarUsuariosCSV(Biblioteca* b, const char* caminho, long dicaLinhas, RelatorioImportacao* rel) {
+    LeitorCSV lc;
+    memset(rel, 0, sizeof(*rel));
+    double inicio = agoraSegundos();
+    if (!leitorAbrir(&lc, caminho)) return 0;
+
+    if (dicaLinhas <= 0) dicaLinhas = estimarLinhas(lc.f, 20);
+    Usuario* temp = (Usuario*)reservarVetor(b->usuarios, &b->capUsu, limitarDica(dicaLinhas, b->nUsu), sizeof(Usuario));
+    if (temp) b->usuarios = temp;
+
+    int n0 = b->nUsu;
+    int maior0 = b->maiorIdUsuario;
+    char* linha;
+    char* campos[CSV_MAX_CAMPOS];
+    while ((linha = leitorProximaLinha(&lc)) != NULL) {
+        if (ehCabecalho(&lc, linha) || linha[0] == '\0') continue;
+        rel->lidas++;
+        long id = 0;
+        if (dividirCampos(linha, campos, CSV_MAX_CAMPOS) != 2) { rejeitarLinha(rel, lc.numLinha, "esperados 2 campos"); continue; }
+        if (campos[0][0] != '\0' && !lerInteiro(campos[0], 1, 0x7fffffffL, &id)) { rejeitarLinha(rel, lc.numLinha, "id inválido"); continue; }
+        if (campos[1][0] == '\0') { rejeitarLinha(rel, lc.numLinha, "nome vazio"); continue; }
+
+        Usuario novo;
+        memset(&novo, 0, sizeof(novo));
+        novo.id = (int)id;
+        novo.nome = poolGuardar(&b->textos, campos[1]);
+        if (!novo.nome || !adicionarUsuario(&b->usuarios, &b->nUsu, &b->capUsu, novo)) { lc.erro = 1; break; }
+    }
+
+    int nLidos = b->nUsu;
+    int ok = !lc.erro && indiceIdReservar(&b->idxUsuarios, b->nUsu);
+    int maior = b->maiorIdUsuario;
+    int w = n0;
+    for (int i = n0; ok && i < b->nUsu; i++) {
+        Usuario* u = &b->usuarios[i];
+        if (u->id != 0) {
+            int r = indiceIdInserir(&b->idxUsuarios, u->id, w);
+            if (r == 0) { rejeitarLinha(rel, 0, "id de usuário duplicado"); continue; }
+            if (r < 0) { ok = 0; break; }
+            if (u->id > maior) maior = u->id;
+        }
+        b->usuarios[w++] = *u;
+    }
+    if (ok) {
+        int fim = w;
+        w = n0;
+        for (int i = n0; i < fim; i++) {
+            Usuario u = b->usuarios[i];
+            if (u.id == 0) {
+                if (maior == 0x7fffffff) { rejeitarLinha(rel, 0, "não há id livre para gerar"); continue; }
+                u.id = ++maior;
+                if (indiceIdInserir(&b->idxUsuarios, u.id, w) < 0) { ok = 0; break; }
+            } else if (w != i) {
+                indiceIdDefinir(&b->idxUsuarios, u.id, w);
+            }
+            b->usuarios[w++] = u;
+        }
+        b->nUsu = w;
+        b->maiorIdUsuario = maior;
+    }
+    if (!ok) { /* mesmo desfazer seletivo dos livros */
+        for (int i = n0; i < nLidos; i++) {
+            int id = b->usuarios[i].id;
+            if (id != 0 && indiceIdBuscar(&b->idxUsuarios, id) >= n0) indiceIdRemover(&b->idxUsuarios, id);
+        }
+        b->nUsu = n0;
+        b->maiorIdUsuario = maior0;
+    }
+
+    rel->aceitas = ok ? b->nUsu - n0 : 0;
+    rel->segundos = agoraSegundos() - inicio;
+    leitorFechar(&lc);
+    return ok;
+}
+
+/* Desfaz os empréstimos em aberto de uma importação que falhou, do último para o primeiro.
+   O i-ésimo inserido tirou o slot da pilha de livres se i < nLivres0, senão da marca d'água;
+   na ordem inversa cada slot volta exatamente para onde estava. */
+static void descartarImportados(Biblioteca* b, const int* slots, int n, int nLivres0) {
+    RegistroEmprestimos* r = &b->emps;
+    for (int i = n - 1; i >= 0; i--) {
+        Emprestimo* e = slotEmprestimo(r, slots[i]);
+        int idxL = indiceIdBuscar(&b->idxLivros, e->idLivro);
+        b->livros[idxL].disponiveis++;
+        b->agregados.disponiveis++;
+        desencadearSlot(r, slots[i], 1);
+        e->ativo = 0;
+        if (i < nLivres0) r->livres[r->nLivres++] = slots[i];
+        else r->usados--;
+    }
+}
+
+/* Formato: id,idLivro,idUsuario,data(epoch),ativo
+   O histórico deve vir em ordem crescente de id (como é exportado); livro e usuário
+   precisam existir, e empréstimos em aberto consomem exemplares disponíveis.
+   Tudo ou nada: se faltar memória no meio, o que já entrou é desfeito. A análise de
+   circulação (que não tem como desfazer) só é alimentada depois que a carga deu certo. */
+int importarEmprestimosCSV(Biblioteca* b, const char* caminho, long dicaLinhas, RelatorioImportacao* rel) {
+    LeitorCSV lc;
+    memset(rel, 0, sizeof(*rel));
+    double inicio = agoraSegundos();
+    if (!leitorAbrir(&lc, caminho)) return 0;
+
+    /* o histórico compactado fica em torno de 8 bytes por registro */
+    if (dicaLinhas <= 0) dicaLinhas = estimarLinhas(lc.f, 32);
+    HistoricoEmprestimos* h = &b->emps.hist;
+    size_t desejado = h->tam + (size_t)dicaLinhas * 8;
+    if (desejado > h->cap) {
+        unsigned char* temp = (unsigned char*)realloc(h->dados, desejado);
+        if (temp) { h->dados = temp; h->cap = desejado; }
+    }
+
+    /* estado para desfazer: o histórico só cresce no fim, os ativos ficam anotados em slots */
+    HistoricoEmprestimos h0 = *h;
+    int maiorId0 = b->emps.maiorId, nLivres0 = b->emps.nLivres;
+    int* slots = NULL;
+    int nSlots = 0, capSlots = 0;
+
+    int ultimoId = b->emps.maiorId;
+    char* linha;
+    char* campos[CSV_MAX_CAMPOS];
+    while ((linha = leitorProximaLinha(&lc)) != NULL) {
+        if (ehCabecalho(&lc, linha) || linha[0] == '\0') continue;
+        rel->lidas++;
+        long id, idL, idU, data, ativo;
+        if (dividirCampos(linha, campos, CSV_MAX_CAMPOS) != 5) { rejeitarLinha(rel, lc.numLinha, "esperados 5 campos"); continue; }
+        if (!lerInteiro(campos[0], 1, 0x7fffffffL, &id) || id <= ultimoId) { rejeitarLinha(rel, lc.numLinha, "id inválido ou fora de ordem"); continue; }
+        if (!lerInteiro(campos[1], 1, 0x7fffffffL, &idL) || !lerInteiro(campos[2], 1, 0x7fffffffL, &idU)) { rejeitarLinha(rel, lc.numLinha, "ids de livro/usuário inválidos"); continue; }
+        if (!lerInteiro(campos[3], 0, 0x7fffffffL, &data)) { rejeitarLinha(rel, lc.numLinha, "data inválida"); continue; }
+        if (!lerInteiro(campos[4], 0, 1, &ativo)) { rejeitarLinha(rel, lc.numLinha, "ativo deve ser 0 ou 1"); continue; }
+
+        int idxL = indiceIdBuscar(&b->idxLivros, (int)idL);
+        if (idxL < 0 || indiceIdBuscar(&b->idxUsuarios, (int)idU) < 0) { rejeitarLinha(rel, lc.numLinha, "livro ou usuário inexistente"); continue; }
+        if (ativo && b->livros[idxL].disponiveis <= 0) { rejeitarLinha(rel, lc.numLinha, "sem exemplares para empréstimo em aberto"); continue; }
+
+        Emprestimo e;
+        e.id = (int)id;
+        e.idLivro = (int)idL;
+        e.idUsuario = (int)idU;
+        e.data = (time_t)data;
+        e.ativo = (int)ativo;
+        /* em aberto vai para o pool; devolvido direto para o histórico */
+        if (ativo) {
+            if (nSlots == capSlots) {
+                int novoCap = capSlots ? capSlots * 2 : 256;
+                int* temp = (int*)realloc(slots, (size_t)novoCap * sizeof(int));
+                if (!temp) { lc.erro = 1; break; }
+                slots = temp;
+                capSlots = novoCap;
+            }
+            int slot = registroInserir(&b->emps, e);
+            if (slot < 0) { lc.erro = 1; break; }
+            slots[nSlots++] = slot;
+            b->livros[idxL].disponiveis--;
+            b->agregados.disponiveis--;
+        } else {
+            if (!historicoAnexar(h, &e)) { lc.erro = 1; break; }
+            if (e.id > b->emps.maiorId) b->emps.maiorId = e.id;
+        }
+        ultimoId = (int)id;
+        rel->aceitas++;
+    }
+
+    int ok = !lc.erro;
+    if (!ok) {
+        descartarImportados(b, slots, nSlots, nLivres0);
+        h->tam = h0.tam;
+        h->n = h0.n;
+        h->ultimoId = h0.ultimoId;
+        h->ultimaData = h0.ultimaData;
+        b->emps.maiorId = maiorId0;
+        rel->aceitas = 0;
+    } else {
+        /* alimenta a análise na ordem do arquivo: intercala histórico novo e ativos por id */
+        CursorHistorico c = { h0.tam, h0.ultimoId, h0.ultimaData };
+        Emprestimo dev;
+        int temDev = historicoLer(h, &c, &dev);
+        for (int i = 0; i < nSlots || temDev;) {
+            const Emprestimo* at = i < nSlots ? slotEmprestimo(&b->emps, slots[i]) : NULL;
+            if (temDev && (!at || dev.id < at->id)) {
+                analiseRegistrar(&b->analise, &dev);
+                temDev = historicoLer(h, &c, &dev);
+            } else {
+                analiseRegistrar(&b->analise, at);
+                i++;
+            }
+        }
+    }
+    free(slots);
+
+    rel->segundos = agoraSegundos() - inicio;
+    leitorFechar(&lc);
+    return ok;
+}
+
+void exibirRelatorioImportacao(const char* tipo, RelatorioImportacao r) {
+    double taxa = r.segundos > 0 ? r.lidas / r.segundos : 0;
+    printf("%s: %ld linhas lidas, %ld aceitas, %ld rejeitadas em %.3f s (%.0f linhas/s)\n",
+           tipo, r.lidas, r.aceitas, r.rejeitadas, r.segundos, taxa);
+}
+
+void exibirLivro(Livro l) {
+    printf("#%d | \"%s\" (%d) - %s | ex: %d, disp: %d\n",
+           l.id, l.titulo, l.ano, l.autor, l.exemplares, l.disponiveis);
+}
+
+void exibirUsuario(Usuario u) {
+    printf("#%d | %s\n", u.id, u.nome);
+}
+
+void formatarData(time_t t, char* buf, size_t tam) {
+    struct tm* tm_info = localtime(&t);
+    strftime(buf, tam, "%d/%m/%Y %H:%M", tm_info);
+}
+
+/* dd/mm/aaaa no fuso local; fimDoDia devolve a meia-noite seguinte (limite aberto) */
+int lerDataBR(const char* s, time_t* t, int fimDoDia) {
+    int d, m, a;
+    if (sscanf(s, "%d/%d/%d", &d, &m, &a) != 3 || d < 1 || d > 31 || m < 1 || m > 12 || a < 1970) return 0;
+    struct tm tm_data;
+    memset(&tm_data, 0, sizeof(tm_data));
+    tm_data.tm_mday = d + (fimDoDia ? 1 : 0);
+    tm_data.tm_mon = m - 1;
+    tm_data.tm_year = a - 1900;
+    tm_data.tm_isdst = -1;
+    *t = mktime(&tm_data);
+    return *t != (time_t)-1;
+}
+
+
+void listarLivros(const Livro* v, int n) {
+    titulo("LIVROS");
+    if (n == 0) { puts("(vazio)"); return; }
+    Saida out;
+    FiltroRelatorio f = { FORMATO_TEXTO, NULL, 0 };
+    CursorAcervo c = { 0, 0, 0 };
+    saidaIniciar(&out, stdout);
+    relatorioLivros(&out, v, n, &f, &c, 0);
+    saidaDescarregar(&out);
+}
+
+void listarUsuarios(const Usuario* v, int n) {
+    titulo("USUÁRIOS");
+    if (n == 0) { puts("(vazio)"); return; }
+    Saida out;
+    FiltroRelatorio f = { FORMATO_TEXTO, NULL, 0 };
+    CursorAcervo c = { 0, 0, 0 };
+    saidaIniciar(&out, stdout);
+    relatorioUsuarios(&out, v, n, &f, &c, 0);
+    saidaDescarregar(&out);
+}
+
+/* Pausa entre páginas na tela. Retorna 0 se o usuário pediu para parar. */
+static int continuarPaginacao(void) {
+    printf("-- Enter para continuar, q para sair -- ");
+    int ch = getchar();
+    if (ch != '\n') limparBufferEntrada();
+    return !(ch == 'q' || ch == 'Q' || ch == EOF);
+}
+
+/* Acervo (livros ou usuários) na tela ou num arquivo; na tela tamPagina > 0 pagina */
+void exportarAcervo(const Biblioteca* b, int livros, const FiltroRelatorio* f, const char* caminho, int tamPagina) {
+    FILE* arq = stdout;
+    if (caminho && caminho[0]) {
+        arq = fopen(caminho, "w");
+        if (!arq) { perror(caminho); return; }
+        tamPagina = 0;
+    }
+    Saida* out = (Saida*)malloc(sizeof(Saida));
+    if (!out) { if (arq != stdout) fclose(arq); return; }
+    CursorAcervo c = { 0, 0, 0 };
+    double inicio = agoraSegundos();
+    saidaIniciar(out, arq);
+    while (!c.fim) {
+        if (livros) relatorioLivros(out, b->livros, b->nLiv, f, &c, tamPagina);
+        else relatorioUsuarios(out, b->usuarios, b->nUsu, f, &c, tamPagina);
+        saidaDescarregar(out);
+        if (!c.fim && tamPagina > 0 && !continuarPaginacao()) break;
+    }
+    free(out);
+    if (arq != stdout) {
+        fclose(arq);
+        double seg = agoraSegundos() - inicio;
+        printf("%ld linha(s) gravada(s) em %s em %.3f s\n", c.escritas, caminho, seg);
+    }
+}
+
+/* Acervo na ordem de um índice, só dentro da faixa, com pausa a cada tamPagina livros */
+void navegarAcervo(const Biblioteca* b, const FaixaOrdem* fx, int tamPagina) {
+    static const char* nomes[ORDEM_CHAVES] = { "TÍTULO", "AUTOR", "ANO" };
+    char cab[48];
+    snprintf(cab, sizeof(cab), "LIVROS POR %s", nomes[fx->chave]);
+    titulo(cab);
+    Saida out;
+    FiltroRelatorio f = { FORMATO_TEXTO, NULL, 0 };
+    CursorOrdem c;
+    saidaIniciar(&out, stdout);
+    ordemIniciar(b, fx, &c);
+    while (relatorioLivrosOrdenado(&out, b, fx, &f, &c, tamPagina) > 0 && tamPagina > 0 && !c.fim) {
+        saidaDescarregar(&out);
+        if (!continuarPaginacao()) break;
+    }
+    if (c.escritas == 0) saidaPrintf(&out, "(nenhum livro na faixa)\n");
+    saidaDescarregar(&out);
+}
+
+/* Em aberto primeiro (pool), depois os devolvidos (histórico).
+   tamPagina > 0 pausa a cada página (Enter continua, q encerra). */
+void listarEmprestimos(const Biblioteca* b, int tamPagina) {
+    const RegistroEmprestimos* r = &b->emps;
+    titulo("EMPRÉSTIMOS");
+    if (r->nAtivos == 0 && r->hist.n == 0) { puts("(vazio)"); return; }
+
+    Saida out;
+    CacheDatas datas;
+    CursorEmprestimos c;
+    saidaIniciar(&out, stdout);
+    cacheDatasIniciar(&datas);
+    memset(&c, 0, sizeof(c));
+    while (relatorioEmprestimos(&out, b, &c, &datas, tamPagina) > 0 && tamPagina > 0) {
+        saidaDescarregar(&out);
+        if (!continuarPaginacao()) break;
+    }
+    saidaDescarregar(&out);
+}
+
+void listarEmprestimosDoUsuario(const Biblioteca* b, int idUsuario) {
+    const RegistroEmprestimos* r = &b->emps;
+    titulo("EMPRÉSTIMOS DO USUÁRIO");
+    int s = primeiroDoUsuario(r, idUsuario);
+    if (s < 0) { puts("(nenhum em aberto)"); return; }
+
+    Saida out;
+    CacheDatas datas;
+    saidaIniciar(&out, stdout);
+    cacheDatasIniciar(&datas);
+    for (; s >= 0; s = proximoDoUsuario(r, s))
+        escreverEmprestimo(&out, b, slotEmprestimo(r, s), &datas);
+    saidaDescarregar(&out);
+}
+
+void listarEmprestimosDoLivro(const Biblioteca* b, int idLivro) {
+    const RegistroEmprestimos* r = &b->emps;
+    titulo("EXEMPLARES EMPRESTADOS");
+    int s = primeiroDoLivro(r, idLivro);
+    if (s < 0) { puts("(nenhum em aberto)"); return; }
+
+    Saida out;
+    CacheDatas datas;
+    saidaIniciar(&out, stdout);
+    cacheDatasIniciar(&datas);
+    for (; s >= 0; s = proximoDoLivro(r, s))
+        escreverEmprestimo(&out, b, slotEmprestimo(r, s), &datas);
+
+    int fila[10];
+    int n = filaReservas(&b->reservas, idLivro, fila, 10);
+    if (n > 0) {
+        saidaPrintf(&out, "Fila de reserva: %d usuario(s). Proximos:", n);
+        for (int i = 0; i < n && i < 10; i++) saidaPrintf(&out, " #%d", fila[i]);
+        saidaPrintf(&out, "\n");
+    }
+    saidaDescarregar(&out);
+}
+
+void listarEmprestimosNoPeriodo(const Biblioteca* b, time_t ini, time_t fim) {
+    titulo("EMPRÉSTIMOS EM ABERTO NO PERÍODO");
+    Saida out;
+    CacheDatas datas;
+    saidaIniciar(&out, stdout);
+    cacheDatasIniciar(&datas);
+    int n = relatorioPeriodo(&out, b, ini, fim, &datas);
+    if (n == 0) saidaPrintf(&out, "(nenhum)\n");
+    else saidaPrintf(&out, "%d emprestimo(s)\n", n);
+    saidaDescarregar(&out);
+}
+
+/* Atrasados são os ativos emprestados antes de agora - PRAZO_EMPRESTIMO.
+   apenasNovos lista só os que venceram desde o último relatório incremental e
+   avança o corte; o completo não mexe nele. Importações com datas antigas depois
+   de um corte só aparecem no relatório completo. */
+void listarAtrasados(Biblioteca* b, time_t agora, int apenasNovos) {
+    time_t limite = agora - PRAZO_EMPRESTIMO;
+    time_t desde = apenasNovos ? b->corteAtrasos : 0;
+    titulo(apenasNovos ? "NOVOS ATRASOS" : "EMPRÉSTIMOS EM ATRASO");
+    Saida out;
+    CacheDatas datas;
+    saidaIniciar(&out, stdout);
+    cacheDatasIniciar(&datas);
+    int n = relatorioPeriodo(&out, b, desde, limite, &datas);
+    if (n == 0) saidaPrintf(&out, "(nenhum)\n");
+    else saidaPrintf(&out, "%d emprestimo(s) em atraso\n", n);
+    saidaDescarregar(&out);
+    if (apenasNovos && limite > b->corteAtrasos) b->corteAtrasos = limite;
+}
+
+/* ---------------------- Relatório de empréstimos ---------------------- */
+void saidaIniciar(Saida* out, FILE* f) {
+    out->f = f;
+    out->mem = NULL;
+    out->usado = 0;
+}
+
+void saidaIniciarMemoria(Saida* out, BufferMemoria* m) {
+    out->f = NULL;
+    out->mem = m;
+    out->usado = 0;
+}
+
+/* Entrega bytes ao destino: fwrite no FILE*, ou anexa ao buffer em memória (dobrando) */
+static void saidaDespejar(Saida* out, const char* s, size_t n) {
+    if (out->f) { fwrite(s, 1, n, out->f); return; }
+    BufferMemoria* m = out->mem;
+    if (m->tam + n > m->cap) {
+        size_t novoCap = m->cap ? m->cap : 4096;
+        while (novoCap < m->tam + n) novoCap *= 2;
+        char* temp = (char*)realloc(m->dados, novoCap);
+        if (!temp) { m->erro = 1; return; }
+        m->dados = temp;
+        m->cap = novoCap;
+    }
+    memcpy(m->dados + m->tam, s, n);
+    m->tam += n;
+}
+
+void saidaDescarregar(Saida* out) {
+    if (out->usado > 0) saidaDespejar(out, out->buf, out->usado);
+    out->usado = 0;
+}
+
+void saidaPrintf(Saida* out, const char* fmt, ...) {
+    va_list ap;
+    for (int tentativa = 0; tentativa < 2; tentativa++) {
+        size_t livre = SAIDA_TAM - out->usado;
+        va_start(ap, fmt);
+        int n = vsnprintf(out->buf + out->usado, livre, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < livre) { out->usado += (size_t)n; return; }
+        saidaDescarregar(out); /* não coube: esvazia e tenta de novo */
+    }
+    va_start(ap, fmt); /* maior que o buffer inteiro: escreve direto */
+    if (out->f) {
+        vfprintf(out->f, fmt, ap);
+    } else {
+        int n = vsnprintf(NULL, 0, fmt, ap);
+        char* tmp = n >= 0 ? (char*)malloc((size_t)n + 1) : NULL;
+        va_end(ap);
+        va_start(ap, fmt);
+        if (tmp) vsnprintf(tmp, (size_t)n + 1, fmt, ap);
+        if (tmp) saidaDespejar(out, tmp, (size_t)n);
+        else out->mem->erro = 1;
+        free(tmp);
+    }
+    va_end(ap);
+}
+
+/* Cópia crua para o buffer (sem formatação) */
+void saidaTexto(Saida* out, const char* s, size_t n) {
+    if (n > SAIDA_TAM - out->usado) {
+        saidaDescarregar(out);
+        if (n > SAIDA_TAM) { saidaDespejar(out, s, n); return; }
+    }
+    memcpy(out->buf + out->usado, s, n);
+    out->usado += n;
+}
+
+void saidaInteiro(Saida* out, long v) {
+    char tmp[24];
+    int i = sizeof(tmp);
+    unsigned long u = v < 0 ? 0UL - (unsigned long)v : (unsigned long)v;
+    do { tmp[--i] = (char)('0' + u % 10); u /= 10; } while (u);
+    if (v < 0) tmp[--i] = '-';
+    saidaTexto(out, tmp + i, sizeof(tmp) - i);
+}
+
+static void saidaCadeia(Saida* out, const char* s) {
+    saidaTexto(out, s, strlen(s));
+}
+
+/* Campo CSV: entre aspas só quando tem separador, aspas ou quebra de linha */
+static void saidaCampoCSV(Saida* out, const char* s) {
+    size_t n = strcspn(s, ",\"\r\n");
+    if (s[n] == '\0') { saidaTexto(out, s, n); return; }
+    saidaTexto(out, "\"", 1);
+    for (const char* p = s; *p; p++) {
+        if (*p == '"') saidaTexto(out, "\"\"", 2);
+        else saidaTexto(out, p, 1);
+    }
+    saidaTexto(out, "\"", 1);
+}
+
+/* String JSON com aspas; controles viram \u00XX */
+static void saidaCampoJSON(Saida* out, const char* s) {
+    saidaTexto(out, "\"", 1);
+    const char* ini = s;
+    for (const char* p = s; *p; p++) {
+        unsigned char ch = (unsigned char)*p;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') continue;
+        saidaTexto(out, ini, (size_t)(p - ini));
+        if (ch == '"' || ch == '\\') {
+            char esc[2] = { '\\', (char)ch };
+            saidaTexto(out, esc, 2);
+        } else {
+            char esc[7];
+            snprintf(esc, sizeof(esc), "\\u%04x", ch);
+            saidaTexto(out, esc, 6);
+        }
+        ini = p + 1;
+    }
+    saidaCadeia(out, ini);
+    saidaTexto(out, "\"", 1);
+}
+
+/* Busca sem diferenciar maiúsculas (ASCII) */
+static int contemTrecho(const char* s, const char* trecho) {
+    size_t n = strlen(trecho);
+    for (; *s; s++) {
+        size_t i = 0;
+        while (i < n && s[i] && tolower((unsigned char)s[i]) == tolower((unsigned char)trecho[i])) i++;
+        if (i == n) return 1;
+    }
+    return n == 0;
+}
+
+/* Cabeçalho (CSV), abertura e separadores (JSON) comuns às listagens do acervo */
+static void acervoAntesDaLinha(Saida* out, const FiltroRelatorio* f, CursorAcervo* c, const char* cabecalhoCSV) {
+    if (c->escritas == 0) {
+        if (f->formato == FORMATO_CSV) saidaCadeia(out, cabecalhoCSV);
+        else if (f->formato == FORMATO_JSON) saidaTexto(out, "[\n", 2);
+    } else if (f->formato == FORMATO_JSON) {
+        saidaTexto(out, ",\n", 2);
+    }
+    c->escritas++;
+}
+
+static void acervoFechar(Saida* out, const FiltroRelatorio* f, CursorAcervo* c, const char* cabecalhoCSV) {
+    if (f->formato == FORMATO_JSON) saidaCadeia(out, c->escritas == 0 ? "[]\n" : "\n]\n");
+    else if (f->formato == FORMATO_CSV && c->escritas == 0) saidaCadeia(out, cabecalhoCSV);
+    c->fim = 1;
+}
+
+static const char* CABECALHO_LIVROS = "id,titulo,autor,ano,exemplares,disponiveis\n";
+
+static int livroPassaFiltro(const FiltroRelatorio* f, const Livro* l) {
+    if (f->apenasDisponiveis && l->disponiveis <= 0) return 0;
+    return !f->trecho || contemTrecho(l->titulo, f->trecho) || contemTrecho(l->autor, f->trecho);
+}
+
+/* Uma linha de livro no formato do filtro (sem separadores nem cabeçalho) */
+static void escreverLinhaLivro(Saida* out, const FiltroRelatorio* f, const Livro* l) {
+    if (f->formato == FORMATO_TEXTO) {
+        saidaTexto(out, "#", 1); saidaInteiro(out, l->id);
+        saidaTexto(out, " | \"", 4); saidaCadeia(out, l->titulo);
+        saidaTexto(out, "\" (", 3); saidaInteiro(out, l->ano);
+        saidaTexto(out, ") - ", 4); saidaCadeia(out, l->autor);
+        saidaTexto(out, " | ex: ", 7); saidaInteiro(out, l->exemplares);
+        saidaTexto(out, ", disp: ", 8); saidaInteiro(out, l->disponiveis);
+        saidaTexto(out, "\n", 1);
+    } else if (f->formato == FORMATO_CSV) {
+        saidaInteiro(out, l->id); saidaTexto(out, ",", 1);
+        saidaCampoCSV(out, l->titulo); saidaTexto(out, ",", 1);
+        saidaCampoCSV(out, l->autor); saidaTexto(out, ",", 1);
+        saidaInteiro(out, l->ano); saidaTexto(out, ",", 1);
+        saidaInteiro(out, l->exemplares); saidaTexto(out, ",", 1);
+        saidaInteiro(out, l->disponiveis); saidaTexto(out, "\n", 1);
+    } else {
+        saidaCadeia(out, "  {\"id\": "); saidaInteiro(out, l->id);
+        saidaCadeia(out, ", \"titulo\": "); saidaCampoJSON(out, l->titulo);
+        saidaCadeia(out, ", \"autor\": "); saidaCampoJSON(out, l->autor);
+        saidaCadeia(out, ", \"ano\": "); saidaInteiro(out, l->ano);
+        saidaCadeia(out, ", \"exemplares\": "); saidaInteiro(out, l->exemplares);
+        saidaCadeia(out, ", \"disponiveis\": "); saidaInteiro(out, l->disponiveis);
+        saidaTexto(out, "}", 1);
+    }
+}
+
+/* Escreve até tamPagina livros (<= 0: todos) que passam no filtro, a partir do cursor.
+   Retorna quantas linhas escreveu; c->fim indica que o rodapé já saiu. */
+int relatorioLivros(Saida* out, const Livro* v, int n, const FiltroRelatorio* f, CursorAcervo* c, int tamPagina) {
+    int escritas = 0;
+    while (c->pos < n && (tamPagina <= 0 || escritas < tamPagina)) {
+        const Livro* l = &v[c->pos++];
+        if (!livroPassaFiltro(f, l)) continue;
+        acervoAntesDaLinha(out, f, c, CABECALHO_LIVROS);
+        escreverLinhaLivro(out, f, l);
+        escritas++;
+    }
+    if (c->pos >= n && !c->fim) acervoFechar(out, f, c, CABECALHO_LIVROS);
+    return escritas;
+}
+
+/* Como relatorioLivros, mas na ordem do índice e só dentro da faixa: O(log n + k) */
+int relatorioLivrosOrdenado(Saida* out, const Biblioteca* b, const FaixaOrdem* fx, const FiltroRelatorio* f,
+                            CursorOrdem* c, int tamPagina) {
+    CursorAcervo ca = { 0, c->escritas, 0 };
+    int escritas = 0, pos, jaTerminado = c->fim;
+    while ((tamPagina <= 0 || escritas < tamPagina) && (pos = ordemProximo(b, fx, c)) >= 0) {
+        const Livro* l = &b->livros[pos];
+        if (!livroPassaFiltro(f, l)) continue;
+        acervoAntesDaLinha(out, f, &ca, CABECALHO_LIVROS);
+        escreverLinhaLivro(out, f, l);
+        escritas++;
+    }
+    if (c->fim && !jaTerminado) acervoFechar(out, f, &ca, CABECALHO_LIVROS);
+    c->escritas = ca.escritas;
+    return escritas;
+}
+
+int relatorioUsuarios(Saida* out, const Usuario* v, int n, const FiltroRelatorio* f, CursorAcervo* c, int tamPagina) {
+    static const char* cab = "id,nome\n";
+    int escritas = 0;
+    while (c->pos < n && (tamPagina <= 0 || escritas < tamPagina)) {
+        const Usuario* u = &v[c->pos++];
+        if (f->trecho && !contemTrecho(u->nome, f->trecho)) continue;
+        acervoAntesDaLinha(out, f, c, cab);
+        if (f->formato == FORMATO_TEXTO) {
+            saidaTexto(out, "#", 1); saidaInteiro(out, u->id);
+            saidaTexto(out, " | ", 3); saidaCadeia(out, u->nome);
+            saidaTexto(out, "\n", 1);
+        } else if (f->formato == FORMATO_CSV) {
+            saidaInteiro(out, u->id); saidaTexto(out, ",", 1);
+            saidaCampoCSV(out, u->nome); saidaTexto(out, "\n", 1);
+        } else {
+            saidaCadeia(out, "  {\"id\": "); saidaInteiro(out, u->id);
+            saidaCadeia(out, ", \"nome\": "); saidaCampoJSON(out, u->nome);
+            saidaTexto(out, "}", 1);
+        }
+        escritas++;
+    }
+    if (c->pos >= n && !c->fim) acervoFechar(out, f, c, cab);
+    return escritas;
+}
+
+void cacheDatasIniciar(CacheDatas* c) {
+    for (int i = 0; i < CACHE_DATAS; i++) c->minuto[i] = -1;
+}
+
+/* localtime/strftime só na primeira vez que um minuto aparece no slot */
+const char* dataEmCache(CacheDatas* c, time_t t) {
+    long minuto = (long)(t / 60);
+    int i = (int)((unsigned long)minuto & (CACHE_DATAS - 1));
+    if (c->minuto[i] != minuto) {
+        formatarData((time_t)minuto * 60, c->texto[i], sizeof(c->texto[i]));
+        c->minuto[i] = minuto;
+    }
+    return c->texto[i];
+}
+
+/* Uma linha de empréstimo; livro e usuário resolvidos pelos índices de ID (O(1)) */
+void escreverEmprestimo(Saida* out, const Biblioteca* b, const Emprestimo* e, CacheDatas* datas) {
+    int iL = indiceIdBuscar(&b->idxLivros, e->idLivro);
+    int iU = indiceIdBuscar(&b->idxUsuarios, e->idUsuario);
+    saidaPrintf(out, "#%d | Livro: %s (ID %d) | Usuário: %s (ID %d) | %s | %s\n",
+                e->id,
+                (iL >= 0 ? b->livros[iL].titulo : "<removido>"), e->idLivro,
+                (iU >= 0 ? b->usuarios[iU].nome : "<removido>"), e->idUsuario,
+                dataEmCache(datas, e->data), e->ativo ? "ABERTO" : "FECHADO");
+}
+
+/* Escreve até tamPagina linhas (<= 0: todas) a partir do cursor e o avança.
+   Retorna quantas linhas escreveu; 0 significa fim da listagem. */
+int relatorioEmprestimos(Saida* out, const Biblioteca* b, CursorEmprestimos* c, CacheDatas* datas, int tamPagina) {
+    const RegistroEmprestimos* r = &b->emps;
+    int escritas = 0;
+    while (tamPagina <= 0 || escritas < tamPagina) {
+        if (!c->noHistorico) {
+            if (c->slot >= r->usados) { c->noHistorico = 1; continue; }
+            const Emprestimo* e = slotEmprestimo(r, c->slot++);
+            if (!e->ativo) continue;
+            escreverEmprestimo(out, b, e, datas);
+        } else {
+            Emprestimo e;
+            if (!historicoLer(&r->hist, &c->hist, &e)) break;
+            escreverEmprestimo(out, b, &e, datas);
+        }
+        escritas++;
+    }
+    return escritas;
+}
+
+/* Ativos com ini <= data < fim pelo índice por data. Retorna quantos escreveu. */
+int relatorioPeriodo(Saida* out, const Biblioteca* b, time_t ini, time_t fim, CacheDatas* datas) {
+    const RegistroEmprestimos* r = &b->emps;
+    CursorPeriodo c;
+    int s, n = 0;
+    periodoIniciar(r, &c, ini, fim);
+    while ((s = periodoProximo(r, &c)) >= 0) {
+        escreverEmprestimo(out, b, slotEmprestimo(r, s), datas);
+        n++;
+    }
+    return n;
+}
+
+/* ---------------------- Motor concorrente ---------------------- */
+const char* descreverResultado(int codigo) {
+    switch (codigo) {
+        case OP_LIVRO_INEXISTENTE:      return "livro inexistente";
+        case OP_USUARIO_INEXISTENTE:    return "usuário inexistente";
+        case OP_SEM_EXEMPLARES:         return "sem exemplares disponíveis";
+        case OP_LIMITE_USUARIO:         return "limite de empréstimos do usuário";
+        case OP_EMPRESTIMO_INEXISTENTE: return "empréstimo não encontrado ou já devolvido";
+        case OP_SEM_MEMORIA:            return "memória insuficiente";
+        case OP_LIVRO_DISPONIVEL:       return "livro disponível, basta emprestar";
+        case OP_OPERACAO_INVALIDA:      return "operação inválida";
+        case OP_JA_NA_FILA:             return "usuário já está na fila deste livro";
+        case OP_JA_TEM_LIVRO:           return "usuário já está com um exemplar deste livro";
+        default:                        return codigo >= 0 ? "ok" : "erro desconhecido";
+    }
+}
+
+/* Decrementa *v somente se > 0. O CAS garante que duas threads nunca levem o mesmo exemplar. */
+static int decrementarSePositivo(int* v) {
+    int atual = __atomic_load_n(v, __ATOMIC_RELAXED);
+    while (atual > 0) {
+        if (__atomic_compare_exchange_n(v, &atual, atual - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+/* Incrementa *v somente se continuar < limite */
+static int incrementarAbaixoDe(int* v, int limite) {
+    int atual = __atomic_load_n(v, __ATOMIC_RELAXED);
+    while (atual < limite) {
+        if (__atomic_compare_exchange_n(v, &atual, atual + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+/* Parte do estado atual da biblioteca: os empréstimos em aberto são distribuídos
+   pelos fragmentos e as cotas por usuário são contadas a partir deles. */
+int motorIniciar(MotorEmprestimos* m, Biblioteca* b) {
+    memset(m, 0, sizeof(*m));
+    m->livros = b->livros;
+    m->idxLivros = &b->idxLivros;
+    m->idxUsuarios = &b->idxUsuarios;
+    m->nUsu = b->nUsu;
+    m->proximoId = b->emps.maiorId + 1;
+    m->ativosPorUsuario = (int*)calloc(b->nUsu > 0 ? b->nUsu : 1, sizeof(int));
+    if (!m->ativosPorUsuario) return 0;
+
+    int i;
+    for (i = 0; i < MOTOR_FRAGMENTOS; i++) {
+        if (!registroIniciar(&m->frag[i].reg)) { registroLiberar(&m->frag[i].reg); break; }
+        pthread_mutex_init(&m->frag[i].trava, NULL);
+    }
+    if (i < MOTOR_FRAGMENTOS) {
+        while (i-- > 0) { registroLiberar(&m->frag[i].reg); pthread_mutex_destroy(&m->frag[i].trava); }
+        free(m->ativosPorUsuario);
+        return 0;
+    }
+
+    const RegistroEmprestimos* r = &b->emps;
+    for (int s = 0; s < r->usados; s++) {
+        const Emprestimo* e = slotEmprestimo(r, s);
+        if (!e->ativo) continue;
+        if (registroInserir(&m->frag[e->id % MOTOR_FRAGMENTOS].reg, *e) < 0) { motorLiberar(m); return 0; }
+        int posU = indiceIdBuscar(&b->idxUsuarios, e->idUsuario);
+        if (posU >= 0) m->ativosPorUsuario[posU]++;
+    }
+    return 1;
+}
 
-/* Helpers de ID/Busca */
-int proximoIdLivro(const Livro* v, int n);
-int proximoIdUsuario(const Usuario* v, int n);
-int proximoIdEmprestimo(const Emprestimo* v, int n);
-int buscarLivroPorId(const Livro* v, int n, int id);
-int buscarUsuarioPorId(const Usuario* v, int n, int id);
-int buscarEmprestimoAtivo(const Emprestimo* v, int n, int idEmp);
+void motorLiberar(MotorEmprestimos* m) {
+    for (int i = 0; i < MOTOR_FRAGMENTOS; i++) {
+        registroLiberar(&m->frag[i].reg);
+        pthread_mutex_destroy(&m->frag[i].trava);
+    }
+    free(m->ativosPorUsuario);
+    m->ativosPorUsuario = NULL;
+}
 
-/* Cadastro (atualizam por referência) */
-int adicionarLivro(Livro** v, int* n, int* cap, Livro novo);
-int adicionarUsuario(Usuario** v, int* n, int* cap, Usuario novo);
+/* Seguro para várias threads. Retorna o id do empréstimo ou um OP_* negativo. */
+int motorEmprestar(MotorEmprestimos* m, int idLivro, int idUsuario) {
+    int posL = indiceIdBuscar(m->idxLivros, idLivro);
+    if (posL < 0) return OP_LIVRO_INEXISTENTE;
+    int posU = indiceIdBuscar(m->idxUsuarios, idUsuario);
+    if (posU < 0) return OP_USUARIO_INEXISTENTE;
 
-/* Empréstimo e Devolução (atualizam por referência) */
-int realizarEmprestimo(Livro* livros, int nLiv,
-                       Usuario* usuarios, int nUsu,
-                       Emprestimo** emps, int* nEmp, int* capEmp,
-                       int idLivro, int idUsuario);
-int devolverEmprestimo(Livro* livros, int nLiv,
-                       Emprestimo* emps, int nEmp,
-                       int idEmprestimo);
+    /* reserva exemplar e cota sem trava; desfaz o que já reservou se algo falhar */
+    if (!decrementarSePositivo(&m->livros[posL].disponiveis)) return OP_SEM_EXEMPLARES;
+    if (!incrementarAbaixoDe(&m->ativosPorUsuario[posU], LIMITE_EMPRESTIMOS)) {
+        __atomic_add_fetch(&m->livros[posL].disponiveis, 1, __ATOMIC_ACQ_REL);
+        return OP_LIMITE_USUARIO;
+    }
 
-/* Exibição (passagem por valor) */
-void exibirLivro(Livro l);
-void exibirUsuario(Usuario u);
-void exibirEmprestimo(const Emprestimo e, const Livro* livros, int nLiv, const Usuario* usuarios, int nUsu);
-void listarLivros(const Livro* v, int n);
-void listarUsuarios(const Usuario* v, int n);
-void listarEmprestimos(const Emprestimo* v, int n, const Livro* livros, int nLiv, const Usuario* usuarios, int nUsu);
+    Emprestimo e;
+    e.id = __atomic_fetch_add(&m->proximoId, 1, __ATOMIC_RELAXED);
+    e.idLivro = idLivro;
+    e.idUsuario = idUsuario;
+    e.data = time(NULL);
+    e.ativo = 1;
 
-/* Utilitários */
-void limparBufferEntrada(void);
-void titulo(const char* s);
-void linha(void);
-void formatarData(time_t t, char* buf, size_t tam);
+    FragmentoEmprestimos* f = &m->frag[e.id % MOTOR_FRAGMENTOS];
+    pthread_mutex_lock(&f->trava);
+    int slot = registroInserir(&f->reg, e);
+    pthread_mutex_unlock(&f->trava);
+    if (slot < 0) {
+        __atomic_sub_fetch(&m->ativosPorUsuario[posU], 1, __ATOMIC_ACQ_REL);
+        __atomic_add_fetch(&m->livros[posL].disponiveis, 1, __ATOMIC_ACQ_REL);
+        return OP_SEM_MEMORIA;
+    }
+    return e.id;
+}
 
-/* ---------------------- Implementações ---------------------- */
+/* Seguro para várias threads. Retorna OP_OK ou um OP_* negativo. */
+int motorDevolver(MotorEmprestimos* m, int idEmprestimo) {
+    if (idEmprestimo <= 0) return OP_EMPRESTIMO_INEXISTENTE;
+    FragmentoEmprestimos* f = &m->frag[idEmprestimo % MOTOR_FRAGMENTOS];
+    pthread_mutex_lock(&f->trava);
+    int slot = buscarEmprestimoAtivo(&f->reg, idEmprestimo);
+    if (slot < 0) { pthread_mutex_unlock(&f->trava); return OP_EMPRESTIMO_INEXISTENTE; }
+    Emprestimo e = *slotEmprestimo(&f->reg, slot);
+    int ok = registroFechar(&f->reg, slot);
+    pthread_mutex_unlock(&f->trava);
+    if (!ok) return OP_SEM_MEMORIA;
 
-void inicializar(Livro** livros, int* nLiv, int* capLiv,
-                 Usuario** usuarios, int* nUsu, int* capUsu,
-                 Emprestimo** emps, int* nEmp, int* capEmp) {
-    *nLiv = *nUsu = *nEmp = 0;
-    *capLiv = *capUsu = *capEmp = 4;
+    int posL = indiceIdBuscar(m->idxLivros, e.idLivro);
+    int posU = indiceIdBuscar(m->idxUsuarios, e.idUsuario);
+    if (posL >= 0) __atomic_add_fetch(&m->livros[posL].disponiveis, 1, __ATOMIC_ACQ_REL);
+    if (posU >= 0) __atomic_sub_fetch(&m->ativosPorUsuario[posU], 1, __ATOMIC_ACQ_REL);
+    return OP_OK;
+}
 
-    *livros = (Livro*)calloc(*capLiv, sizeof(Livro));
-    *usuarios = (Usuario*)calloc(*capUsu, sizeof(Usuario));
-    *emps = (Emprestimo*)calloc(*capEmp, sizeof(Emprestimo));
+/* Recontagem completa (com as threads paradas): para cada livro, disponíveis + em aberto
+   deve ser igual a exemplares; cotas devem bater com os empréstimos de cada usuário.
+   Retorna o número de inconsistências (-1 se faltar memória). */
+long motorVerificar(const MotorEmprestimos* m, const Biblioteca* b) {
+    int* porLivro = (int*)calloc(b->nLiv > 0 ? b->nLiv : 1, sizeof(int));
+    int* porUsuario = (int*)calloc(b->nUsu > 0 ? b->nUsu : 1, sizeof(int));
+    if (!porLivro || !porUsuario) { free(porLivro); free(porUsuario); return -1; }
 
-    if (!*livros || !*usuarios || !*emps) {
-        fprintf(stderr, "Falha ao alocar memória inicial.\n");
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < MOTOR_FRAGMENTOS; i++) {
+        const RegistroEmprestimos* r = &m->frag[i].reg;
+        for (int s = 0; s < r->usados; s++) {
+            const Emprestimo* e = slotEmprestimo(r, s);
+            if (!e->ativo) continue;
+            int posL = indiceIdBuscar(&b->idxLivros, e->idLivro);
+            int posU = indiceIdBuscar(&b->idxUsuarios, e->idUsuario);
+            if (posL >= 0) porLivro[posL]++;
+            if (posU >= 0) porUsuario[posU]++;
+        }
     }
+    long erros = 0;
+    for (int i = 0; i < b->nLiv; i++) {
+        const Livro* l = &b->livros[i];
+        if (l->disponiveis < 0 || l->disponiveis + porLivro[i] != l->exemplares) erros++;
+    }
+    for (int i = 0; i < b->nUsu; i++) {
+        if (porUsuario[i] != m->ativosPorUsuario[i] || porUsuario[i] > LIMITE_EMPRESTIMOS) erros++;
+    }
+    free(porLivro);
+    free(porUsuario);
+    return erros;
 }
 
-void liberarMemoria(Livro* livros, Usuario* usuarios, Emprestimo* emps) {
-    free(livros);
-    free(usuarios);
-    free(emps);
+/* ---------------------- Teste de estresse ---------------------- */
+typedef struct {
+    MotorEmprestimos* m;   /* NULL: caminho real (realizarEmprestimo/devolverEmprestimo em b) */
+    Biblioteca* b;
+    int nLiv, nUsu;        /* ids sorteados em 1..n */
+    long ops;
+    unsigned semente;
+    long recusas;
+    int retidos[ESTRESSE_RETIDOS]; /* ainda em aberto quando a thread termina */
+    int nRetidos;
+} TarefaEstresse;
+
+static unsigned aleatorio(unsigned* s) {
+    unsigned x = *s;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return *s = x;
 }
 
-int proximoIdLivro(const Livro* v, int n) {
-    int max = 0;
-    for (int i = 0; i < n; i++) if (v[i].id > max) max = v[i].id;
-    return max + 1;
+/* Mistura empréstimos e devoluções; cada thread devolve apenas o que ela emprestou */
+static void* trabalhadorEstresse(void* arg) {
+    TarefaEstresse* t = (TarefaEstresse*)arg;
+    int* retidos = t->retidos;
+    int n = 0;
+    for (long i = 0; i < t->ops; i++) {
+        unsigned r = aleatorio(&t->semente);
+        if (n == ESTRESSE_RETIDOS || (n > 0 && (r & 1))) {
+            int k = (int)((r >> 1) % (unsigned)n);
+            if (t->m) motorDevolver(t->m, retidos[k]);
+            else devolverEmprestimo(t->b, retidos[k]);
+            retidos[k] = retidos[--n];
+        } else {
+            int idL = 1 + (int)((r >> 1) % (unsigned)t->nLiv);
+            int idU = 1 + (int)(aleatorio(&t->semente) % (unsigned)t->nUsu);
+            int id = t->m ? motorEmprestar(t->m, idL, idU) : realizarEmprestimo(t->b, idL, idU);
+            if (id > 0) retidos[n++] = id;
+            else t->recusas++;
+        }
+    }
+    t->nRetidos = n;
+    return NULL;
 }
-int proximoIdUsuario(const Usuario* v, int n) {
-    int max = 0;
-    for (int i = 0; i < n; i++) if (v[i].id > max) max = v[i].id;
-    return max + 1;
+
+/* Conferência do caminho real com as threads paradas e os retidos ainda em aberto:
+   agregados e índices batem com a recontagem, nenhum livro ficou com disponíveis
+   negativo e nenhum usuário passou do limite. Retorna o número de inconsistências. */
+static long conferirEstresse(const Biblioteca* b) {
+    FotoAgregados rc;
+    long erros = agregadosConferir(b, &rc);
+    if (erros < 0) return 1;
+    for (int i = 0; i < b->nLiv; i++)
+        if (b->livros[i].disponiveis < 0) erros++;
+    for (int i = 0; i < b->nUsu; i++)
+        if (contarEmprestimosDoUsuario(&b->emps, b->usuarios[i].id) > LIMITE_EMPRESTIMOS) erros++;
+    return erros;
 }
-int proximoIdEmprestimo(const Emprestimo* v, int n) {
-    int max = 0;
-    for (int i = 0; i < n; i++) if (v[i].id > max) max = v[i].id;
-    return max + 1;
+
+/* Uma rodada com nThreads sorteando entre os nLivSorteio primeiros livros, pelo caminho
+   real da Biblioteca (real = 1) ou pelo motor de fragmentos.
+   Os empréstimos do motor não passam para a Biblioteca: os disponíveis do acervo são
+   guardados antes e restaurados depois. No caminho real os retidos são devolvidos depois
+   da conferência. Nos dois casos a rodada não altera o catálogo (só o histórico cresce).
+   Retorna operações por segundo, ou -1 se terminou inconsistente ou não rodou. */
+static double rodadaEstresse(Biblioteca* b, int nThreads, long opsPorThread, int nLivSorteio, int real,
+                             long* recusas) {
+    MotorEmprestimos* m = real ? NULL : (MotorEmprestimos*)malloc(sizeof(MotorEmprestimos));
+    pthread_t* th = (pthread_t*)malloc(nThreads * sizeof(pthread_t));
+    TarefaEstresse* tarefas = (TarefaEstresse*)calloc(nThreads, sizeof(TarefaEstresse));
+    int* disponiveis = (int*)malloc((b->nLiv > 0 ? b->nLiv : 1) * sizeof(int));
+    if ((!real && (!m || !motorIniciar(m, b))) || !th || !tarefas || !disponiveis) {
+        free(m); free(th); free(tarefas); free(disponiveis);
+        puts("Memória insuficiente para a rodada.");
+        return -1;
+    }
+    for (int i = 0; i < b->nLiv; i++) disponiveis[i] = b->livros[i].disponiveis;
+
+    double inicio = agoraSegundos();
+    int criadas = 0;
+    for (; criadas < nThreads; criadas++) {
+        TarefaEstresse* t = &tarefas[criadas];
+        t->m = m;
+        t->b = b;
+        t->nLiv = nLivSorteio;
+        t->nUsu = b->nUsu;
+        t->ops = opsPorThread;
+        t->semente = 2463534242u + 7919u * (unsigned)criadas;
+        if (pthread_create(&th[criadas], NULL, trabalhadorEstresse, t) != 0) break;
+    }
+    for (int i = 0; i < criadas; i++) pthread_join(th[i], NULL);
+    double segundos = agoraSegundos() - inicio;
+
+    *recusas = 0;
+    for (int i = 0; i < criadas; i++) *recusas += tarefas[i].recusas;
+    long erros;
+    if (real) {
+        erros = conferirEstresse(b);
+        for (int i = 0; i < criadas; i++)
+            for (int k = 0; k < tarefas[i].nRetidos; k++) devolverEmprestimo(b, tarefas[i].retidos[k]);
+        for (int i = 0; i < b->nLiv; i++) if (b->livros[i].disponiveis != disponiveis[i]) erros++;
+    } else {
+        erros = motorVerificar(m, b);
+        motorLiberar(m);
+        for (int i = 0; i < b->nLiv; i++) b->livros[i].disponiveis = disponiveis[i];
+    }
+    free(m); free(th); free(tarefas); free(disponiveis);
+    if (criadas < nThreads) {
+        printf("Não foi possível criar a thread %d de %d.\n", criadas + 1, nThreads);
+        return -1;
+    }
+    if (erros != 0) {
+        printf("INCONSISTENTE: %ld livros/usuários com contagem errada\n", erros);
+        return -1;
+    }
+    return segundos > 0 ? nThreads * opsPorThread / segundos : 0;
 }
 
-int buscarLivroPorId(const Livro* v, int n, int id) {
-    for (int i = 0; i < n; i++) if (v[i].id == id) return i;
-    return -1;
+/* Mede a vazão com 1, 2, 4, ... maxThreads e confere, a cada rodada, que nenhum livro
+   foi emprestado além dos exemplares. Cenário "real": realizarEmprestimo/devolverEmprestimo
+   sobre a própria Biblioteca (o caminho do servidor); "motor": o motor de fragmentos com CAS.
+   As rodadas "disputa" concentram todas as threads em 8 livros de 1 exemplar. */
+int executarEstresse(int maxThreads, long opsPorThread) {
+    const int nLiv = 200000, nUsu = 100000;
+    Biblioteca b;
+    inicializar(&b);
+    for (int i = 1; i <= nLiv; i++) {
+        Livro l;
+        memset(&l, 0, sizeof(l));
+        l.id = i;
+        char tit[32], aut[32];
+        snprintf(tit, sizeof(tit), "Livro %d", i);
+        snprintf(aut, sizeof(aut), "Autor %d", i % 997);
+        l.titulo = tit;
+        l.autor = aut;
+        l.ano = 1950 + i % 70;
+        l.exemplares = l.disponiveis = (i <= 8) ? 1 : 1 + i % 3;
+        cadastrarLivro(&b, l);
+    }
+    for (int i = 1; i <= nUsu; i++) {
+        Usuario u;
+        memset(&u, 0, sizeof(u));
+        u.id = i;
+        char nome[32];
+        snprintf(nome, sizeof(nome), "Usuario %d", i);
+        u.nome = nome;
+        cadastrarUsuario(&b, u);
+    }
+
+    int falhou = 0;
+    double base = 0;
+    long recusas;
+    titulo("ESTRESSE DE EMPRÉSTIMOS CONCORRENTES");
+    printf("%ld CPU(s) online; a escala só passa de 1x com threads em núcleos distintos.\n",
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-10s %-8s %14s %10s %12s\n", "CENARIO", "THREADS", "OPS/S", "ESCALA", "RECUSAS");
+    for (int real = 1; real >= 0 && !falhou; real--) {
+        const char* nome = real ? "real" : "motor";
+        for (int t = 1; ; t = (t * 2 > maxThreads && t < maxThreads) ? maxThreads : t * 2) {
+            if (t > maxThreads) break;
+            double vazao = rodadaEstresse(&b, t, opsPorThread, nLiv, real, &recusas);
+            if (vazao < 0) { falhou = 1; break; }
+            if (t == 1) base = vazao;
+            printf("%-10s %-8d %14.0f %9.2fx %12ld\n", nome, t, vazao, base > 0 ? vazao / base : 0, recusas);
+        }
+        if (!falhou) {
+            double vazao = rodadaEstresse(&b, maxThreads, opsPorThread, 8, real, &recusas);
+            if (vazao < 0) falhou = 1;
+            else printf("%-10s %-8d %14.0f %10s %12ld\n", real ? "disputa" : "disp.motor", maxThreads, vazao, "-", recusas);
+        }
+    }
+    puts(falhou ? "Resultado: FALHA" : "Resultado: OK (nenhum exemplar emprestado em excesso)");
+    liberarMemoria(&b);
+    return falhou;
 }
-int buscarUsuarioPorId(const Usuario* v, int n, int id) {
-    for (int i = 0; i < n; i++) if (v[i].id == id) return i;
-    return -1;
+
+/* ---------------------- Benchmark de latência ---------------------- */
+/* Mistura de operações (em milésimos; soma 1000) sobre o acervo sintético */
+static const struct { const char* nome; int peso; } OPS_BENCH[BENCH_TIPOS] = {
+    { "consulta_livro",   300 },  /* indiceIdBuscar em idxLivros */
+    { "busca_emprestimo", 100 },  /* buscarEmprestimoAtivo */
+    { "busca_linear",      10 },  /* buscarLivroPorId (varredura) */
+    { "emprestar",        250 },  /* realizarEmprestimo */
+    { "devolver",         220 },  /* devolverEmprestimo */
+    { "listar_usuario",    70 },  /* lista de ativos do usuário formatada */
+    { "pagina_livros",     50 },  /* 20 livros a partir de posição aleatória */
+};
+
+static long long relogioNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
-int buscarEmprestimoAtivo(const Emprestimo* v, int n, int idEmp) {
-    for (int i = 0; i < n; i++) if (v[i].id == idEmp && v[i].ativo) return i;
-    return -1;
+
+static int compararLongLong(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
 }
 
-int adicionarLivro(Livro** v, int* n, int* cap, Livro novo) {
-    if (*n >= *cap) {
-        int novoCap = (*cap) * 2;
-        Livro* temp = (Livro*)realloc(*v, novoCap * sizeof(Livro));
-        if (!temp) return 0;
-        *v = temp;
-        *cap = novoCap;
-    }
-    (*v)[*n] = novo;
-    (*n)++;
-    return 1;
+static long long percentil(const long long* v, long n, double p) {
+    return n > 0 ? v[(long)(p * (double)(n - 1))] : 0;
 }
 
-int adicionarUsuario(Usuario** v, int* n, int* cap, Usuario novo) {
-    if (*n >= *cap) {
-        int novoCap = (*cap) * 2;
-        Usuario* temp = (Usuario*)realloc(*v, novoCap * sizeof(Usuario));
-        if (!temp) return 0;
-        *v = temp;
-        *cap = novoCap;
+/* Monta o acervo sintético: livros, usuários, histórico de devolvidos e alguns ativos */
+static void montarAcervoBench(Biblioteca* b, int nLiv, int nUsu, long nHist) {
+    inicializar(b);
+    b->livros = (Livro*)reservarVetor(b->livros, &b->capLiv, nLiv, sizeof(Livro));
+    b->usuarios = (Usuario*)reservarVetor(b->usuarios, &b->capUsu, nUsu, sizeof(Usuario));
+    if (!b->livros || !b->usuarios || !indiceIdReservar(&b->idxLivros, nLiv) ||
+        !indiceIdReservar(&b->idxUsuarios, nUsu)) {
+        fprintf(stderr, "Memória insuficiente para o acervo do benchmark.\n");
+        exit(EXIT_FAILURE);
     }
-    (*v)[*n] = novo;
-    (*n)++;
-    return 1;
+    for (int i = 1; i <= nLiv; i++) {
+        Livro l;
+        memset(&l, 0, sizeof(l));
+        l.id = i;
+        char tit[32], aut[32];
+        snprintf(tit, sizeof(tit), "Livro %d", i);
+        snprintf(aut, sizeof(aut), "Autor %d", i % 9973);
+        l.titulo = tit;
+        l.autor = aut;
+        l.ano = 1900 + i % 125;
+        l.exemplares = l.disponiveis = 1 + i % 4;
+        cadastrarLivro(b, l);
+    }
+    for (int i = 1; i <= nUsu; i++) {
+        Usuario u;
+        memset(&u, 0, sizeof(u));
+        u.id = i;
+        char nome[32];
+        snprintf(nome, sizeof(nome), "Usuario %d", i);
+        u.nome = nome;
+        cadastrarUsuario(b, u);
+    }
+    /* devolvidos: um por minuto até agora, livro e usuário espalhados */
+    time_t agora = time(NULL);
+    unsigned semente = 88172645u;
+    for (long i = 1; i <= nHist; i++) {
+        Emprestimo e;
+        e.id = (int)i;
+        e.idLivro = 1 + (int)(aleatorio(&semente) % (unsigned)nLiv);
+        e.idUsuario = 1 + (int)(aleatorio(&semente) % (unsigned)nUsu);
+        e.data = agora - (time_t)(nHist - i) * 60;
+        e.ativo = 0;
+        if (!historicoAnexar(&b->emps.hist, &e)) {
+            fprintf(stderr, "Memória insuficiente para o histórico do benchmark.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    b->emps.maiorId = (int)nHist;
 }
 
-int realizarEmprestimo(Livro* livros, int nLiv,
-                       Usuario* usuarios, int nUsu,
-                       Emprestimo** emps, int* nEmp, int* capEmp,
-                       int idLivro, int idUsuario) {
-    int idxL = buscarLivroPorId(livros, nLiv, idLivro);
-    int idxU = buscarUsuarioPorId(usuarios, nUsu, idUsuario);
+/* Resultado anterior de uma operação no arquivo de resultados (última linha dela) */
+typedef struct {
+    char rotulo[64];
+    long long p50, p99;
+    double vazao;
+    int achou;
+} AnteriorBench;
 
-    if (idxL < 0 || idxU < 0) {
-        puts("Livro ou usuário inexistente.");
-        return 0;
+static void lerAnteriores(const char* caminho, AnteriorBench* ant) {
+    FILE* f = fopen(caminho, "r");
+    if (!f) return;
+    char linhaArq[256];
+    while (fgets(linhaArq, sizeof(linhaArq), f)) {
+        char rotulo[64], op[32];
+        long n;
+        long long p50, p99, p999;
+        double vazao;
+        if (sscanf(linhaArq, "%63[^,],%*[^,],%31[^,],%ld,%lld,%lld,%lld,%lf",
+                   rotulo, op, &n, &p50, &p99, &p999, &vazao) != 7) continue;
+        for (int t = 0; t < BENCH_TIPOS; t++) {
+            if (strcmp(op, OPS_BENCH[t].nome) != 0) continue;
+            strcpy(ant[t].rotulo, rotulo);
+            ant[t].p50 = p50;
+            ant[t].p99 = p99;
+            ant[t].vazao = vazao;
+            ant[t].achou = 1;
+        }
     }
-    if (livros[idxL].disponiveis <= 0) {
-        puts("Sem exemplares disponíveis para este livro.");
-        return 0;
+    fclose(f);
+}
+
+/* Reproduz ops operações sorteadas pela mistura, mede cada uma e imprime p50/p99/p999
+   e vazão por tipo. Com arquivo, compara com a última execução gravada e anexa esta. */
+int executarBenchmark(long ops, const char* arquivo, const char* rotulo) {
+    Biblioteca b;
+    double t0 = agoraSegundos();
+    montarAcervoBench(&b, BENCH_LIVROS, BENCH_USUARIOS, BENCH_HISTORICO);
+    printf("Acervo: %d livros, %d usuarios, %ld devolvidos no historico (%.1f s para montar)\n",
+           b.nLiv, b.nUsu, b.emps.hist.n, agoraSegundos() - t0);
+
+    /* cada tipo recebe a sua fração da mistura com 25% de folga; empréstimos e devoluções
+       trocam de lugar quando o estoque de retidos acaba, então o vetor ainda pode crescer */
+    long long* amostras[BENCH_TIPOS];
+    long nAmostras[BENCH_TIPOS] = { 0 };
+    long capAmostras[BENCH_TIPOS];
+    long recusas = 0;
+    for (int t = 0; t < BENCH_TIPOS; t++) {
+        capAmostras[t] = ops / 1000 * OPS_BENCH[t].peso * 5 / 4 + 1024;
+        amostras[t] = (long long*)malloc((size_t)capAmostras[t] * sizeof(long long));
+        if (!amostras[t]) { fprintf(stderr, "Memória insuficiente para as amostras.\n"); exit(EXIT_FAILURE); }
     }
+    int* retidos = (int*)malloc(BENCH_RETIDOS * sizeof(int));
+    Saida* out = (Saida*)malloc(sizeof(Saida));
+    FILE* nulo = fopen("/dev/null", "w");
+    if (!retidos || !out || !nulo) { fprintf(stderr, "Falha ao preparar o benchmark.\n"); exit(EXIT_FAILURE); }
+    saidaIniciar(out, nulo);
+    CacheDatas datas;
+    cacheDatasIniciar(&datas);
+    FiltroRelatorio filtro = { FORMATO_TEXTO, NULL, 0 };
+    int nRetidos = 0;
+    unsigned semente = 2463534242u;
 
-    /* Realoca se necessário */
-    if (*nEmp >= *capEmp) {
-        int novoCap = (*capEmp) * 2;
-        Emprestimo* temp = (Emprestimo*)realloc(*emps, novoCap * sizeof(Emprestimo));
-        if (!temp) return 0;
-        *emps = temp;
-        *capEmp = novoCap;
+    double inicio = agoraSegundos();
+    for (long i = 0; i < ops; i++) {
+        unsigned r = aleatorio(&semente);
+        int sorteio = (int)(r % 1000), tipo = 0;
+        while (sorteio >= OPS_BENCH[tipo].peso) sorteio -= OPS_BENCH[tipo].peso, tipo++;
+        if (tipo == BENCH_DEVOLVER && nRetidos == 0) tipo = BENCH_EMPRESTAR;
+        if (tipo == BENCH_EMPRESTAR && nRetidos == BENCH_RETIDOS) tipo = BENCH_DEVOLVER;
+        int idL = 1 + (int)(aleatorio(&semente) % (unsigned)b.nLiv);
+        int idU = 1 + (int)(aleatorio(&semente) % (unsigned)b.nUsu);
+        int k = nRetidos > 0 ? (int)(aleatorio(&semente) % (unsigned)nRetidos) : 0;
+        int res;
+
+        long long t = relogioNs();
+        switch (tipo) {
+        case BENCH_CONSULTA:
+            res = indiceIdBuscar(&b.idxLivros, idL);
+            break;
+        case BENCH_BUSCA_EMPRESTIMO:
+            res = buscarEmprestimoAtivo(&b.emps, nRetidos > 0 ? retidos[k] : idL);
+            break;
+        case BENCH_BUSCA_LINEAR:
+            res = buscarLivroPorId(b.livros, b.nLiv, idL);
+            break;
+        case BENCH_EMPRESTAR:
+            res = realizarEmprestimo(&b, idL, idU);
+            break;
+        case BENCH_DEVOLVER:
+            res = devolverEmprestimo(&b, retidos[k]);
+            break;
+        case BENCH_LISTAR_USUARIO:
+            res = 0;
+            for (int s = primeiroDoUsuario(&b.emps, idU); s >= 0; s = proximoDoUsuario(&b.emps, s), res++)
+                escreverEmprestimo(out, &b, slotEmprestimo(&b.emps, s), &datas);
+            break;
+        default: {
+            CursorAcervo c = { idL - 1, 0, 0 };
+            res = relatorioLivros(out, b.livros, b.nLiv, &filtro, &c, 20);
+            break;
+        }
+        }
+        long long dt = relogioNs() - t;
+        if (nAmostras[tipo] == capAmostras[tipo]) {
+            capAmostras[tipo] *= 2;
+            long long* temp = (long long*)realloc(amostras[tipo], (size_t)capAmostras[tipo] * sizeof(long long));
+            if (!temp) { fprintf(stderr, "Memória insuficiente para as amostras.\n"); exit(EXIT_FAILURE); }
+            amostras[tipo] = temp;
+        }
+        amostras[tipo][nAmostras[tipo]++] = dt;
+
+        if (tipo == BENCH_EMPRESTAR) {
+            if (res > 0) retidos[nRetidos++] = res;
+            else recusas++;
+        } else if (tipo == BENCH_DEVOLVER) {
+            retidos[k] = retidos[--nRetidos];
+        }
     }
+    double total = agoraSegundos() - inicio;
+    saidaDescarregar(out);
+    fclose(nulo);
 
-    Emprestimo e;
-    e.id = proximoIdEmprestimo(*emps, *nEmp);
-    e.idLivro = idLivro;
-    e.idUsuario = idUsuario;
-    e.data = time(NULL);
-    e.ativo = 1;
+    AnteriorBench ant[BENCH_TIPOS];
+    memset(ant, 0, sizeof(ant));
+    if (arquivo) lerAnteriores(arquivo, ant);
 
-    (*emps)[*nEmp] = e;
-    (*nEmp)++;
+    titulo("BENCHMARK DE LATENCIA");
+    printf("%ld operacoes em %.3f s (%.0f ops/s), %ld emprestimos recusados, %d ativos ao final\n",
+           ops, total, total > 0 ? ops / total : 0, recusas, b.emps.nAtivos);
+    printf("%-17s %9s %10s %10s %10s %12s %s\n", "OPERACAO", "N", "P50(ns)", "P99(ns)", "P999(ns)", "OPS/S", "P50 ANTERIOR");
+    FILE* res = arquivo ? fopen(arquivo, "a") : NULL;
+    if (arquivo && !res) perror(arquivo);
+    char quando[20];
+    formatarData(time(NULL), quando, sizeof(quando));
+    for (int t = 0; t < BENCH_TIPOS; t++) {
+        long n = nAmostras[t];
+        long long soma = 0;
+        for (long i = 0; i < n; i++) soma += amostras[t][i];
+        qsort(amostras[t], (size_t)n, sizeof(long long), compararLongLong);
+        long long p50 = percentil(amostras[t], n, 0.50);
+        long long p99 = percentil(amostras[t], n, 0.99);
+        long long p999 = percentil(amostras[t], n, 0.999);
+        double vazao = soma > 0 ? n / (soma / 1e9) : 0;
+        printf("%-17s %9ld %10lld %10lld %10lld %12.0f", OPS_BENCH[t].nome, n, p50, p99, p999, vazao);
+        if (ant[t].achou && ant[t].p50 > 0)
+            printf(" %lld (%s, %+.0f%%)", ant[t].p50, ant[t].rotulo, 100.0 * (p50 - ant[t].p50) / ant[t].p50);
+        putchar('\n');
+        if (res) fprintf(res, "%s,%s,%s,%ld,%lld,%lld,%lld,%.0f\n", rotulo, quando, OPS_BENCH[t].nome, n, p50, p99, p999, vazao);
+        free(amostras[t]);
+    }
+    if (res) {
+        fclose(res);
+        printf("Resultados anexados a %s (rotulo \"%s\")\n", arquivo, rotulo);
+    }
+    free(retidos);
+    free(out);
+    liberarMemoria(&b);
+    return 0;
+}
 
-    /* Atualização por referência: reduz disponíveis do livro */
-    livros[idxL].disponiveis--;
+/* ---------------------- Servidor de comandos ---------------------- */
+/* Protocolo de texto, um comando por linha, campos separados por '|':
+     CADLIVRO|titulo|autor|ano|exemplares   -> OK <id>
+     CADUSUARIO|nome                        -> OK <id>
+     EMPRESTAR|idLivro|idUsuario            -> OK <idEmprestimo>
+     DEVOLVER|idEmprestimo                  -> OK [idEmprestimo repassado ao primeiro da fila]
+     RESERVAR|idLivro|idUsuario             -> OK
+     PAINEL                                 -> OK total|ultimas24h|idLivro:n,...|idUsuario:n,...
+     LOTE|E:idLivro:idUsuario,D:idEmp,...   -> OK r1,r2,... (id do empréstimo; devolução: 0 ou id
+                                               repassado à fila). Tudo ou nada: ERR <posição> <motivo>
+     TOTAIS                                 -> OK livros|usuarios|exemplares|disponiveis|ativos|
+                                               devolvidos|usuariosComEmprestimo|livrosEmprestados|reservas
+     TOTAIS|CONFERIR                        -> o mesmo após recontar tudo; ERR <n> divergência(s)
+     NAVEGAR|campo|de|ate|limite[|depoisDe] -> OK n|id,id,...  campo = TITULO, AUTOR ou ANO; de/ate
+                                               vazios = sem limite, "K|K" = começa com K; depoisDe =
+                                               último id da página anterior
+     LIVRO|id                               -> OK id|titulo|autor|ano|exemplares|disponiveis
+     USUARIO|id                             -> OK id|nome
+     EMPRESTIMOS|idUsuario                  -> OK n|idEmp:idLivro,...
+     SAIR                                   -> encerra a conexão
+   Falhas respondem "ERR <motivo>". Os comandos podem chegar em sequência (pipeline):
+   cada leitura é processada inteira e as respostas vão juntas numa única escrita. */
 
-    puts("Empréstimo registrado com sucesso.");
-    return 1;
+static int separarComando(char* linha, char** campos, int max) {
+    int n = 0;
+    campos[n++] = linha;
+    for (char* p = linha; *p; p++) {
+        if (*p != '|') continue;
+        if (n == max) return -1;
+        *p = '\0';
+        campos[n++] = p + 1;
+    }
+    return n;
 }
 
-int devolverEmprestimo(Livro* livros, int nLiv,
-                       Emprestimo* emps, int nEmp,
-                       int idEmprestimo) {
-    int idxE = buscarEmprestimoAtivo(emps, nEmp, idEmprestimo);
-    if (idxE < 0) {
-        puts("Empréstimo não encontrado ou já devolvido.");
-        return 0;
+/* Separa "E:idLivro:idUsuario,D:idEmprestimo,..." em operações. Retorna quantas ou -1. */
+static int separarLote(char* texto, OperacaoLote* ops, int max) {
+    int n = 0;
+    for (char* item = strtok(texto, ","); item; item = strtok(NULL, ",")) {
+        char* c[3];
+        long v1, v2;
+        int k = 0;
+        if (n == max) return -1;
+        c[k++] = item;
+        for (char* p = item; *p; p++) {
+            if (*p != ':') continue;
+            if (k == 3) return -1;
+            *p = '\0';
+            c[k++] = p + 1;
+        }
+        if (k == 3 && strcmp(c[0], "E") == 0 && lerInteiro(c[1], 1, 0x7fffffffL, &v1) &&
+            lerInteiro(c[2], 1, 0x7fffffffL, &v2)) {
+            ops[n].tipo = LOTE_EMPRESTAR;
+            ops[n].id = (int)v1;
+            ops[n].idUsuario = (int)v2;
+        } else if (k == 2 && strcmp(c[0], "D") == 0 && lerInteiro(c[1], 1, 0x7fffffffL, &v1)) {
+            ops[n].tipo = LOTE_DEVOLVER;
+            ops[n].id = (int)v1;
+            ops[n].idUsuario = 0;
+        } else {
+            return -1;
+        }
+        n++;
     }
-    int idxL = buscarLivroPorId(livros, nLiv, emps[idxE].idLivro);
-    if (idxL < 0) {
-        puts("Livro do empréstimo não existe mais no acervo.");
+    return n;
+}
+
+/* Executa uma linha e escreve a resposta. Retorna 0 quando o cliente pede SAIR. */
+int executarComando(Biblioteca* b, char* linha, Saida* out) {
+    char* c[CSV_MAX_CAMPOS];
+    long v1, v2, v3;
+    int n = separarComando(linha, c, CSV_MAX_CAMPOS);
+
+    if (n < 1 || c[0][0] == '\0') {
+        saidaPrintf(out, "ERR comando vazio\n");
+    } else if (strcmp(c[0], "SAIR") == 0) {
+        saidaPrintf(out, "OK\n");
         return 0;
+    } else if (strcmp(c[0], "CADLIVRO") == 0) {
+        if (n != 5 || c[1][0] == '\0' ||
+            !lerInteiro(c[3], -9999, 9999, &v1) || !lerInteiro(c[4], 0, 1000000, &v2)) {
+            saidaPrintf(out, "ERR uso: CADLIVRO|titulo|autor|ano|exemplares\n");
+        } else {
+            Livro novo;
+            memset(&novo, 0, sizeof(novo));
+            novo.titulo = c[1];
+            novo.autor = c[2];
+            novo.ano = (int)v1;
+            novo.exemplares = novo.disponiveis = (int)v2;
+            pthread_rwlock_wrlock(&b->travaAcervo); /* o id e o cadastro juntos */
+            novo.id = b->maiorIdLivro + 1;
+            int ok = cadastrarLivro(b, novo);
+            pthread_rwlock_unlock(&b->travaAcervo);
+            if (ok) saidaPrintf(out, "OK %d\n", novo.id);
+            else saidaPrintf(out, "ERR %s\n", descreverResultado(OP_SEM_MEMORIA));
+        }
+    } else if (strcmp(c[0], "CADUSUARIO") == 0) {
+        if (n != 2 || c[1][0] == '\0') {
+            saidaPrintf(out, "ERR uso: CADUSUARIO|nome\n");
+        } else {
+            Usuario novo;
+            memset(&novo, 0, sizeof(novo));
+            novo.nome = c[1];
+            pthread_rwlock_wrlock(&b->travaAcervo);
+            novo.id = b->maiorIdUsuario + 1;
+            int ok = cadastrarUsuario(b, novo);
+            pthread_rwlock_unlock(&b->travaAcervo);
+            if (ok) saidaPrintf(out, "OK %d\n", novo.id);
+            else saidaPrintf(out, "ERR %s\n", descreverResultado(OP_SEM_MEMORIA));
+        }
+    } else if (strcmp(c[0], "EMPRESTAR") == 0) {
+        if (n != 3 || !lerInteiro(c[1], 1, 0x7fffffffL, &v1) || !lerInteiro(c[2], 1, 0x7fffffffL, &v2)) {
+            saidaPrintf(out, "ERR uso: EMPRESTAR|idLivro|idUsuario\n");
+        } else {
+            int r = realizarEmprestimo(b, (int)v1, (int)v2);
+            if (r > 0) saidaPrintf(out, "OK %d\n", r);
+            else saidaPrintf(out, "ERR %s\n", descreverResultado(r));
+        }
+    } else if (strcmp(c[0], "DEVOLVER") == 0) {
+        if (n != 2 || !lerInteiro(c[1], 1, 0x7fffffffL, &v1)) {
+            saidaPrintf(out, "ERR uso: DEVOLVER|idEmprestimo\n");
+        } else {
+            int r = devolverEmprestimo(b, (int)v1);
+            if (r == OP_OK) saidaPrintf(out, "OK\n");
+            else if (r > 0) saidaPrintf(out, "OK %d\n", r);
+            else saidaPrintf(out, "ERR %s\n", descreverResultado(r));
+        }
+    } else if (strcmp(c[0], "RESERVAR") == 0) {
+        if (n != 3 || !lerInteiro(c[1], 1, 0x7fffffffL, &v1) || !lerInteiro(c[2], 1, 0x7fffffffL, &v2)) {
+            saidaPrintf(out, "ERR uso: RESERVAR|idLivro|idUsuario\n");
+        } else {
+            int r = reservarLivro(b, (int)v1, (int)v2);
+            if (r == OP_OK) saidaPrintf(out, "OK\n");
+            else saidaPrintf(out, "ERR %s\n", descreverResultado(r));
+        }
+    } else if (strcmp(c[0], "LOTE") == 0) {
+        int max = 1;
+        for (const char* p = n == 2 ? c[1] : ""; *p; p++) max += (*p == ',');
+        OperacaoLote* ops = (OperacaoLote*)malloc((size_t)max * sizeof(OperacaoLote));
+        int* res = (int*)malloc((size_t)max * sizeof(int));
+        int k = (n == 2 && ops && res) ? separarLote(c[1], ops, max) : -1;
+        if (!ops || !res) {
+            saidaPrintf(out, "ERR %s\n", descreverResultado(OP_SEM_MEMORIA));
+        } else if (k <= 0) {
+            saidaPrintf(out, "ERR uso: LOTE|E:idLivro:idUsuario,D:idEmprestimo,...\n");
+        } else {
+            int falha;
+            int r = executarLote(b, ops, k, res, &falha);
+            if (r != OP_OK) {
+                saidaPrintf(out, "ERR %d %s\n", falha + 1, descreverResultado(r));
+            } else {
+                saidaPrintf(out, "OK ");
+                for (int i = 0; i < k; i++) saidaPrintf(out, "%d%s", res[i], i + 1 < k ? "," : "\n");
+            }
+        }
+        free(ops);
+        free(res);
+    } else if (strcmp(c[0], "TOTAIS") == 0) {
+        FotoAgregados f;
+        long erros = 0;
+        pthread_rwlock_rdlock(&b->travaAcervo);
+        pthread_mutex_lock(&b->travaEmprestimos);
+        if (n == 2 && strcmp(c[1], "CONFERIR") == 0) erros = agregadosConferir(b, &f);
+        else if (n == 1) agregadosFoto(b, &f);
+        else erros = -2;
+        pthread_mutex_unlock(&b->travaEmprestimos);
+        pthread_rwlock_unlock(&b->travaAcervo);
+        if (erros == -2) saidaPrintf(out, "ERR uso: TOTAIS[|CONFERIR]\n");
+        else if (erros < 0) saidaPrintf(out, "ERR %s\n", descreverResultado(OP_SEM_MEMORIA));
+        else if (erros > 0) saidaPrintf(out, "ERR %ld divergência(s)\n", erros);
+        else saidaPrintf(out, "OK %ld|%ld|%ld|%ld|%ld|%ld|%ld|%ld|%ld\n", f.livros, f.usuarios, f.exemplares,
+                         f.disponiveis, f.ativos, f.devolvidos, f.usuariosComEmprestimo, f.livrosEmprestados, f.reservas);
+    } else if (strcmp(c[0], "NAVEGAR") == 0) {
+        FaixaOrdem fx;
+        CursorOrdem cur;
+        int ok = (n == 5 || n == 6) && lerInteiro(c[4], 1, 10000, &v3);
+        memset(&fx, 0, sizeof(fx));
+        fx.anoDe = -9999;
+        fx.anoAte = 9999;
+        if (ok && strcmp(c[1], "TITULO") == 0) fx.chave = ORDEM_TITULO;
+        else if (ok && strcmp(c[1], "AUTOR") == 0) fx.chave = ORDEM_AUTOR;
+        else if (ok && strcmp(c[1], "ANO") == 0) fx.chave = ORDEM_ANO;
+        else ok = 0;
+        if (ok && fx.chave == ORDEM_ANO) {
+            if (c[2][0] && lerInteiro(c[2], -9999, 9999, &v1)) fx.anoDe = (int)v1;
+            else if (c[2][0]) ok = 0;
+            if (c[3][0] && lerInteiro(c[3], -9999, 9999, &v2)) fx.anoAte = (int)v2;
+            else if (c[3][0]) ok = 0;
+        } else {
+            fx.textoDe = c[2];
+            fx.textoAte = c[3];
+        }
+        if (ok) pthread_rwlock_rdlock(&b->travaAcervo);
+        if (!ok) {
+            saidaPrintf(out, "ERR uso: NAVEGAR|TITULO, AUTOR ou ANO|de|ate|limite[|depoisDe]\n");
+        } else if (n == 6 && (!lerInteiro(c[5], 1, 0x7fffffffL, &v1) || !ordemDepoisDe(b, &fx, (int)v1, &cur))) {
+            saidaPrintf(out, "ERR %s\n", descreverResultado(OP_LIVRO_INEXISTENTE));
+        } else {
+            if (n == 5) ordemIniciar(b, &fx, &cur);
+            int* ids = (int*)malloc((size_t)v3 * sizeof(int)); /* a contagem vai antes da lista */
+            int k = 0, pos;
+            while (ids && k < v3 && (pos = ordemProximo(b, &fx, &cur)) >= 0) ids[k++] = b->livros[pos].id;
+            if (!ids) {
+                saidaPrintf(out, "ERR %s\n", descreverResultado(OP_SEM_MEMORIA));
+            } else {
+                saidaPrintf(out, "OK %d|", k);
+                for (int i = 0; i < k; i++) saidaPrintf(out, "%d%s", ids[i], i + 1 < k ? "," : "");
+                saidaPrintf(out, "\n");
+            }
+            free(ids);
+        }
+        if (ok) pthread_rwlock_unlock(&b->travaAcervo);
+    } else if (strcmp(c[0], "PAINEL") == 0) {
+        const AnaliseCirculacao* a = &b->analise;
+        ContadorTop top[10];
+        time_t agora = time(NULL);
+        long ultimas = 0;
+        pthread_mutex_lock(&b->travaEmprestimos);
+        for (int h = 0; h < 24; h++) ultimas += analiseNaHora(a, agora - (time_t)h * 3600);
+        saidaPrintf(out, "OK %ld|%ld|", a->total, ultimas);
+        int k = analiseTop(&a->livros, top, 10);
+        for (int i = 0; i < k; i++) saidaPrintf(out, "%d:%ld%s", top[i].id, top[i].contagem, i + 1 < k ? "," : "");
+        saidaPrintf(out, "|");
+        k = analiseTop(&a->usuarios, top, 10);
+        for (int i = 0; i < k; i++) saidaPrintf(out, "%d:%ld%s", top[i].id, top[i].contagem, i + 1 < k ? "," : "");
+        pthread_mutex_unlock(&b->travaEmprestimos);
+        saidaPrintf(out, "\n");
+    } else if (strcmp(c[0], "LIVRO") == 0) {
+        pthread_rwlock_rdlock(&b->travaAcervo);
+        int pos = (n == 2 && lerInteiro(c[1], 1, 0x7fffffffL, &v1)) ? indiceIdBuscar(&b->idxLivros, (int)v1) : -1;
+        if (pos < 0) {
+            saidaPrintf(out, "ERR %s\n", descreverResultado(OP_LIVRO_INEXISTENTE));
+        } else {
+            const Livro* l = &b->livros[pos];
+            saidaPrintf(out, "OK %d|%s|%s|%d|%d|%d\n", l->id, l->titulo, l->autor, l->ano, l->exemplares,
+                        __atomic_load_n(&l->disponiveis, __ATOMIC_ACQUIRE));
+        }
+        pthread_rwlock_unlock(&b->travaAcervo);
+    } else if (strcmp(c[0], "USUARIO") == 0) {
+        pthread_rwlock_rdlock(&b->travaAcervo);
+        int pos = (n == 2 && lerInteiro(c[1], 1, 0x7fffffffL, &v1)) ? indiceIdBuscar(&b->idxUsuarios, (int)v1) : -1;
+        if (pos < 0) saidaPrintf(out, "ERR %s\n", descreverResultado(OP_USUARIO_INEXISTENTE));
+        else saidaPrintf(out, "OK %d|%s\n", b->usuarios[pos].id, b->usuarios[pos].nome);
+        pthread_rwlock_unlock(&b->travaAcervo);
+    } else if (strcmp(c[0], "EMPRESTIMOS") == 0) {
+        pthread_rwlock_rdlock(&b->travaAcervo);
+        pthread_mutex_lock(&b->travaEmprestimos);
+        if (n != 2 || !lerInteiro(c[1], 1, 0x7fffffffL, &v3) || indiceIdBuscar(&b->idxUsuarios, (int)v3) < 0) {
+            saidaPrintf(out, "ERR %s\n", descreverResultado(OP_USUARIO_INEXISTENTE));
+        } else {
+            const RegistroEmprestimos* r = &b->emps;
+            saidaPrintf(out, "OK %d|", contarEmprestimosDoUsuario(r, (int)v3));
+            for (int s = primeiroDoUsuario(r, (int)v3); s >= 0; s = proximoDoUsuario(r, s)) {
+                const Emprestimo* e = slotEmprestimo(r, s);
+                saidaPrintf(out, "%d:%d%s", e->id, e->idLivro, proximoDoUsuario(r, s) >= 0 ? "," : "");
+            }
+            saidaPrintf(out, "\n");
+        }
+        pthread_mutex_unlock(&b->travaEmprestimos);
+        pthread_rwlock_unlock(&b->travaAcervo);
+    } else {
+        saidaPrintf(out, "ERR comando desconhecido: %s\n", c[0]);
     }
-    /* Atualização por referência: marcar devolução e devolver exemplar */
-    emps[idxE].ativo = 0;
-    livros[idxL].disponiveis++;
-    puts("Devolução realizada com sucesso.");
     return 1;
 }
 
-/* ---------------------- Exibições (valor) ---------------------- */
-void exibirLivro(Livro l) {
-    printf("#%d | \"%s\" (%d) - %s | ex: %d, disp: %d\n",
-           l.id, l.titulo, l.ano, l.autor, l.exemplares, l.disponiveis);
+/* Executa o comando de um quadro binário. A resposta é montada à parte para que o
+   tamanho vá na frente, no mesmo formato do pedido. */
+static int executarQuadro(Biblioteca* b, char* comando, Saida* out, Saida* quadro) {
+    BufferMemoria* m = quadro->mem;
+    m->tam = 0;
+    m->erro = 0;
+    int continuar = executarComando(b, comando, quadro);
+    saidaDescarregar(quadro);
+    if (m->erro) {
+        m->tam = 0;
+        saidaPrintf(quadro, "ERR %s\n", descreverResultado(OP_SEM_MEMORIA));
+        saidaDescarregar(quadro);
+    }
+    unsigned char cab[QUADRO_CABECALHO];
+    cab[0] = 0;
+    cab[1] = (unsigned char)(m->tam >> 24);
+    cab[2] = (unsigned char)(m->tam >> 16);
+    cab[3] = (unsigned char)(m->tam >> 8);
+    cab[4] = (unsigned char)m->tam;
+    saidaTexto(out, (const char*)cab, QUADRO_CABECALHO);
+    saidaTexto(out, m->dados, m->tam);
+    return continuar;
 }
 
-void exibirUsuario(Usuario u) {
-    printf("#%d | %s\n", u.id, u.nome);
+/* Executa os comandos completos dos `tam` bytes do buffer e guarda o resto no início.
+   Linha de texto: campos separados por '|', terminada em \n. Quadro binário: byte 0,
+   tamanho em 4 bytes big-endian e o comando na mesma sintaxe, sem \n (o texto nunca
+   começa com 0, então os dois se misturam no mesmo fluxo). */
+static void consumirComandos(Biblioteca* b, LeitorComandos* lc, size_t tam, Saida* out, Saida* quadro) {
+    char* ini = lc->buf;
+    char* fim = lc->buf + tam;
+    while (lc->continuar && ini < fim) {
+        if (lc->descartando) {
+            char* nl = (char*)memchr(ini, '\n', (size_t)(fim - ini));
+            ini = nl ? nl + 1 : fim;
+            lc->descartando = nl == NULL;
+        } else if (*ini == '\0') {
+            if (fim - ini < QUADRO_CABECALHO) break;
+            const unsigned char* u = (const unsigned char*)ini;
+            unsigned long n = (unsigned long)u[1] << 24 | (unsigned long)u[2] << 16 | (unsigned long)u[3] << 8 | u[4];
+            if (n > SERVIDOR_BLOCO - QUADRO_CABECALHO) { /* não há como ressincronizar: encerra */
+                saidaPrintf(out, "ERR quadro longo demais\n");
+                lc->continuar = 0;
+                break;
+            }
+            if ((size_t)(fim - ini) < QUADRO_CABECALHO + n) break;
+            char* comando = ini + QUADRO_CABECALHO;
+            char guardado = comando[n]; /* pode ser o byte extra do buffer */
+            comando[n] = '\0';
+            lc->continuar = executarQuadro(b, comando, out, quadro);
+            comando[n] = guardado;
+            lc->comandos++;
+            ini = comando + n;
+        } else {
+            char* nl = (char*)memchr(ini, '\n', (size_t)(fim - ini));
+            if (!nl) break;
+            *nl = '\0';
+            if (nl > ini && nl[-1] == '\r') nl[-1] = '\0';
+            lc->continuar = executarComando(b, ini, out);
+            lc->comandos++;
+            ini = nl + 1;
+        }
+    }
+    lc->pendente = (size_t)(fim - ini);
+    if (lc->pendente == SERVIDOR_BLOCO) { /* linha maior que o bloco: descarta até o \n */
+        saidaPrintf(out, "ERR linha longa demais\n");
+        lc->pendente = 0;
+        lc->descartando = 1;
+    }
+    memmove(lc->buf, ini, lc->pendente);
 }
 
-void formatarData(time_t t, char* buf, size_t tam) {
-    struct tm* tm_info = localtime(&t);
-    strftime(buf, tam, "%d/%m/%Y %H:%M", tm_info);
+/* Fim da entrada: a última linha pode vir sem \n (um quadro incompleto é ignorado) */
+static void encerrarComandos(Biblioteca* b, LeitorComandos* lc, Saida* out) {
+    if (lc->continuar && lc->pendente > 0 && !lc->descartando && lc->buf[0] != '\0') {
+        lc->buf[lc->pendente] = '\0';
+        executarComando(b, lc->buf, out);
+        lc->comandos++;
+    }
+    lc->pendente = 0;
+    lc->continuar = 0;
 }
 
-void exibirEmprestimo(const Emprestimo e, const Livro* livros, int nLiv, const Usuario* usuarios, int nUsu) {
-    const char* status = e.ativo ? "ABERTO" : "FECHADO";
-    int iL = buscarLivroPorId(livros, nLiv, e.idLivro);
-    int iU = buscarUsuarioPorId(usuarios, nUsu, e.idUsuario);
-    char data[20] = {0};
-    formatarData(e.data, data, sizeof(data));
-    printf("#%d | Livro: %s (ID %d) | Usuário: %s (ID %d) | %s | %s\n",
-           e.id,
-           (iL >= 0 ? livros[iL].titulo : "<removido>"), e.idLivro,
-           (iU >= 0 ? usuarios[iU].nome  : "<removido>"), e.idUsuario,
-           data, status);
+static int leitorComandosIniciar(LeitorComandos* lc) {
+    memset(lc, 0, sizeof(*lc));
+    lc->buf = (char*)malloc(SERVIDOR_BLOCO + 1);
+    lc->continuar = 1;
+    return lc->buf != NULL;
 }
 
-void listarLivros(const Livro* v, int n) {
-    titulo("LIVROS");
-    if (n == 0) { puts("(vazio)"); return; }
-    for (int i = 0; i < n; i++) exibirLivro(v[i]);
+/* Lê do descritor em blocos, executa todos os comandos completos de cada bloco e
+   envia as respostas de uma vez. Retorna quantos comandos executou. */
+long servirFluxo(Biblioteca* b, int fdEntrada, FILE* saida) {
+    LeitorComandos lc;
+    BufferMemoria mq = { NULL, 0, 0, 0 };
+    Saida* out = (Saida*)malloc(2 * sizeof(Saida)); /* [0] resposta, [1] quadro em montagem */
+    if (!leitorComandosIniciar(&lc) || !out) { free(lc.buf); free(out); return 0; }
+    saidaIniciar(&out[0], saida);
+    saidaIniciarMemoria(&out[1], &mq);
+
+    while (lc.continuar) {
+        ssize_t lidos = read(fdEntrada, lc.buf + lc.pendente, SERVIDOR_BLOCO - lc.pendente);
+        if (lidos < 0 && errno == EINTR) continue;
+        if (lidos <= 0) {
+            encerrarComandos(b, &lc, &out[0]);
+            break;
+        }
+        consumirComandos(b, &lc, lc.pendente + (size_t)lidos, &out[0], &out[1]);
+        saidaDescarregar(&out[0]);
+        fflush(saida);
+    }
+    saidaDescarregar(&out[0]);
+    fflush(saida);
+    free(lc.buf);
+    free(mq.dados);
+    free(out);
+    return lc.comandos;
 }
 
-void listarUsuarios(const Usuario* v, int n) {
-    titulo("USUÁRIOS");
-    if (n == 0) { puts("(vazio)"); return; }
-    for (int i = 0; i < n; i++) exibirUsuario(v[i]);
+/* Cliente do servidor por socket: comandos lidos e respostas ainda não enviadas */
+typedef struct {
+    int fd;
+    LeitorComandos leitor;
+    BufferMemoria saida;
+    size_t enviado;     /* bytes de saida.dados já escritos no socket */
+    double inicio;
+} ClienteServidor;
+
+static void fecharCliente(ClienteServidor* c) {
+    double seg = agoraSegundos() - c->inicio;
+    long n = c->leitor.comandos;
+    fprintf(stderr, "Cliente atendido: %ld comandos em %.3f s (%.0f cmd/s)\n", n, seg, seg > 0 ? n / seg : 0);
+    close(c->fd);
+    free(c->leitor.buf);
+    free(c->saida.dados);
+    free(c);
 }
 
-void listarEmprestimos(const Emprestimo* v, int n, const Livro* livros, int nLiv, const Usuario* usuarios, int nUsu) {
-    titulo("EMPRÉSTIMOS");
-    if (n == 0) { puts("(vazio)"); return; }
-    for (int i = 0; i < n; i++) exibirEmprestimo(v[i], livros, nLiv, usuarios, nUsu);
+/* Escreve o que der sem bloquear. Retorna 0 se o cliente caiu. */
+static int enviarCliente(ClienteServidor* c) {
+    while (c->enviado < c->saida.tam) {
+        ssize_t w = write(c->fd, c->saida.dados + c->enviado, c->saida.tam - c->enviado);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+        if (w <= 0) return 0;
+        c->enviado += (size_t)w;
+    }
+    c->saida.tam = c->enviado = 0;
+    return 1;
+}
+
+/* Lê um bloco do cliente e executa os comandos completos. Retorna 0 se o cliente caiu. */
+static int atenderCliente(Biblioteca* b, ClienteServidor* c, Saida* out, Saida* quadro) {
+    LeitorComandos* lc = &c->leitor;
+    ssize_t lidos = read(c->fd, lc->buf + lc->pendente, SERVIDOR_BLOCO - lc->pendente);
+    if (lidos < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+    if (lidos < 0) return 0;
+    if (c->enviado > 0 && c->enviado >= c->saida.tam / 2) { /* recupera o espaço já enviado */
+        memmove(c->saida.dados, c->saida.dados + c->enviado, c->saida.tam - c->enviado);
+        c->saida.tam -= c->enviado;
+        c->enviado = 0;
+    }
+    saidaIniciarMemoria(out, &c->saida);
+    if (lidos == 0) encerrarComandos(b, lc, out);
+    else consumirComandos(b, lc, lc->pendente + (size_t)lidos, out, quadro);
+    saidaDescarregar(out);
+    return !c->saida.erro;
+}
+
+/* Uma thread do servidor por socket: seus próprios clientes, aceitos do socket comum.
+   O pipe de aviso só fica legível quando alguma thread desiste, e aí todas param. */
+typedef struct {
+    Biblioteca* b;
+    int fd;
+    int aviso[2];
+} LacoServidor;
+
+/* Laço de poll de uma thread: lê de todos os seus clientes e executa os comandos de cada
+   bloco na hora (a Biblioteca toma as próprias travas). Cliente que não lê as respostas
+   deixa de ser lido ao acumular SERVIDOR_PENDENTE bytes, sem atrasar os outros. */
+static void* lacoServidor(void* arg) {
+    LacoServidor* ls = (LacoServidor*)arg;
+    Biblioteca* b = ls->b;
+    ClienteServidor* clientes[SERVIDOR_CLIENTES] = { NULL };
+    struct pollfd pfd[SERVIDOR_CLIENTES + 2];
+    int qual[SERVIDOR_CLIENTES + 2];
+    BufferMemoria mq = { NULL, 0, 0, 0 };
+    Saida* out = (Saida*)malloc(2 * sizeof(Saida)); /* [0] resposta, [1] quadro em montagem */
+    if (!out) {
+        if (write(ls->aviso[1], "x", 1) < 0) { /* as outras threads seguem sem esta */ }
+        return NULL;
+    }
+    saidaIniciarMemoria(&out[1], &mq);
+    int nClientes = 0;
+    for (;;) {
+        int np = 2;
+        pfd[0].fd = ls->fd;
+        pfd[0].events = nClientes < SERVIDOR_CLIENTES ? POLLIN : 0;
+        pfd[1].fd = ls->aviso[0];
+        pfd[1].events = POLLIN;
+        for (int i = 0; i < SERVIDOR_CLIENTES; i++) {
+            ClienteServidor* c = clientes[i];
+            if (!c) continue;
+            size_t aEnviar = c->saida.tam - c->enviado;
+            pfd[np].fd = c->fd;
+            pfd[np].events = (c->leitor.continuar && aEnviar < SERVIDOR_PENDENTE ? POLLIN : 0) | (aEnviar > 0 ? POLLOUT : 0);
+            pfd[np].revents = 0;
+            qual[np++] = i;
+        }
+        if (poll(pfd, (nfds_t)np, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            if (write(ls->aviso[1], "x", 1) < 0) { /* as outras já estão parando */ }
+            break;
+        }
+        if (pfd[1].revents & POLLIN) break;
+        if (pfd[0].revents & POLLIN) {
+            int cli;
+            /* as threads disputam o accept: quem chega depois recebe EAGAIN e segue */
+            while (nClientes < SERVIDOR_CLIENTES && (cli = accept(ls->fd, NULL, NULL)) >= 0) {
+                ClienteServidor* c = (ClienteServidor*)calloc(1, sizeof(ClienteServidor));
+                if (!c || !leitorComandosIniciar(&c->leitor)) {
+                    if (c) free(c->leitor.buf);
+                    free(c);
+                    close(cli);
+                    continue;
+                }
+                fcntl(cli, F_SETFL, fcntl(cli, F_GETFL) | O_NONBLOCK);
+                c->fd = cli;
+                c->inicio = agoraSegundos();
+                int i = 0;
+                while (clientes[i]) i++;
+                clientes[i] = c;
+                nClientes++;
+            }
+        }
+        for (int k = 2; k < np; k++) {
+            ClienteServidor* c = clientes[qual[k]];
+            int vivo = 1;
+            if ((pfd[k].revents & (POLLIN | POLLHUP | POLLERR)) && c->leitor.continuar)
+                vivo = atenderCliente(b, c, &out[0], &out[1]);
+            if (vivo) vivo = enviarCliente(c);
+            if (!vivo || (!c->leitor.continuar && c->enviado == c->saida.tam)) {
+                fecharCliente(c);
+                clientes[qual[k]] = NULL;
+                nClientes--;
+            }
+        }
+    }
+    for (int i = 0; i < SERVIDOR_CLIENTES; i++)
+        if (clientes[i]) fecharCliente(clientes[i]);
+    free(mq.dados);
+    free(out);
+    return NULL;
+}
+
+/* Atende vários clientes ao mesmo tempo num socket Unix local, com nThreads laços de
+   poll em paralelo (cada cliente fica com a thread que o aceitou). */
+int servirSocket(Biblioteca* b, const char* caminho, int nThreads) {
+    struct sockaddr_un end;
+    if (strlen(caminho) >= sizeof(end.sun_path)) {
+        fprintf(stderr, "Caminho de socket longo demais.\n");
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { perror("socket"); return 1; }
+    memset(&end, 0, sizeof(end));
+    end.sun_family = AF_UNIX;
+    strcpy(end.sun_path, caminho);
+    unlink(caminho);
+    if (bind(fd, (struct sockaddr*)&end, sizeof(end)) < 0 || listen(fd, 64) < 0) {
+        perror("bind/listen");
+        close(fd);
+        return 1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN); /* cliente que fecha antes de ler não derruba o servidor */
+
+    LacoServidor ls;
+    ls.b = b;
+    ls.fd = fd;
+    pthread_t* th = (pthread_t*)malloc((size_t)nThreads * sizeof(pthread_t));
+    if (!th || pipe(ls.aviso) < 0) {
+        free(th);
+        close(fd);
+        unlink(caminho);
+        return 1;
+    }
+    int criadas = 0;
+    while (criadas < nThreads - 1 && pthread_create(&th[criadas], NULL, lacoServidor, &ls) == 0) criadas++;
+    fprintf(stderr, "Servidor ouvindo em %s (%d threads)\n", caminho, criadas + 1);
+    lacoServidor(&ls);
+    for (int i = 0; i < criadas; i++) pthread_join(th[i], NULL);
+    free(th);
+    close(ls.aviso[0]);
+    close(ls.aviso[1]);
+    close(fd);
+    unlink(caminho);
+    return 1;
 }
 
 /* ---------------------- Utilitários ---------------------- */
@@ -288,28 +4173,74 @@ void titulo(const char* s) {
 void linha(void) {
     puts("------------------------------------------------------------");
 }
+/* Lê uma linha inteira de stdin (qualquer tamanho) no buffer reaproveitável, sem o \n.
+   Em EOF devolve "". */
+char* lerLinhaEntrada(char** buf, size_t* cap) {
+    if (getline(buf, cap, stdin) < 0) {
+        if (!*buf) return "";
+        (*buf)[0] = '\0';
+    }
+    (*buf)[strcspn(*buf, "\r\n")] = 0;
+    return *buf;
+}
+
+double agoraSegundos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
 /* ---------------------- Main / Menu ---------------------- */
-int main(void) {
-    Livro* livros = NULL;     int nLiv=0, capLiv=0;
-    Usuario* usuarios = NULL; int nUsu=0, capUsu=0;
-    Emprestimo* emps = NULL;  int nEmp=0, capEmp=0;
+int main(int argc, char** argv) {
+    /* Modo não interativo: ./biblioteca --estresse [threads] [ops por thread] */
+    if (argc > 1 && strcmp(argv[1], "--estresse") == 0) {
+        int threads = argc > 2 ? atoi(argv[2]) : 8;
+        long ops = argc > 3 ? atol(argv[3]) : 1000000;
+        if (threads < 1) threads = 1;
+        if (ops < 1) ops = 1;
+        return executarEstresse(threads, ops);
+    }
+    /* ./biblioteca --benchmark [ops] [arquivo de resultados] [rotulo do build] */
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        long ops = argc > 2 ? atol(argv[2]) : 1000000;
+        if (ops < 1) ops = 1;
+        return executarBenchmark(ops, argc > 3 ? argv[3] : NULL, argc > 4 ? argv[4] : "atual");
+    }
+
+    Biblioteca b;
+    inicializar(&b);
 
-    inicializar(&livros, &nLiv, &capLiv,
-                &usuarios, &nUsu, &capUsu,
-                &emps, &nEmp, &capEmp);
+    /* ./biblioteca --servidor (stdin/stdout) ou --servidor-socket <caminho> [threads] */
+    if (argc > 1 && strcmp(argv[1], "--servidor") == 0) {
+        double inicio = agoraSegundos();
+        long n = servirFluxo(&b, STDIN_FILENO, stdout);
+        double seg = agoraSegundos() - inicio;
+        fprintf(stderr, "%ld comandos em %.3f s (%.0f cmd/s)\n", n, seg, seg > 0 ? n / seg : 0);
+        liberarMemoria(&b);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "--servidor-socket") == 0) {
+        int threads = argc > 3 ? atoi(argv[3]) : 4;
+        if (threads < 1) threads = 1;
+        int r = servirSocket(&b, argv[2], threads);
+        liberarMemoria(&b);
+        return r;
+    }
 
     /* Cadastro inicial opcional para facilitar testes */
     Livro l1 = { .id = 1, .titulo = "Algoritmos", .autor = "Cormen", .ano = 2009, .exemplares = 3, .disponiveis = 3 };
     Livro l2 = { .id = 2, .titulo = "C em Acao", .autor = "K&R", .ano = 1988, .exemplares = 2, .disponiveis = 2 };
-    adicionarLivro(&livros, &nLiv, &capLiv, l1);
-    adicionarLivro(&livros, &nLiv, &capLiv, l2);
+    cadastrarLivro(&b, l1);
+    cadastrarLivro(&b, l2);
 
     Usuario u1 = { .id = 1, .nome = "Ana Silva" };
     Usuario u2 = { .id = 2, .nome = "Bruno Costa" };
-    adicionarUsuario(&usuarios, &nUsu, &capUsu, u1);
-    adicionarUsuario(&usuarios, &nUsu, &capUsu, u2);
+    cadastrarUsuario(&b, u1);
+    cadastrarUsuario(&b, u2);
 
+    char* entrada1 = NULL; /* linhas de texto livre do menu (sem limite de tamanho) */
+    char* entrada2 = NULL;
+    size_t capEntrada1 = 0, capEntrada2 = 0;
     int opc = -1;
     do {
         titulo("SISTEMA DE BIBLIOTECA");
@@ -320,6 +4251,16 @@ int main(void) {
         puts("5 - Registrar emprestimo");
         puts("6 - Registrar devolucao");
         puts("7 - Listar emprestimos");
+        puts("8 - Importar CSV (carga em massa)");
+        puts("9 - Emprestimos em aberto de um usuario");
+        puts("10 - Quem esta com um livro");
+        puts("11 - Emprestimos em atraso");
+        puts("12 - Emprestimos em aberto por periodo");
+        puts("13 - Consultar/exportar acervo (texto, CSV ou JSON)");
+        puts("14 - Painel de circulacao");
+        puts("15 - Balcao: devolver e emprestar de uma vez");
+        puts("16 - Totais (com conferencia opcional)");
+        puts("17 - Navegar acervo em ordem (titulo, autor ou ano)");
         puts("0 - Sair");
         linha();
         printf("Opcao: ");
@@ -327,21 +4268,19 @@ int main(void) {
         limparBufferEntrada();
 
         if (opc == 1) {
-            listarLivros(livros, nLiv);
+            listarLivros(b.livros, b.nLiv);
         } else if (opc == 2) {
             Livro novo;
             /* Passagem por referência ao inserir, por valor ao exibir */
-            novo.id = proximoIdLivro(livros, nLiv);
-            printf("Titulo: "); fgets(novo.titulo, TITULO_MAX, stdin);
-            novo.titulo[strcspn(novo.titulo, "\n")] = 0;
-            printf("Autor: "); fgets(novo.autor, AUTOR_MAX, stdin);
-            novo.autor[strcspn(novo.autor, "\n")] = 0;
+            novo.id = b.maiorIdLivro + 1;
+            printf("Titulo: "); novo.titulo = lerLinhaEntrada(&entrada1, &capEntrada1);
+            printf("Autor: "); novo.autor = lerLinhaEntrada(&entrada2, &capEntrada2);
             printf("Ano: "); scanf("%d", &novo.ano); limparBufferEntrada();
             printf("Exemplares: "); scanf("%d", &novo.exemplares); limparBufferEntrada();
             if (novo.exemplares < 0) novo.exemplares = 0;
             novo.disponiveis = novo.exemplares;
 
-            if (adicionarLivro(&livros, &nLiv, &capLiv, novo)) {
+            if (cadastrarLivro(&b, novo)) {
                 puts("Livro cadastrado:");
                 exibirLivro(novo); /* por valor */
             } else {
@@ -349,15 +4288,14 @@ int main(void) {
             }
 
         } else if (opc == 3) {
-            listarUsuarios(usuarios, nUsu);
+            listarUsuarios(b.usuarios, b.nUsu);
 
         } else if (opc == 4) {
             Usuario novo;
-            novo.id = proximoIdUsuario(usuarios, nUsu);
-            printf("Nome: "); fgets(novo.nome, NOME_MAX, stdin);
-            novo.nome[strcspn(novo.nome, "\n")] = 0;
+            novo.id = b.maiorIdUsuario + 1;
+            printf("Nome: "); novo.nome = lerLinhaEntrada(&entrada1, &capEntrada1);
 
-            if (adicionarUsuario(&usuarios, &nUsu, &capUsu, novo)) {
+            if (cadastrarUsuario(&b, novo)) {
                 puts("Usuario cadastrado:");
                 exibirUsuario(novo); /* por valor */
             } else {
@@ -366,27 +4304,189 @@ int main(void) {
 
         } else if (opc == 5) {
             int idL, idU;
-            listarLivros(livros, nLiv);
+            listarLivros(b.livros, b.nLiv);
             printf("ID do livro para emprestar: "); scanf("%d", &idL); limparBufferEntrada();
 
-            listarUsuarios(usuarios, nUsu);
+            listarUsuarios(b.usuarios, b.nUsu);
             printf("ID do usuario: "); scanf("%d", &idU); limparBufferEntrada();
 
-            if (!realizarEmprestimo(livros, nLiv, usuarios, nUsu,
-                                    &emps, &nEmp, &capEmp, idL, idU)) {
-                puts("Nao foi possivel registrar o emprestimo.");
+            int r = realizarEmprestimo(&b, idL, idU);
+            if (r > 0) {
+                printf("Emprestimo #%d registrado com sucesso.\n", r);
+            } else {
+                printf("Nao foi possivel registrar o emprestimo: %s.\n", descreverResultado(r));
+                if (r == OP_SEM_EXEMPLARES) {
+                    printf("Entrar na fila de reserva? (s/n): ");
+                    int ch = getchar();
+                    if (ch != '\n' && ch != EOF) limparBufferEntrada();
+                    if (ch == 's' || ch == 'S') {
+                        r = reservarLivro(&b, idL, idU);
+                        if (r == OP_OK) puts("Reserva registrada; o exemplar sera entregue na proxima devolucao.");
+                        else printf("Nao foi possivel reservar: %s.\n", descreverResultado(r));
+                    }
+                }
             }
 
         } else if (opc == 6) {
             int idE;
-            listarEmprestimos(emps, nEmp, livros, nLiv, usuarios, nUsu);
+            listarEmprestimos(&b, 0);
             printf("ID do emprestimo a devolver: "); scanf("%d", &idE); limparBufferEntrada();
-            if (!devolverEmprestimo(livros, nLiv, emps, nEmp, idE)) {
-                puts("Nao foi possivel registrar a devolucao.");
-            }
+            int r = devolverEmprestimo(&b, idE);
+            if (r == OP_OK) puts("Devolucao realizada com sucesso.");
+            else if (r > 0) printf("Devolucao realizada; exemplar repassado a reserva (emprestimo #%d).\n", r);
+            else printf("Nao foi possivel registrar a devolucao: %s.\n", descreverResultado(r));
 
         } else if (opc == 7) {
-            listarEmprestimos(emps, nEmp, livros, nLiv, usuarios, nUsu);
+            int tamPagina;
+            printf("Linhas por pagina (0 = todas): "); scanf("%d", &tamPagina); limparBufferEntrada();
+            listarEmprestimos(&b, tamPagina);
+
+        } else if (opc == 8) {
+            int tipo;
+            long dica;
+            char caminho[256];
+            puts("1 - Livros (id,titulo,autor,ano,exemplares)");
+            puts("2 - Usuarios (id,nome)");
+            puts("3 - Emprestimos (id,idLivro,idUsuario,data,ativo)");
+            printf("Tipo: "); scanf("%d", &tipo); limparBufferEntrada();
+            printf("Arquivo: "); fgets(caminho, sizeof(caminho), stdin);
+            caminho[strcspn(caminho, "\n")] = 0;
+            printf("Linhas estimadas (0 = estimar pelo tamanho): "); scanf("%ld", &dica); limparBufferEntrada();
+
+            RelatorioImportacao rel;
+            int ok = 0;
+            const char* nomeTipo = "Livros";
+            if (tipo == 1) {
+                ok = importarLivrosCSV(&b, caminho, dica, &rel);
+            } else if (tipo == 2) {
+                nomeTipo = "Usuarios";
+                ok = importarUsuariosCSV(&b, caminho, dica, &rel);
+            } else if (tipo == 3) {
+                nomeTipo = "Emprestimos";
+                ok = importarEmprestimosCSV(&b, caminho, dica, &rel);
+            } else {
+                puts("Tipo invalido.");
+                continue;
+            }
+            if (ok) exibirRelatorioImportacao(nomeTipo, rel);
+            else puts("Falha na importacao (arquivo inacessivel ou memoria insuficiente).");
+
+        } else if (opc == 9) {
+            int idU;
+            printf("ID do usuario: "); scanf("%d", &idU); limparBufferEntrada();
+            listarEmprestimosDoUsuario(&b, idU);
+
+        } else if (opc == 10) {
+            int idL;
+            printf("ID do livro: "); scanf("%d", &idL); limparBufferEntrada();
+            listarEmprestimosDoLivro(&b, idL);
+
+        } else if (opc == 11) {
+            int modo;
+            puts("1 - Todos os atrasados");
+            puts("2 - Apenas os que venceram desde o ultimo relatorio");
+            printf("Modo: "); scanf("%d", &modo); limparBufferEntrada();
+            listarAtrasados(&b, time(NULL), modo == 2);
+
+        } else if (opc == 12) {
+            char texto[32];
+            time_t ini, fim;
+            printf("De (dd/mm/aaaa): "); fgets(texto, sizeof(texto), stdin);
+            int okIni = lerDataBR(texto, &ini, 0);
+            printf("Ate (dd/mm/aaaa): "); fgets(texto, sizeof(texto), stdin);
+            if (!okIni || !lerDataBR(texto, &fim, 1)) puts("Data invalida.");
+            else listarEmprestimosNoPeriodo(&b, ini, fim);
+
+        } else if (opc == 13) {
+            int tipo, formato, disp = 0, tamPagina = 0;
+            char trecho[256], caminho[256];
+            printf("1 - Livros, 2 - Usuarios: "); scanf("%d", &tipo); limparBufferEntrada();
+            printf("Formato (1 - texto, 2 - CSV, 3 - JSON): "); scanf("%d", &formato); limparBufferEntrada();
+            printf("Filtro por trecho (Enter = todos): "); fgets(trecho, sizeof(trecho), stdin);
+            trecho[strcspn(trecho, "\n")] = 0;
+            if (tipo == 1) { printf("Apenas disponiveis (1 = sim): "); scanf("%d", &disp); limparBufferEntrada(); }
+            printf("Arquivo (Enter = tela): "); fgets(caminho, sizeof(caminho), stdin);
+            caminho[strcspn(caminho, "\n")] = 0;
+            if (caminho[0] == '\0') { printf("Linhas por pagina (0 = todas): "); scanf("%d", &tamPagina); limparBufferEntrada(); }
+
+            FiltroRelatorio f;
+            f.formato = formato == 2 ? FORMATO_CSV : formato == 3 ? FORMATO_JSON : FORMATO_TEXTO;
+            f.trecho = trecho[0] ? trecho : NULL;
+            f.apenasDisponiveis = (disp == 1);
+            exportarAcervo(&b, tipo == 1, &f, caminho, tamPagina);
+
+        } else if (opc == 14) {
+            int idL;
+            exibirPainelCirculacao(&b, time(NULL));
+            printf("ID do livro para estimar emprestimos (0 = nenhum): "); scanf("%d", &idL); limparBufferEntrada();
+            if (idL > 0) printf("Livro #%d: cerca de %ld emprestimo(s).\n", idL, analiseEstimativa(&b.analise.livros, idL));
+
+        } else if (opc == 15) {
+            /* Atendimento de balcão: devoluções e empréstimos do mesmo usuário num lote atômico */
+            int idU, n = 0, falha;
+            long v;
+            printf("ID do usuario: "); scanf("%d", &idU); limparBufferEntrada();
+            listarEmprestimosDoUsuario(&b, idU);
+            printf("IDs dos emprestimos a devolver (separados por espaco): ");
+            char* devolver = lerLinhaEntrada(&entrada1, &capEntrada1);
+            printf("IDs dos livros a emprestar (separados por espaco): ");
+            char* emprestar = lerLinhaEntrada(&entrada2, &capEntrada2);
+            int max = 2 + (int)(strlen(devolver) + strlen(emprestar)) / 2;
+            OperacaoLote* ops = (OperacaoLote*)malloc((size_t)max * sizeof(OperacaoLote));
+            int* res = (int*)malloc((size_t)max * sizeof(int));
+            if (!ops || !res) {
+                puts("Memoria insuficiente.");
+                free(ops);
+                free(res);
+                continue;
+            }
+            int valido = 1;
+            for (char* t = strtok(devolver, " ,"); t && valido; t = strtok(NULL, " ,")) {
+                valido = lerInteiro(t, 1, 0x7fffffffL, &v);
+                ops[n].tipo = LOTE_DEVOLVER; ops[n].id = (int)v; ops[n].idUsuario = 0; n++;
+            }
+            for (char* t = strtok(emprestar, " ,"); t && valido; t = strtok(NULL, " ,")) {
+                valido = lerInteiro(t, 1, 0x7fffffffL, &v);
+                ops[n].tipo = LOTE_EMPRESTAR; ops[n].id = (int)v; ops[n].idUsuario = idU; n++;
+            }
+            if (!valido || n == 0) {
+                puts("Nada a fazer (IDs invalidos ou vazios).");
+            } else if (executarLote(&b, ops, n, res, &falha) == OP_OK) {
+                for (int i = 0; i < n; i++) {
+                    if (ops[i].tipo == LOTE_EMPRESTAR) printf("Livro #%d: emprestimo #%d.\n", ops[i].id, res[i]);
+                    else if (res[i] > 0) printf("Emprestimo #%d devolvido; repassado a reserva (#%d).\n", ops[i].id, res[i]);
+                    else printf("Emprestimo #%d devolvido.\n", ops[i].id);
+                }
+            } else {
+                printf("Nada foi registrado: %s #%d recusado (%s).\n",
+                       ops[falha].tipo == LOTE_EMPRESTAR ? "livro" : "emprestimo", ops[falha].id,
+                       descreverResultado(res[falha]));
+            }
+            free(ops);
+            free(res);
+
+        } else if (opc == 16) {
+            int conferir;
+            printf("Conferir com recontagem completa? (1 = sim): "); scanf("%d", &conferir); limparBufferEntrada();
+            exibirAgregados(&b, conferir == 1);
+
+        } else if (opc == 17) {
+            FaixaOrdem fx;
+            int campo, tamPagina;
+            memset(&fx, 0, sizeof(fx));
+            fx.anoDe = -9999;
+            fx.anoAte = 9999;
+            printf("Ordenar por (1 - titulo, 2 - autor, 3 - ano): "); scanf("%d", &campo); limparBufferEntrada();
+            fx.chave = campo == 2 ? ORDEM_AUTOR : campo == 3 ? ORDEM_ANO : ORDEM_TITULO;
+            if (fx.chave == ORDEM_ANO) {
+                printf("De (ano): "); scanf("%d", &fx.anoDe); limparBufferEntrada();
+                printf("Ate (ano): "); scanf("%d", &fx.anoAte); limparBufferEntrada();
+            } else {
+                printf("A partir de (Enter = inicio): "); fx.textoDe = lerLinhaEntrada(&entrada1, &capEntrada1);
+                printf("Ate os que comecam com (Enter = fim): "); fx.textoAte = lerLinhaEntrada(&entrada2, &capEntrada2);
+            }
+            printf("Linhas por pagina (0 = todas): "); scanf("%d", &tamPagina); limparBufferEntrada();
+            navegarAcervo(&b, &fx, tamPagina);
 
         } else if (opc == 0) {
             puts("Encerrando...");
@@ -397,6 +4497,8 @@ int main(void) {
 
     } while (opc != 0);
 
-    liberarMemoria(livros, usuarios, emps);
+    free(entrada1);
+    free(entrada2);
+    liberarMemoria(&b);
     return 0;
 }
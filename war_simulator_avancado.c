@@ -8,10 +8,20 @@
  * Data: 2025
  */
 
+#define _POSIX_C_SOURCE 200809L  // clock_gettime, sockets, poll e sigaction
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 // Definicao da estrutura Pais
 typedef struct {
@@ -46,6 +56,204 @@ const char* CORES_DISPONIVEIS[] = {
 #define MAX_ALIADOS 3
 #define MIN_TROPAS 3
 #define MAX_TROPAS 10
+#define PAGINA_PAISES 64         // Paises por pagina compartilhada entre bifurcacoes
+#define ROLLOUTS_PADRAO 2000     // Futuros simulados por ataque candidato
+#define PROFUNDIDADE_ROLLOUT 20  // Ataques aleatorios depois da jogada avaliada
+#define NUM_THREADS 4            // Threads que simulam os futuros em paralelo
+#define MAX_VIZINHOS 8           // Grade com 4 vizinhos fixos + ate 4 diagonais sorteadas
+#define BATALHAS_ESTRESSE 1000000 // Batalhas do teste de estresse sobre o mapa gerado
+#define PODER_MAXIMO 10
+#define VIDA_MAXIMA 100
+#define MAX_SESSOES_PADRAO 10000 // Partidas simultaneas no hospedeiro de sessoes
+#define LINHA_EVENTO 96          // Maior linha de evento aceita ("<sessao> <comando> ...")
+#define RESPOSTA_EVENTO 512      // Maior resposta (ESTADO com MAX_PAISES paises)
+#define FILA_EVENTOS 4096        // Eventos pendentes por trabalhador
+#define MAX_CONEXOES 64          // Clientes simultaneos no socket de sessoes
+#define SAIDA_CONEXAO 65536      // Respostas ainda nao enviadas por cliente
+#define PENDENTES_CONEXAO 32     // Linhas sem resposta antes de parar de ler o cliente
+#define FAIXAS_LATENCIA 32       // Histograma de latencia em potencias de 2 (us)
+
+// Variantes de regras de batalha. Cada linha gera, em tempo de compilacao, um
+// kernel de batalha e um lote proprios, com as regras como constantes:
+//   X(nome, faces do dado, divisor do bonus de poder do atacante e do defensor
+//     (0 = sem bonus), vida perdida pelo atacante na derrota e no empate,
+//     faixas sorteadas apos a batalha: poder e vida ganhos pelo vencedor e vida
+//     perdida pelo territorio conquistado (min, max), poder maximo, vida maxima)
+// A primeira linha sao as regras padrao do jogo (--regras escolhe outra).
+#define VARIANTES_REGRAS(X) \
+    X(Classica,   6, 3, 4,  5, 2, 1, 2,  5, 14, 2,  6, PODER_MAXIMO, VIDA_MAXIMA) \
+    X(D8,         8, 3, 4,  5, 2, 1, 2,  5, 14, 2,  6, PODER_MAXIMO, VIDA_MAXIMA) \
+    X(Defensiva,  6, 4, 2,  5, 2, 1, 2,  5, 14, 1,  3, PODER_MAXIMO, VIDA_MAXIMA) \
+    X(Sangrenta,  6, 3, 4, 10, 5, 1, 2,  2,  8, 4, 10, PODER_MAXIMO, VIDA_MAXIMA) \
+    X(SemBonus,   6, 0, 0,  5, 2, 0, 0,  5, 14, 2,  6, PODER_MAXIMO, VIDA_MAXIMA) \
+    X(Epica,     12, 2, 3,  8, 3, 1, 3, 10, 24, 3,  9, 20, 200)
+
+// Pagina de paises compartilhada entre estados bifurcados (copy-on-write)
+typedef struct {
+    int referencias;             // Quantos estados apontam para esta pagina
+    Pais paises[PAGINA_PAISES];
+} PaginaPaises;
+
+// Estado de jogo bifurcavel: uma bifurcacao copia so o vetor de paginas,
+// e uma pagina so eh duplicada quando um pais dela eh alterado
+typedef struct {
+    PaginaPaises** paginas;
+    int numPaginas;
+    int numPaises;
+    int paginasCopiadas;         // Estatistica: copias feitas por este estado
+} EstadoJogo;
+
+// Resultado esperado de um ataque candidato, medido em varios futuros simulados
+typedef struct {
+    int defensor;
+    int rollouts;
+    int vitoriasImediatas;       // Rollouts em que a primeira batalha foi vencida
+    int eliminacoes;             // Rollouts em que o atacante terminou eliminado
+    double territoriosMedios;    // Paises com a cor do atacante ao fim
+    double paginasCopiadas;      // Media de paginas duplicadas por rollout
+} ResultadoAtaque;
+
+// Mapa gerado proceduralmente: territorios numa grade largura x altura e
+// adjacencia compacta (CSR): os vizinhos de i ficam em
+// vizinhos[inicioVizinhos[i] .. inicioVizinhos[i + 1] - 1], em ordem crescente
+typedef struct {
+    Pais* paises;
+    int numPaises;
+    int numExercitos;
+    int largura;
+    int* inicioVizinhos;
+    int* vizinhos;
+    unsigned long long semente;
+} Mapa;
+
+// Faixa de territorios gerada por uma thread
+typedef struct {
+    Mapa* mapa;
+    int inicio, fim;
+    int etapa;                   // 1 = contar vizinhos, 2 = preencher paises e vizinhos
+} TarefaGeracao;
+
+// Batalha com regras fixas: resolve o ataque e retorna 1/-1/0 (como resolverAtaque)
+typedef int (*KernelBatalha)(Pais* atacante, Pais* defensor, unsigned int* semente,
+                             int* dadoAtacante, int* dadoDefensor);
+
+// Resultado de um lote de batalhas
+typedef struct {
+    long batalhas;               // Sorteios que viraram batalha
+    long conquistas;
+    long eliminacoes;            // Territorios sem vida (so as penalidades matam)
+    long partidas;               // Vezes que o mapa comecou do original
+} ResultadoLote;
+
+// Lote de batalhas com regras fixas sobre uma copia do mapa (trabalho), que
+// guarda o estado entre as batalhas: cada sorteio escolhe uma fronteira (pares
+// i, j em fronteiras) e um lado; sem ataque possivel nela o sorteio eh pulado,
+// e depois de numFronteiras sorteios seguidos pulados a copia volta ao original.
+typedef void (*LoteBatalhas)(const Pais* paises, Pais* trabalho, int numPaises, const int* fronteiras,
+                             int numFronteiras, long batalhas, unsigned int* semente, ResultadoLote* resultado);
+
+// Uma variante de regras: parametros (para exibir e para o modo interpretado)
+// e os kernels especializados gerados por VARIANTES_REGRAS
+typedef struct {
+    const char* nome;
+    int faces;
+    int divAtaque, divDefesa;
+    int vidaDerrota, vidaEmpate;
+    int poderMin, poderMax;      // Faixas sorteadas apos a batalha
+    int vidaGanhoMin, vidaGanhoMax;
+    int vidaPerdaMin, vidaPerdaMax;
+    int poderMaximo, vidaMaxima;
+    KernelBatalha batalha;
+    LoteBatalhas lote;
+} VarianteRegras;
+
+// Estados de uma sessao hospedada
+typedef enum {
+    SESSAO_LIVRE,                // Sem partida (antes de NOVA ou depois de FIM)
+    SESSAO_JOGANDO,
+    SESSAO_ENCERRADA             // Sobrou um exercito ou nao ha mais ataques possiveis
+} EstadoSessao;
+
+// Partida hospedada: memoria fixa, sem alocacao por sessao. Avanca um evento
+// por vez (maquina de estados) em vez de bloquear no scanf do menu.
+typedef struct {
+    EstadoSessao estado;
+    Pais paises[MAX_PAISES];
+    int numPaises;
+    unsigned int semente;        // Gerador proprio da partida (sortear)
+    const VarianteRegras* regras; // Regras da partida (NOVA ... [regras])
+    long jogadas;
+    double latenciaTotal;        // Segundos somados das jogadas (chegada -> resposta)
+    double latenciaMaxima;
+} Sessao;
+
+// Evento de entrada: uma linha "<sessao> <comando> [argumentos]" e a sua origem
+typedef struct {
+    int sessao;
+    int conexao;                 // Posicao em conexoes (-1 = arquivo/saida padrao)
+    unsigned int geracao;        // Geracao da conexao quando o evento chegou
+    double chegada;
+    int longa;                   // Linha maior que LINHA_EVENTO (responde erro, em ordem)
+    char linha[LINHA_EVENTO];
+} Evento;
+
+typedef struct Hospedeiro Hospedeiro;
+
+// Trabalhador com fila circular propria: a sessao s sempre cai no trabalhador
+// s % numTrabalhadores, entao os eventos de uma partida sao processados em
+// ordem e a partida nao precisa de trava
+typedef struct {
+    Hospedeiro* hospedeiro;
+    pthread_t thread;
+    pthread_mutex_t trava;       // Protege a fila e as estatisticas abaixo
+    pthread_cond_t temEvento, temEspaco;
+    Evento fila[FILA_EVENTOS];
+    int inicio, quantidade;
+    int encerrar;
+    long eventos;
+    long latencias[FAIXAS_LATENCIA];
+    double latenciaMaxima;
+} Trabalhador;
+
+// Cliente do socket de sessoes; a geracao muda quando a posicao eh reusada,
+// para respostas atrasadas nao irem para o cliente seguinte
+typedef struct {
+    int fd;                      // -1 = posicao livre
+    unsigned int geracao;
+    int lenta;                   // Saida estourou: desconectar
+    int descartando;             // Linha longa demais: ignora ate o proximo '\n'
+    int fimEntrada;              // Cliente fechou a escrita: responde o que falta e fecha
+    int eventosPendentes;        // Linhas do cliente ainda sem resposta
+    size_t pendente;
+    char entrada[4 * LINHA_EVENTO];
+    size_t tamSaida;             // Respostas esperando o laco de eventos enviar
+    char saida[SAIDA_CONEXAO];
+} Conexao;
+
+// Hospedeiro de muitas partidas num processo so
+struct Hospedeiro {
+    Sessao* sessoes;             // Indices 1..maxSessoes (0 = comandos do hospedeiro)
+    int maxSessoes;
+    int sessoesAtivas;           // Atualizado com operacoes atomicas
+    Trabalhador* trabalhadores;
+    int numTrabalhadores;
+    pthread_mutex_t travaSaida;  // Respostas inteiras, uma de cada vez
+    FILE* saida;
+    int despertar[2];            // Pipe que acorda o laco de eventos quando ha resposta
+    Conexao conexoes[MAX_CONEXOES];
+};
+
+// Parte dos rollouts de um ataque candidato, executada por uma thread
+typedef struct {
+    const EstadoJogo* base;      // Estado compartilhado (somente leitura)
+    int atacante, defensor;
+    int inicio, fim;             // Faixa de rollouts; o numero define a semente
+    int concluidos;
+    int vitoriasImediatas;
+    int eliminacoes;
+    long territorios;
+    long paginasCopiadas;
+} TarefaRollout;
 
 // Prototipos das funcoes
 void inicializarPais(Pais* pais, const char* nome, const char* cor, int tropas);
@@ -55,26 +263,171 @@ void exibirPais(Pais* pais, int indice);
 void exibirTodosPaises(Pais* paises, int numPaises);
 void exibirRanking(Pais* paises, int numPaises);
 void atacar(Pais* atacante, Pais* defensor);
+int resolverAtaque(Pais* atacante, Pais* defensor, unsigned int* semente, int* dadoAtacante, int* dadoDefensor);
 int escolherPais(Pais* paises, int numPaises, const char* acao);
-int validarAtaque(Pais* atacante, Pais* defensor);
+int validarAtaque(const Pais* atacante, const Pais* defensor);
 void atualizarPoderVida(Pais* pais, int vitoria);
+void aplicarPoderVida(Pais* pais, int vitoria, unsigned int* semente);
+static inline void ajustarPoderVida(Pais* pais, int vitoria, unsigned int* semente,
+                                    const int poderMin, const int poderMax,
+                                    const int vidaGanhoMin, const int vidaGanhoMax,
+                                    const int vidaPerdaMin, const int vidaPerdaMax,
+                                    const int poderMaximo, const int vidaMaxima);
+static inline int resolverComRegras(Pais* atacante, Pais* defensor, unsigned int* semente,
+                                    int* dadoAtacante, int* dadoDefensor,
+                                    const int faces, const int divAtaque, const int divDefesa,
+                                    const int vidaDerrota, const int vidaEmpate,
+                                    const int poderMin, const int poderMax,
+                                    const int vidaGanhoMin, const int vidaGanhoMax,
+                                    const int vidaPerdaMin, const int vidaPerdaMax,
+                                    const int poderMaximo, const int vidaMaxima);
+#define DECLARAR_VARIANTE(nome, ...) \
+    int batalha##nome(Pais* atacante, Pais* defensor, unsigned int* semente, int* dadoAtacante, int* dadoDefensor); \
+    void lote##nome(const Pais* paises, Pais* trabalho, int numPaises, const int* fronteiras, int numFronteiras, \
+                    long batalhas, unsigned int* semente, ResultadoLote* resultado);
+VARIANTES_REGRAS(DECLARAR_VARIANTE)
+int buscarVariante(const char* nome);
+void loteInterpretado(const VarianteRegras* regras, const Pais* paises, Pais* trabalho, int numPaises,
+                      const int* fronteiras, int numFronteiras, long batalhas, unsigned int* semente,
+                      ResultadoLote* resultado);
+void compararVariantes(const Pais* paises, const int* fronteiras, int numFronteiras,
+                       const char* regras, unsigned int semente);
+EstadoJogo* criarEstado(const Pais* paises, int numPaises);
+EstadoJogo* bifurcarEstado(const EstadoJogo* base);
+const Pais* lerPaisEstado(const EstadoJogo* estado, int indice);
+Pais* alterarPaisEstado(EstadoJogo* estado, int indice);
+void liberarEstado(EstadoJogo* estado);
+int simularRollout(EstadoJogo* estado, int atacante, int defensor, unsigned int* semente);
+void* executarRollouts(void* arg);
+int avaliarAtaques(const Pais* paises, int numPaises, int atacante, int rollouts, ResultadoAtaque* resultados);
+void exibirAnaliseAtaques(Pais* paises, int numPaises, int atacante);
 void liberarMemoria(Pais* paises);
 void exibirMenu();
 void exibirMenuAliados();
 int simularDado();
+int sortear(unsigned int* semente, int faixa);
+unsigned long long misturar(unsigned long long semente, unsigned long long chave);
+void nomearTerritorio(char* nome, unsigned int codigo);
+int vizinhosDoTerritorio(const Mapa* mapa, int indice, int* saida);
+void* executarGeracao(void* arg);
+Mapa* gerarMapa(int numPaises, int numExercitos, unsigned long long semente, int numThreads);
+int verificarMapa(const Mapa* mapa);
+void liberarMapa(Mapa* mapa);
+int executarGerador(int numPaises, int numExercitos, unsigned long long semente, int numThreads, const char* regras);
+double agoraSegundos();
+void iniciarSessao(Sessao* sessao, int numPaises, unsigned int semente);
+int escolherJogadaIA(const Sessao* sessao, int* atacante, int* defensor);
+int verificarFimSessao(Sessao* sessao);
+int processarEvento(Hospedeiro* h, Evento* ev, char* resposta, size_t tamanho);
+void* executarTrabalhador(void* arg);
+Hospedeiro* criarHospedeiro(int numTrabalhadores, int maxSessoes, FILE* saida);
+void pararTrabalhadores(Hospedeiro* h);
+void liberarHospedeiro(Hospedeiro* h);
+void responderEvento(Hospedeiro* h, int conexao, unsigned int geracao, const char* texto);
+void despacharEvento(Hospedeiro* h, const char* linha, int conexao, unsigned int geracao);
+double percentilLatencia(const long* latencias, long total, double fracao);
+void resumirLatencias(Hospedeiro* h, long* eventos, long* latencias, double* maxima);
+void exibirResumoHospedeiro(Hospedeiro* h, double segundos);
+int hospedarArquivo(Hospedeiro* h, FILE* entrada);
+void tratarSinalEncerrar(int sinal);
+int abrirSocketSessoes(Hospedeiro* h, const char* caminho);
+int hospedarSocket(Hospedeiro* h, const char* caminho);
 void limparBuffer();
 int paisesDisponiveis[NUM_PAISES_DISPONIVEIS];
 int coresDisponiveis[NUM_CORES_DISPONIVEIS];
 
+// Tabela das variantes de regras (kernels gerados por VARIANTES_REGRAS)
+#define LINHA_VARIANTE(nome, ...) { #nome, __VA_ARGS__, batalha##nome, lote##nome },
+const VarianteRegras VARIANTES[] = { VARIANTES_REGRAS(LINHA_VARIANTE) };
+#define NUM_VARIANTES ((int)(sizeof(VARIANTES) / sizeof(VARIANTES[0])))
+
+// Regras do jogo interativo, das analises e das sessoes sem regras proprias.
+// Escolhidas uma vez na partida (--regras), antes de qualquer thread.
+const VarianteRegras* regrasJogo = &VARIANTES[0];
+
+// Bonus de poder no dado com o divisor da variante (0 = sem bonus)
+static inline int bonusPoder(int poder, int divisor) {
+    return divisor > 0 ? poder / divisor : 0;
+}
+
 /*
  * Funcao principal do programa
+ * Uso: ./war                                               (jogo interativo)
+ *      ./war --gerar <territorios> <exercitos> [semente] [threads] [regras|todas]
+ *      ./war --sessoes <arquivo|-> [trabalhadores] [max sessoes]   (eventos de arquivo)
+ *      ./war --sessoes-socket <caminho> [trabalhadores] [max sessoes]
+ * Qualquer modo aceita antes "--regras <variante>": as regras do jogo (padrao Classica).
  */
-int main() {
+int main(int argc, char* argv[]) {
     int numPaises;
     Pais* paises = NULL;
     int opcao;
     int paisSelecionado;
     
+    // Regras do jogo escolhidas na partida: o kernel fica em regrasJogo
+    if (argc >= 3 && strcmp(argv[1], "--regras") == 0) {
+        int v = buscarVariante(argv[2]);
+        if (v < 0) {
+            printf("Erro: Regras desconhecidas! Use uma de:");
+            for (int k = 0; k < NUM_VARIANTES; k++) printf(" %s", VARIANTES[k].nome);
+            printf("\n");
+            return 1;
+        }
+        regrasJogo = &VARIANTES[v];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    
+    // Modo gerador: mapa procedural grande, sem menu
+    if (argc >= 4 && strcmp(argv[1], "--gerar") == 0) {
+        long territorios = atol(argv[2]);
+        long exercitos = atol(argv[3]);
+        unsigned long long semente = argc >= 5 ? strtoull(argv[4], NULL, 10) : (unsigned long long)time(NULL);
+        int threads = argc >= 6 ? atoi(argv[5]) : NUM_THREADS;
+        const char* regras = argc >= 7 ? argv[6] : regrasJogo->nome;
+        if (territorios < 2 || territorios > 100000000L || exercitos < 2 || exercitos > territorios ||
+            threads < 1 || threads > 256) {
+            printf("Erro: Use --gerar <territorios 2-100000000> <exercitos 2-territorios> [semente] [threads 1-256] [regras]\n");
+            return 1;
+        }
+        if (strcmp(regras, "todas") != 0 && buscarVariante(regras) < 0) {
+            printf("Erro: Regras desconhecidas! Use todas ou uma de:");
+            for (int v = 0; v < NUM_VARIANTES; v++) printf(" %s", VARIANTES[v].nome);
+            printf("\n");
+            return 1;
+        }
+        return executarGerador((int)territorios, (int)exercitos, semente, threads, regras);
+    }
+    
+    // Hospedeiro de sessoes: muitas partidas por eventos, sem menu
+    if (argc >= 3 && (strcmp(argv[1], "--sessoes") == 0 || strcmp(argv[1], "--sessoes-socket") == 0)) {
+        int trabalhadores = argc >= 4 ? atoi(argv[3]) : NUM_THREADS;
+        long maxSessoes = argc >= 5 ? atol(argv[4]) : MAX_SESSOES_PADRAO;
+        if (trabalhadores < 1 || trabalhadores > 256 || maxSessoes < 1 || maxSessoes > 10000000L) {
+            printf("Erro: Use %s <origem> [trabalhadores 1-256] [max sessoes 1-10000000]\n", argv[1]);
+            return 1;
+        }
+        FILE* entrada = NULL;
+        if (strcmp(argv[1], "--sessoes") == 0) {
+            entrada = strcmp(argv[2], "-") == 0 ? stdin : fopen(argv[2], "r");
+            if (entrada == NULL) {
+                printf("Erro: Nao foi possivel abrir %s!\n", argv[2]);
+                return 1;
+            }
+        }
+        Hospedeiro* h = criarHospedeiro(trabalhadores, (int)maxSessoes, stdout);
+        if (h == NULL) {
+            printf("Erro: Falha ao criar as sessoes ou os trabalhadores!\n");
+            if (entrada != NULL && entrada != stdin) fclose(entrada);
+            return 1;
+        }
+        if (entrada == NULL) return hospedarSocket(h, argv[2]);
+        int status = hospedarArquivo(h, entrada);
+        if (entrada != stdin) fclose(entrada);
+        return status;
+    }
+    
     // Inicializa o gerador de numeros aleatorios
     srand(time(NULL));
     
@@ -83,7 +436,9 @@ int main() {
     printf("- Sistema de aliados (maximo 3 por pais)\n");
     printf("- Poder e vida automaticos\n");
     printf("- Ranking de vitorias e derrotas\n");
-    printf("- %d paises disponiveis para escolha\n\n", NUM_PAISES_DISPONIVEIS);
+    printf("- Analise de ataques por simulacao de futuros\n");
+    printf("- %d paises disponiveis para escolha\n", NUM_PAISES_DISPONIVEIS);
+    printf("- Regras de batalha: %s\n\n", regrasJogo->nome);
     
     // Solicita o numero de paises ao usuario
     printf("Escolha o numero de paises para a simulacao (%d-%d): ", MIN_PAISES, MAX_PAISES);
@@ -128,7 +483,7 @@ int main() {
         limparBuffer();
         
         if (resultado != 1) {
-            printf("Entrada invalida! Digite um numero entre 1 e 6.\n");
+            printf("Entrada invalida! Digite um numero entre 1 e 7.\n");
             opcao = 0; // Forca uma opcao invalida para mostrar o menu novamente
         }
         
@@ -217,6 +572,15 @@ int main() {
                 break;
                 
             case 6:
+                printf("\n=== ANALISE DE ATAQUES ===\n");
+                printf("Escolha o pais que vai atacar:\n");
+                paisSelecionado = escolherPais(paises, numPaises, "analisar");
+                if (paisSelecionado != -1) {
+                    exibirAnaliseAtaques(paises, numPaises, paisSelecionado);
+                }
+                break;
+                
+            case 7:
                 printf("\nEncerrando o simulador...\n");
                 break;
                 
@@ -224,12 +588,12 @@ int main() {
                 printf("Opcao invalida! Tente novamente.\n");
         }
         
-        if (opcao != 6) {
+        if (opcao != 7) {
             printf("\nPressione Enter para continuar...");
             getchar(); // Simples - apenas aguarda Enter
         }
         
-    } while (opcao != 6);
+    } while (opcao != 7);
     
     // Libera a memoria alocada
     liberarMemoria(paises);
@@ -518,85 +882,54 @@ void exibirRanking(Pais* paises, int numPaises) {
  */
 void atacar(Pais* atacante, Pais* defensor) {
     int dadoAtacante, dadoDefensor;
-    int bonusPoder = 0;
+    const VarianteRegras* regras = regrasJogo;
+    int bonusAtacante = bonusPoder(atacante->poder, regras->divAtaque); // Antes da batalha (o poder muda depois)
+    int bonusDefensor = bonusPoder(defensor->poder, regras->divDefesa);
+    int tropasAntes = atacante->tropas;
+    char corDefensor[15];
+    strcpy(corDefensor, defensor->cor); // A cor muda se o defensor for conquistado
     
-    // Calcula bonus de poder baseado no nivel
-    bonusPoder = atacante->poder / 3; // Bonus baseado no poder
-    
-    // Simula os dados de batalha
-    dadoAtacante = simularDado() + bonusPoder;
-    dadoDefensor = simularDado() + (defensor->poder / 4); // Defensor tem bonus menor
+    // Resolve a batalha com o gerador global (rand)
+    int resultado = resolverAtaque(atacante, defensor, NULL, &dadoAtacante, &dadoDefensor);
     
     printf("\nRolando os dados...\n");
-    printf("Dado do atacante (%s + bonus %d): %d\n", atacante->cor, bonusPoder, dadoAtacante);
-    printf("Dado do defensor (%s + bonus %d): %d\n", defensor->cor, defensor->poder / 4, dadoDefensor);
+    printf("Dado do atacante (%s + bonus %d): %d\n", atacante->cor, bonusAtacante, dadoAtacante);
+    printf("Dado do defensor (%s + bonus %d): %d\n", corDefensor, bonusDefensor, dadoDefensor);
     
-    // Determina o vencedor e atualiza os paises
-    if (dadoAtacante > dadoDefensor) {
+    if (resultado > 0) {
         printf("\n*** VITORIA DO ATACANTE! ***\n");
         printf("O pais %s foi conquistado pelo exercito %s!\n", 
                defensor->nome, atacante->cor);
-        
-        // Atualiza estatisticas
-        atacante->vitorias++;
-        defensor->derrotas++;
-        
-        // Calcula tropas a transferir (metade das tropas do atacante)
-        int tropasTransferidas = atacante->tropas / 2;
-        if (tropasTransferidas == 0) tropasTransferidas = 1; // Minimo de 1 tropa
-        
-        // Atualiza o pais defensor
-        strcpy(defensor->cor, atacante->cor);  // Muda a cor do exercito
-        defensor->tropas = tropasTransferidas; // Define as novas tropas
-        
-        // Atualiza o pais atacante (perde as tropas transferidas)
-        atacante->tropas -= tropasTransferidas;
-        
-        // Atualiza poder e vida do vencedor
-        atualizarPoderVida(atacante, 1);
-        atualizarPoderVida(defensor, 0);
-        
-        printf("Tropas transferidas: %d\n", tropasTransferidas);
-        
-    } else if (dadoDefensor > dadoAtacante) {
+        printf("Tropas transferidas: %d\n", tropasAntes - atacante->tropas);
+    } else if (resultado < 0) {
         printf("\n*** VITORIA DO DEFENSOR! ***\n");
         printf("O pais %s resistiu ao ataque!\n", defensor->nome);
-        
-        // Atualiza estatisticas
-        defensor->vitorias++;
-        atacante->derrotas++;
-        
-        // Atacante perde uma tropa
-        atacante->tropas--;
-        atacante->vida -= 5; // Perde vida ao perder
-        
-        // Defensor ganha poder
-        atualizarPoderVida(defensor, 1);
-        
-        printf("O atacante perdeu 1 tropa e 5 pontos de vida na tentativa.\n");
-        
+        printf("O atacante perdeu 1 tropa e %d pontos de vida na tentativa.\n", regras->vidaDerrota);
     } else {
         printf("\n*** EMPATE! ***\n");
         printf("A batalha foi indecisiva!\n");
-        
-        // Em caso de empate, atacante perde uma tropa
-        atacante->tropas--;
-        atacante->vida -= 2;
-        
-        printf("O atacante perdeu 1 tropa e 2 pontos de vida no empate.\n");
+        printf("O atacante perdeu 1 tropa e %d pontos de vida no empate.\n", regras->vidaEmpate);
     }
     
     // Verifica se algum pais foi eliminado
-    if (atacante->tropas <= 0 || atacante->vida <= 0) {
-        atacante->ativo = 0;
+    if (!atacante->ativo) {
         printf("ATENCAO: %s foi eliminado da batalha!\n", atacante->nome);
     }
-    if (defensor->tropas <= 0 || defensor->vida <= 0) {
-        defensor->ativo = 0;
+    if (!defensor->ativo) {
         printf("ATENCAO: %s foi eliminado da batalha!\n", defensor->nome);
     }
 }
 
+/*
+ * Funcao que aplica as regras do jogo (kernel da variante em regrasJogo) a uma
+ * batalha, sem imprimir nada. Com semente NULL usa rand(); com semente usa um gerador
+ * proprio, o que permite simular futuros reprodutiveis em varias threads.
+ * Retorna 1 (vitoria do atacante), -1 (vitoria do defensor) ou 0 (empate).
+ */
+int resolverAtaque(Pais* atacante, Pais* defensor, unsigned int* semente, int* dadoAtacante, int* dadoDefensor) {
+    return regrasJogo->batalha(atacante, defensor, semente, dadoAtacante, dadoDefensor);
+}
+
 /*
  * Funcao para escolher um pais da lista
  */
@@ -631,7 +964,7 @@ int escolherPais(Pais* paises, int numPaises, const char* acao) {
 /*
  * Funcao para validar se um ataque eh permitido
  */
-int validarAtaque(Pais* atacante, Pais* defensor) {
+int validarAtaque(const Pais* atacante, const Pais* defensor) {
     // Verifica se os paises sao da mesma cor
     if (strcmp(atacante->cor, defensor->cor) == 0) {
         return 0;
@@ -652,28 +985,1660 @@ int validarAtaque(Pais* atacante, Pais* defensor) {
  * Funcao para atualizar poder e vida baseado no resultado
  */
 void atualizarPoderVida(Pais* pais, int vitoria) {
+    aplicarPoderVida(pais, vitoria, NULL);
+}
+
+/*
+ * Funcao que aplica o ganho ou a perda de poder e vida das regras do jogo,
+ * sorteando com a semente informada (NULL = rand)
+ */
+void aplicarPoderVida(Pais* pais, int vitoria, unsigned int* semente) {
+    const VarianteRegras* r = regrasJogo;
+    ajustarPoderVida(pais, vitoria, semente, r->poderMin, r->poderMax, r->vidaGanhoMin, r->vidaGanhoMax,
+                     r->vidaPerdaMin, r->vidaPerdaMax, r->poderMaximo, r->vidaMaxima);
+}
+
+/*
+ * Funcao generica de poder e vida apos uma batalha, com as faixas e os limites
+ * como parametros (constantes quando chamada por um kernel de variante)
+ */
+static inline void ajustarPoderVida(Pais* pais, int vitoria, unsigned int* semente,
+                                    const int poderMin, const int poderMax,
+                                    const int vidaGanhoMin, const int vidaGanhoMax,
+                                    const int vidaPerdaMin, const int vidaPerdaMax,
+                                    const int poderMaximo, const int vidaMaxima) {
     if (vitoria) {
-        // Aumenta poder e vida em caso de vitoria
-        pais->poder += (rand() % 2) + 1; // +1 ou +2
-        pais->vida += (rand() % 10) + 5; // +5 a +14
+        // Aumenta poder e vida em caso de vitoria (Classica: +1 a +2 e +5 a +14)
+        pais->poder += sortear(semente, poderMax - poderMin + 1) + poderMin;
+        pais->vida += sortear(semente, vidaGanhoMax - vidaGanhoMin + 1) + vidaGanhoMin;
         
         // Limites maximos
-        if (pais->poder > 10) pais->poder = 10;
-        if (pais->vida > 100) pais->vida = 100;
+        if (pais->poder > poderMaximo) pais->poder = poderMaximo;
+        if (pais->vida > vidaMaxima) pais->vida = vidaMaxima;
     } else {
-        // Diminui ligeiramente em caso de derrota
-        pais->vida -= (rand() % 5) + 2; // -2 a -6
+        // Diminui em caso de derrota (Classica: -2 a -6)
+        pais->vida -= sortear(semente, vidaPerdaMax - vidaPerdaMin + 1) + vidaPerdaMin;
         
         // Limite minimo
         if (pais->vida < 1) pais->vida = 1;
     }
 }
 
+/*
+ * Funcao generica de batalha: as regras chegam como parametros. Nao deve ser
+ * chamada com valores de tempo de execucao no laco principal; cada linha de
+ * VARIANTES_REGRAS a instancia com constantes, e o compilador entao troca as
+ * divisoes por multiplicacoes e remove os testes das regras.
+ * Sorteia na mesma ordem que as regras originais, entao a variante Classica
+ * reproduz exatamente as batalhas anteriores para a mesma semente.
+ */
+static inline int resolverComRegras(Pais* atacante, Pais* defensor, unsigned int* semente,
+                                    int* dadoAtacante, int* dadoDefensor,
+                                    const int faces, const int divAtaque, const int divDefesa,
+                                    const int vidaDerrota, const int vidaEmpate,
+                                    const int poderMin, const int poderMax,
+                                    const int vidaGanhoMin, const int vidaGanhoMax,
+                                    const int vidaPerdaMin, const int vidaPerdaMax,
+                                    const int poderMaximo, const int vidaMaxima) {
+    // Simula os dados de batalha (bonus de poder conforme a variante)
+    *dadoAtacante = sortear(semente, faces) + 1 + (divAtaque > 0 ? atacante->poder / divAtaque : 0);
+    *dadoDefensor = sortear(semente, faces) + 1 + (divDefesa > 0 ? defensor->poder / divDefesa : 0);
+    int resultado = (*dadoAtacante > *dadoDefensor) - (*dadoAtacante < *dadoDefensor);
+    
+    if (resultado > 0) {
+        atacante->vitorias++;
+        defensor->derrotas++;
+        
+        // Tropas a transferir: metade das tropas do atacante, no minimo 1
+        int tropasTransferidas = atacante->tropas / 2;
+        tropasTransferidas += (tropasTransferidas == 0);
+        
+        // O defensor passa para o exercito do atacante
+        memcpy(defensor->cor, atacante->cor, sizeof(defensor->cor));
+        defensor->tropas = tropasTransferidas;
+        atacante->tropas -= tropasTransferidas;
+        
+        ajustarPoderVida(atacante, 1, semente, poderMin, poderMax, vidaGanhoMin, vidaGanhoMax,
+                         vidaPerdaMin, vidaPerdaMax, poderMaximo, vidaMaxima);
+        ajustarPoderVida(defensor, 0, semente, poderMin, poderMax, vidaGanhoMin, vidaGanhoMax,
+                         vidaPerdaMin, vidaPerdaMax, poderMaximo, vidaMaxima);
+    } else {
+        // Derrota ou empate: o atacante perde uma tropa e a vida da variante
+        int derrota = (resultado < 0);
+        defensor->vitorias += derrota;
+        atacante->derrotas += derrota;
+        atacante->tropas--;
+        atacante->vida -= derrota ? vidaDerrota : vidaEmpate;
+        if (derrota) ajustarPoderVida(defensor, 1, semente, poderMin, poderMax, vidaGanhoMin, vidaGanhoMax,
+                                      vidaPerdaMin, vidaPerdaMax, poderMaximo, vidaMaxima);
+    }
+    
+    // Verifica se algum pais foi eliminado
+    atacante->ativo &= (atacante->tropas > 0) & (atacante->vida > 0);
+    defensor->ativo &= (defensor->tropas > 0) & (defensor->vida > 0);
+    
+    return resultado;
+}
+
+/*
+ * Funcao generica do lote de batalhas (ver LoteBatalhas), com as regras como
+ * parametros pelo mesmo motivo de resolverComRegras. O estado fica em trabalho
+ * entre as batalhas, entao as penalidades se acumulam: um atacante que perde
+ * seguidas vezes acaba sem vida (eliminacao), e isso muda as batalhas seguintes.
+ * O ataque segue as regras das sessoes: lados ativos, cores diferentes e o
+ * atacante com pelo menos 2 tropas.
+ */
+static inline void loteComRegras(const Pais* paises, Pais* trabalho, int numPaises, const int* fronteiras,
+                                 int numFronteiras, long batalhas, unsigned int* semente, ResultadoLote* resultado,
+                                 const int faces, const int divAtaque, const int divDefesa,
+                                 const int vidaDerrota, const int vidaEmpate,
+                                 const int poderMin, const int poderMax,
+                                 const int vidaGanhoMin, const int vidaGanhoMax,
+                                 const int vidaPerdaMin, const int vidaPerdaMax,
+                                 const int poderMaximo, const int vidaMaxima) {
+    unsigned int s = *semente;
+    int dadoA, dadoD;
+    int pulados = 0;
+    memset(resultado, 0, sizeof(*resultado));
+    memcpy(trabalho, paises, (size_t)numPaises * sizeof(Pais));
+    resultado->partidas = 1;
+    
+    for (long b = 0; b < batalhas; b++) {
+        int k = sortear(&s, numFronteiras);
+        int lado = sortear(&s, 2);
+        Pais* atacante = &trabalho[fronteiras[2 * k + lado]];
+        Pais* defensor = &trabalho[fronteiras[2 * k + 1 - lado]];
+        if (!atacante->ativo || !defensor->ativo || atacante->tropas <= 1 ||
+            strcmp(atacante->cor, defensor->cor) == 0) {
+            // Mapa provavelmente esgotado: recomeca do original
+            if (++pulados == numFronteiras) {
+                memcpy(trabalho, paises, (size_t)numPaises * sizeof(Pais));
+                resultado->partidas++;
+                pulados = 0;
+            }
+            continue;
+        }
+        pulados = 0;
+        resultado->batalhas++;
+        resultado->conquistas += resolverComRegras(atacante, defensor, &s, &dadoA, &dadoD, faces, divAtaque,
+                                                   divDefesa, vidaDerrota, vidaEmpate, poderMin, poderMax,
+                                                   vidaGanhoMin, vidaGanhoMax, vidaPerdaMin, vidaPerdaMax,
+                                                   poderMaximo, vidaMaxima) > 0;
+        resultado->eliminacoes += !atacante->ativo + !defensor->ativo;
+    }
+    *semente = s;
+}
+
+// Gera, para cada variante, o kernel de uma batalha e o lote de batalhas com
+// as regras fixas (nenhuma regra eh lida por batalha)
+#define DEFINIR_VARIANTE(nome, faces, divAtaque, divDefesa, vidaDerrota, vidaEmpate, poderMin, poderMax, \
+                         vidaGanhoMin, vidaGanhoMax, vidaPerdaMin, vidaPerdaMax, poderMaximo, vidaMaxima) \
+    int batalha##nome(Pais* atacante, Pais* defensor, unsigned int* semente, int* dadoAtacante, int* dadoDefensor) { \
+        return resolverComRegras(atacante, defensor, semente, dadoAtacante, dadoDefensor, \
+                                 faces, divAtaque, divDefesa, vidaDerrota, vidaEmpate, poderMin, poderMax, \
+                                 vidaGanhoMin, vidaGanhoMax, vidaPerdaMin, vidaPerdaMax, poderMaximo, vidaMaxima); \
+    } \
+    void lote##nome(const Pais* paises, Pais* trabalho, int numPaises, const int* fronteiras, int numFronteiras, \
+                    long batalhas, unsigned int* semente, ResultadoLote* resultado) { \
+        loteComRegras(paises, trabalho, numPaises, fronteiras, numFronteiras, batalhas, semente, resultado, \
+                      faces, divAtaque, divDefesa, vidaDerrota, vidaEmpate, poderMin, poderMax, \
+                      vidaGanhoMin, vidaGanhoMax, vidaPerdaMin, vidaPerdaMax, poderMaximo, vidaMaxima); \
+    }
+VARIANTES_REGRAS(DEFINIR_VARIANTE)
+
+/*
+ * Funcao que busca uma variante pelo nome. Retorna o indice ou -1.
+ */
+int buscarVariante(const char* nome) {
+    for (int v = 0; v < NUM_VARIANTES; v++) {
+        if (strcmp(VARIANTES[v].nome, nome) == 0) return v;
+    }
+    return -1;
+}
+
+/*
+ * Funcao de referencia: o mesmo lote lendo as regras da tabela a cada batalha
+ * (como seria sem a especializacao). Serve para medir o ganho e para conferir
+ * que cada kernel produz os mesmos resultados.
+ */
+void loteInterpretado(const VarianteRegras* regras, const Pais* paises, Pais* trabalho, int numPaises,
+                      const int* fronteiras, int numFronteiras, long batalhas, unsigned int* semente,
+                      ResultadoLote* resultado) {
+    loteComRegras(paises, trabalho, numPaises, fronteiras, numFronteiras, batalhas, semente, resultado,
+                  regras->faces, regras->divAtaque, regras->divDefesa, regras->vidaDerrota, regras->vidaEmpate,
+                  regras->poderMin, regras->poderMax, regras->vidaGanhoMin, regras->vidaGanhoMax,
+                  regras->vidaPerdaMin, regras->vidaPerdaMax, regras->poderMaximo, regras->vidaMaxima);
+}
+
+// Ordem crescente de inteiros (qsort)
+static int compararInteiros(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Funcao que executa BATALHAS_ESTRESSE batalhas nas fronteiras com cada
+ * variante escolhida ("todas" = lado a lado), especializada e interpretada,
+ * com a mesma semente. Os lotes trabalham so sobre os territorios de
+ * fronteira (copiados para um vetor compacto), nao sobre o mapa inteiro.
+ */
+void compararVariantes(const Pais* paises, const int* fronteiras, int numFronteiras,
+                       const char* regras, unsigned int semente) {
+    int todas = (strcmp(regras, "todas") == 0);
+    
+    // Territorios distintos das fronteiras, em ordem, e as arestas renumeradas
+    int* territorios = (int*)malloc((size_t)numFronteiras * 2 * sizeof(int));
+    int* arestas = (int*)malloc((size_t)numFronteiras * 2 * sizeof(int));
+    Pais* base = NULL;
+    Pais* trabalho = NULL;
+    int numTerritorios = 0;
+    if (territorios != NULL && arestas != NULL) {
+        memcpy(territorios, fronteiras, (size_t)numFronteiras * 2 * sizeof(int));
+        qsort(territorios, (size_t)numFronteiras * 2, sizeof(int), compararInteiros);
+        for (int i = 0; i < numFronteiras * 2; i++) {
+            if (i == 0 || territorios[i] != territorios[i - 1]) territorios[numTerritorios++] = territorios[i];
+        }
+        base = (Pais*)malloc((size_t)numTerritorios * sizeof(Pais));
+        trabalho = (Pais*)malloc((size_t)numTerritorios * sizeof(Pais));
+    }
+    if (base == NULL || trabalho == NULL) {
+        printf("Erro: Memoria insuficiente para o estresse das fronteiras!\n");
+        free(territorios);
+        free(arestas);
+        free(base);
+        free(trabalho);
+        return;
+    }
+    for (int t = 0; t < numTerritorios; t++) base[t] = paises[territorios[t]];
+    for (int i = 0; i < numFronteiras * 2; i++) {
+        int* p = (int*)bsearch(&fronteiras[i], territorios, (size_t)numTerritorios, sizeof(int), compararInteiros);
+        arestas[i] = (int)(p - territorios);
+    }
+    
+    printf("\n%-10s %5s %6s %8s %16s %8s | %10s %10s %11s %14s %14s\n",
+           "Regras", "Faces", "Bonus", "Vida -/=", "+Poder +Vida -Vida", "Max",
+           "Batalhas", "Conquistas", "Eliminacoes", "Kernel/s", "Interpretado/s");
+    for (int v = 0; v < NUM_VARIANTES; v++) {
+        const VarianteRegras* r = &VARIANTES[v];
+        if (!todas && strcmp(r->nome, regras) != 0) continue;
+        
+        ResultadoLote kernel, referencia;
+        unsigned int s = semente;
+        double inicio = agoraSegundos();
+        r->lote(base, trabalho, numTerritorios, arestas, numFronteiras, BATALHAS_ESTRESSE, &s, &kernel);
+        double segKernel = agoraSegundos() - inicio;
+        
+        s = semente;
+        inicio = agoraSegundos();
+        loteInterpretado(r, base, trabalho, numTerritorios, arestas, numFronteiras, BATALHAS_ESTRESSE, &s, &referencia);
+        double segInterpretado = agoraSegundos() - inicio;
+        
+        printf("%-10s %5d %3d/%-2d %4d/%-3d %2d-%d %2d-%-2d %2d-%-2d %3d/%-4d | %10ld %10ld %11ld %14.0f %14.0f%s\n",
+               r->nome, r->faces, r->divAtaque, r->divDefesa, r->vidaDerrota, r->vidaEmpate,
+               r->poderMin, r->poderMax, r->vidaGanhoMin, r->vidaGanhoMax, r->vidaPerdaMin, r->vidaPerdaMax,
+               r->poderMaximo, r->vidaMaxima, kernel.batalhas, kernel.conquistas, kernel.eliminacoes,
+               segKernel > 0 ? BATALHAS_ESTRESSE / segKernel : 0,
+               segInterpretado > 0 ? BATALHAS_ESTRESSE / segInterpretado : 0,
+               memcmp(&kernel, &referencia, sizeof(kernel)) == 0 ? "" : "  DIVERGENTE");
+    }
+    free(territorios);
+    free(arestas);
+    free(base);
+    free(trabalho);
+}
+
 /*
  * Funcao para simular um dado de 6 faces
  */
 int simularDado() {
-    return (rand() % 6) + 1;
+    return sortear(NULL, 6) + 1;
+}
+
+/*
+ * Funcao que sorteia um inteiro entre 0 e faixa-1.
+ * Sem semente usa rand(); com semente usa xorshift32, que eh independente
+ * por thread (cada simulacao carrega a sua semente).
+ */
+int sortear(unsigned int* semente, int faixa) {
+    if (semente == NULL) {
+        return rand() % faixa;
+    }
+    unsigned int x = *semente;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *semente = x;
+    return (int)(x % (unsigned int)faixa);
+}
+
+/*
+ * Funcao que cria um estado bifurcavel a partir do vetor de paises
+ * (copia os paises uma vez, em paginas de PAGINA_PAISES)
+ */
+EstadoJogo* criarEstado(const Pais* paises, int numPaises) {
+    EstadoJogo* estado = (EstadoJogo*)calloc(1, sizeof(EstadoJogo));
+    if (estado == NULL) return NULL;
+    
+    estado->numPaises = numPaises;
+    estado->numPaginas = (numPaises + PAGINA_PAISES - 1) / PAGINA_PAISES;
+    estado->paginas = (PaginaPaises**)calloc(estado->numPaginas > 0 ? estado->numPaginas : 1, sizeof(PaginaPaises*));
+    if (estado->paginas == NULL) {
+        free(estado);
+        return NULL;
+    }
+    
+    for (int p = 0; p < estado->numPaginas; p++) {
+        estado->paginas[p] = (PaginaPaises*)malloc(sizeof(PaginaPaises));
+        if (estado->paginas[p] == NULL) {
+            estado->numPaginas = p;
+            liberarEstado(estado);
+            return NULL;
+        }
+        int inicio = p * PAGINA_PAISES;
+        int quantos = numPaises - inicio < PAGINA_PAISES ? numPaises - inicio : PAGINA_PAISES;
+        estado->paginas[p]->referencias = 1;
+        memcpy(estado->paginas[p]->paises, &paises[inicio], quantos * sizeof(Pais));
+    }
+    return estado;
+}
+
+/*
+ * Funcao que bifurca um estado: a copia compartilha todas as paginas com a
+ * base. Custa um vetor de ponteiros, nao os paises. Pode ser chamada por
+ * varias threads sobre a mesma base (contagem de referencias atomica).
+ */
+EstadoJogo* bifurcarEstado(const EstadoJogo* base) {
+    EstadoJogo* estado = (EstadoJogo*)malloc(sizeof(EstadoJogo));
+    if (estado == NULL) return NULL;
+    
+    estado->paginas = (PaginaPaises**)malloc((base->numPaginas > 0 ? base->numPaginas : 1) * sizeof(PaginaPaises*));
+    if (estado->paginas == NULL) {
+        free(estado);
+        return NULL;
+    }
+    memcpy(estado->paginas, base->paginas, base->numPaginas * sizeof(PaginaPaises*));
+    estado->numPaginas = base->numPaginas;
+    estado->numPaises = base->numPaises;
+    estado->paginasCopiadas = 0;
+    
+    for (int p = 0; p < estado->numPaginas; p++) {
+        __atomic_add_fetch(&estado->paginas[p]->referencias, 1, __ATOMIC_RELAXED);
+    }
+    return estado;
+}
+
+/*
+ * Funcao para ler um pais de um estado (nunca copia)
+ */
+const Pais* lerPaisEstado(const EstadoJogo* estado, int indice) {
+    return &estado->paginas[indice / PAGINA_PAISES]->paises[indice % PAGINA_PAISES];
+}
+
+/*
+ * Funcao que devolve um pais pronto para alteracao. Se a pagina dele ainda
+ * eh compartilhada com outro estado, ela eh duplicada antes (copy-on-write).
+ * Retorna NULL se faltar memoria para a copia.
+ */
+Pais* alterarPaisEstado(EstadoJogo* estado, int indice) {
+    PaginaPaises* pagina = estado->paginas[indice / PAGINA_PAISES];
+    
+    // Pagina exclusiva: ninguem mais pode passar a compartilha-la sem bifurcar este estado
+    if (__atomic_load_n(&pagina->referencias, __ATOMIC_ACQUIRE) > 1) {
+        PaginaPaises* copia = (PaginaPaises*)malloc(sizeof(PaginaPaises));
+        if (copia == NULL) return NULL;
+        memcpy(copia->paises, pagina->paises, sizeof(pagina->paises));
+        copia->referencias = 1;
+        if (__atomic_sub_fetch(&pagina->referencias, 1, __ATOMIC_ACQ_REL) == 0) {
+            free(pagina); // Os outros estados liberaram enquanto copiavamos
+        }
+        estado->paginas[indice / PAGINA_PAISES] = copia;
+        estado->paginasCopiadas++;
+        pagina = copia;
+    }
+    return &pagina->paises[indice % PAGINA_PAISES];
+}
+
+/*
+ * Funcao para descartar um estado (paginas compartilhadas so saem com a ultima referencia)
+ */
+void liberarEstado(EstadoJogo* estado) {
+    if (estado == NULL) return;
+    for (int p = 0; p < estado->numPaginas; p++) {
+        if (__atomic_sub_fetch(&estado->paginas[p]->referencias, 1, __ATOMIC_ACQ_REL) == 0) {
+            free(estado->paginas[p]);
+        }
+    }
+    free(estado->paginas);
+    free(estado);
+}
+
+/*
+ * Funcao que simula um futuro a partir do estado: o ataque avaliado e depois
+ * PROFUNDIDADE_ROLLOUT tentativas de ataque aleatorias entre paises ativos.
+ * Retorna o resultado da primeira batalha (1, -1 ou 0), ou -2 sem memoria.
+ */
+int simularRollout(EstadoJogo* estado, int atacante, int defensor, unsigned int* semente) {
+    int dadoA, dadoD;
+    Pais* a = alterarPaisEstado(estado, atacante);
+    Pais* d = alterarPaisEstado(estado, defensor);
+    if (a == NULL || d == NULL) return -2;
+    int resultado = resolverAtaque(a, d, semente, &dadoA, &dadoD);
+    
+    for (int k = 0; k < PROFUNDIDADE_ROLLOUT; k++) {
+        int i = sortear(semente, estado->numPaises);
+        int j = sortear(semente, estado->numPaises);
+        const Pais* pi = lerPaisEstado(estado, i);
+        const Pais* pj = lerPaisEstado(estado, j);
+        if (i == j || !pi->ativo || !pj->ativo || pi->tropas <= 1 || !validarAtaque(pi, pj)) continue;
+        
+        a = alterarPaisEstado(estado, i);
+        d = alterarPaisEstado(estado, j);
+        if (a == NULL || d == NULL) return -2;
+        resolverAtaque(a, d, semente, &dadoA, &dadoD);
+    }
+    return resultado;
+}
+
+/*
+ * Funcao executada por cada thread: bifurca a base para cada rollout da sua
+ * faixa, simula, acumula o resultado e descarta a bifurcacao
+ */
+void* executarRollouts(void* arg) {
+    TarefaRollout* t = (TarefaRollout*)arg;
+    char corAtacante[15];
+    strcpy(corAtacante, lerPaisEstado(t->base, t->atacante)->cor);
+    
+    for (int r = t->inicio; r < t->fim; r++) {
+        // Semente depende so do ataque e do numero do rollout, nao da thread
+        unsigned int semente = 2463534242u ^ ((unsigned int)r * 2654435761u) ^ ((unsigned int)t->defensor * 40503u);
+        if (semente == 0) semente = 1;
+        
+        EstadoJogo* futuro = bifurcarEstado(t->base);
+        if (futuro == NULL) continue;
+        int resultado = simularRollout(futuro, t->atacante, t->defensor, &semente);
+        if (resultado != -2) {
+            t->concluidos++;
+            if (resultado > 0) t->vitoriasImediatas++;
+            if (!lerPaisEstado(futuro, t->atacante)->ativo) t->eliminacoes++;
+            for (int i = 0; i < futuro->numPaises; i++) {
+                const Pais* p = lerPaisEstado(futuro, i);
+                if (p->ativo && strcmp(p->cor, corAtacante) == 0) t->territorios++;
+            }
+            t->paginasCopiadas += futuro->paginasCopiadas;
+        }
+        liberarEstado(futuro);
+    }
+    return NULL;
+}
+
+/*
+ * Funcao que compara todos os ataques possiveis do pais atacante: para cada
+ * defensor valido simula 'rollouts' futuros em NUM_THREADS threads, todos
+ * bifurcados do mesmo estado base. Retorna quantos candidatos avaliou
+ * (preenchidos em resultados) ou -1 se faltar memoria ou thread.
+ */
+int avaliarAtaques(const Pais* paises, int numPaises, int atacante, int rollouts, ResultadoAtaque* resultados) {
+    EstadoJogo* base = criarEstado(paises, numPaises);
+    if (base == NULL) return -1;
+    
+    int candidatos = 0;
+    for (int defensor = 0; defensor < numPaises; defensor++) {
+        if (defensor == atacante || !paises[defensor].ativo || paises[atacante].tropas <= 1 ||
+            !validarAtaque(&paises[atacante], &paises[defensor])) {
+            continue;
+        }
+        
+        pthread_t threads[NUM_THREADS];
+        TarefaRollout tarefas[NUM_THREADS];
+        int criadas = 0;
+        for (; criadas < NUM_THREADS; criadas++) {
+            TarefaRollout* tarefa = &tarefas[criadas];
+            memset(tarefa, 0, sizeof(TarefaRollout));
+            tarefa->base = base;
+            tarefa->atacante = atacante;
+            tarefa->defensor = defensor;
+            tarefa->inicio = (int)((long)rollouts * criadas / NUM_THREADS);
+            tarefa->fim = (int)((long)rollouts * (criadas + 1) / NUM_THREADS);
+            if (pthread_create(&threads[criadas], NULL, executarRollouts, tarefa) != 0) break;
+        }
+        if (criadas < NUM_THREADS) {
+            // Espera as que ja rodam (elas leem a base) antes de desistir
+            for (int t = 0; t < criadas; t++) {
+                pthread_join(threads[t], NULL);
+            }
+            liberarEstado(base);
+            return -1;
+        }
+        
+        ResultadoAtaque* r = &resultados[candidatos++];
+        long territorios = 0, copias = 0;
+        memset(r, 0, sizeof(ResultadoAtaque));
+        r->defensor = defensor;
+        for (int t = 0; t < NUM_THREADS; t++) {
+            pthread_join(threads[t], NULL);
+            r->rollouts += tarefas[t].concluidos;
+            r->vitoriasImediatas += tarefas[t].vitoriasImediatas;
+            r->eliminacoes += tarefas[t].eliminacoes;
+            territorios += tarefas[t].territorios;
+            copias += tarefas[t].paginasCopiadas;
+        }
+        if (r->rollouts > 0) {
+            r->territoriosMedios = (double)territorios / r->rollouts;
+            r->paginasCopiadas = (double)copias / r->rollouts;
+        }
+    }
+    
+    liberarEstado(base);
+    return candidatos;
+}
+
+/*
+ * Funcao para exibir a comparacao dos ataques possiveis de um pais
+ */
+void exibirAnaliseAtaques(Pais* paises, int numPaises, int atacante) {
+    ResultadoAtaque* resultados = (ResultadoAtaque*)malloc(numPaises * sizeof(ResultadoAtaque));
+    if (resultados == NULL) {
+        printf("Erro: Falha na alocacao de memoria!\n");
+        return;
+    }
+    
+    clock_t inicio = clock();
+    int n = avaliarAtaques(paises, numPaises, atacante, ROLLOUTS_PADRAO, resultados);
+    double segundos = (double)(clock() - inicio) / CLOCKS_PER_SEC;
+    
+    // Ataques sem nenhum futuro concluido (todas as bifurcacoes falharam) saem da tabela
+    int semFuturos = 0;
+    if (n > 0) {
+        int k = 0;
+        for (int i = 0; i < n; i++) {
+            if (resultados[i].rollouts > 0) resultados[k++] = resultados[i];
+            else semFuturos++;
+        }
+        n = k;
+    }
+    
+    if (n < 0) {
+        printf("Erro: Falha na alocacao de memoria ou na criacao das threads!\n");
+    } else if (n == 0 && semFuturos > 0) {
+        printf("Erro: Nenhum futuro pode ser simulado (falta de memoria para bifurcar o estado)!\n");
+    } else if (n == 0) {
+        printf("%s nao tem ataques possiveis (precisa de 2+ tropas e alvos de outra cor).\n", paises[atacante].nome);
+    } else {
+        // Ordena pelo numero esperado de territorios ao fim (selecao simples)
+        for (int i = 0; i < n - 1; i++) {
+            for (int j = i + 1; j < n; j++) {
+                if (resultados[j].territoriosMedios > resultados[i].territoriosMedios) {
+                    ResultadoAtaque temp = resultados[i];
+                    resultados[i] = resultados[j];
+                    resultados[j] = temp;
+                }
+            }
+        }
+        
+        printf("\n%d futuros simulados por ataque, %d ataques aleatorios depois de cada um.\n",
+               ROLLOUTS_PADRAO, PROFUNDIDADE_ROLLOUT);
+        printf("%-15s %-10s %-12s %-12s %-12s\n", "DEFENSOR", "COR", "VENCE 1a", "ELIMINADO", "TERRITORIOS");
+        printf("---------------------------------------------------------------\n");
+        for (int i = 0; i < n; i++) {
+            ResultadoAtaque* r = &resultados[i];
+            printf("%-15s %-10s %10.1f%% %10.1f%% %12.2f\n", paises[r->defensor].nome, paises[r->defensor].cor,
+                   100.0 * r->vitoriasImediatas / r->rollouts, 100.0 * r->eliminacoes / r->rollouts,
+                   r->territoriosMedios);
+        }
+        if (semFuturos > 0) {
+            printf("(%d ataque(s) omitido(s): nenhum futuro simulado por falta de memoria)\n", semFuturos);
+        }
+        printf("\nMelhor ataque esperado: %s contra %s.\n", paises[atacante].nome, paises[resultados[0].defensor].nome);
+        printf("Paginas copiadas por futuro: %.2f de %d (tempo de CPU: %.2f s)\n",
+               resultados[0].paginasCopiadas, (numPaises + PAGINA_PAISES - 1) / PAGINA_PAISES, segundos);
+    }
+    
+    free(resultados);
+}
+
+/*
+ * Funcao de mistura (splitmix64): gera um valor pseudoaleatorio so a partir
+ * da semente e de uma chave, sem estado. Cada territorio sorteia os seus dados
+ * com a propria chave, entao o mapa nao depende da ordem nem do numero de threads.
+ */
+unsigned long long misturar(unsigned long long semente, unsigned long long chave) {
+    unsigned long long z = semente + (chave + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * Funcao que forma o nome de um territorio a partir de um codigo: cada silaba
+ * (consoante + vogal) representa 4 bits e o sufixo comeca por vogal, entao
+ * codigos diferentes dao nomes diferentes (ex.: "Tavimo", "Zelurara")
+ */
+void nomearTerritorio(char* nome, unsigned int codigo) {
+    static const char* silabas[16] = {
+        "ba", "ce", "di", "fo", "gu", "la", "me", "no",
+        "pa", "re", "si", "to", "vu", "xa", "ze", "mo"
+    };
+    static const char* sufixos[8] = { "ia", "or", "ana", "el", "ista", "ul", "ara", "on" };
+    int tam = 0;
+    unsigned int sufixo = (codigo * 0x9E3779B1u) >> 29;
+    
+    do {
+        memcpy(&nome[tam], silabas[codigo & 15], 2);
+        tam += 2;
+        codigo >>= 4;
+    } while (codigo != 0);
+    strcpy(&nome[tam], sufixos[sufixo]);
+    nome[0] = nome[0] - 'a' + 'A';
+}
+
+/*
+ * Funcao que lista os vizinhos de um territorio em ordem crescente: os 4 da
+ * grade e as diagonais sorteadas. O sorteio de uma diagonal usa o par
+ * (menor, maior), entao os dois lados concordam e a adjacencia eh simetrica.
+ * Retorna quantos vizinhos escreveu em saida (ate MAX_VIZINHOS).
+ */
+int vizinhosDoTerritorio(const Mapa* mapa, int indice, int* saida) {
+    int largura = mapa->largura;
+    int x = indice % largura, y = indice / largura;
+    int n = 0;
+    
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            int nx = x + dx, ny = y + dy;
+            if ((dx == 0 && dy == 0) || nx < 0 || nx >= largura || ny < 0) continue;
+            long long vizinho = (long long)ny * largura + nx;
+            if (vizinho >= mapa->numPaises) continue;
+            
+            if (dx != 0 && dy != 0) { // Diagonal: existe em 1 de cada 4 pares
+                unsigned long long menor = indice < vizinho ? indice : vizinho;
+                unsigned long long maior = indice < vizinho ? vizinho : indice;
+                if ((misturar(mapa->semente ^ 0xD1A6ULL, (menor << 32) | maior) & 3) != 0) continue;
+            }
+            saida[n++] = (int)vizinho;
+        }
+    }
+    return n;
+}
+
+/*
+ * Funcao executada por cada thread da geracao, sobre a faixa [inicio, fim)
+ */
+void* executarGeracao(void* arg) {
+    TarefaGeracao* t = (TarefaGeracao*)arg;
+    Mapa* mapa = t->mapa;
+    int vizinhos[MAX_VIZINHOS];
+    
+    // Mascara do nome: embaralha os codigos sem repetir (XOR dentro dos mesmos bits)
+    unsigned int bits = 1;
+    while (bits < 31 && (1u << bits) < (unsigned int)mapa->numPaises) bits++;
+    unsigned int mascara = (unsigned int)misturar(mapa->semente, 0x4E4F4D45ULL) & ((1u << bits) - 1);
+    
+    // Exercitos em faixas continuas da grade; a permutacao afim varia com a semente
+    long long e = mapa->numExercitos;
+    long long mult = 1 + (long long)(misturar(mapa->semente, 0x434F52ULL) % (unsigned long long)e);
+    while (e > 1) { // mult precisa ser primo com e para nao repetir exercitos
+        long long a = mult, b = e;
+        while (b != 0) { long long r = a % b; a = b; b = r; }
+        if (a == 1) break;
+        mult++;
+    }
+    long long deslocamento = (long long)(misturar(mapa->semente, 0x4445534CULL) % (unsigned long long)e);
+    
+    for (int i = t->inicio; i < t->fim; i++) {
+        if (t->etapa == 1) {
+            mapa->inicioVizinhos[i + 1] = vizinhosDoTerritorio(mapa, i, vizinhos);
+            continue;
+        }
+        
+        int n = vizinhosDoTerritorio(mapa, i, vizinhos);
+        memcpy(&mapa->vizinhos[mapa->inicioVizinhos[i]], vizinhos, n * sizeof(int));
+        
+        Pais* pais = &mapa->paises[i];
+        unsigned long long h = misturar(mapa->semente, (unsigned long long)i);
+        int exercito = (int)((mult * ((long long)i * e / mapa->numPaises) + deslocamento) % e);
+        
+        nomearTerritorio(pais->nome, (unsigned int)i ^ mascara);
+        if (e <= NUM_CORES_DISPONIVEIS) {
+            strcpy(pais->cor, CORES_DISPONIVEIS[exercito]);
+        } else {
+            snprintf(pais->cor, sizeof(pais->cor), "Cor %d", (exercito + 1) % 1000000000); // ate 9 digitos
+        }
+        pais->tropas = MIN_TROPAS + (int)(h % (MAX_TROPAS - MIN_TROPAS + 1));
+        pais->poder = 3 + (int)((h >> 16) % 5);   // Mesmas faixas de inicializarPais
+        pais->vida = 70 + (int)((h >> 32) % 30);
+        pais->vitorias = 0;
+        pais->derrotas = 0;
+        pais->numAliados = 0;
+        pais->ativo = 1;
+        for (int k = 0; k < MAX_ALIADOS; k++) {
+            pais->aliados[k] = -1;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Funcao que gera um mapa completo a partir da semente, em numThreads threads:
+ * 1) cada thread conta os vizinhos da sua faixa; 2) soma de prefixos;
+ * 3) cada thread preenche paises e vizinhos da sua faixa.
+ * O resultado eh o mesmo para qualquer numero de threads. Retorna NULL sem
+ * memoria ou se alguma thread nao puder ser criada.
+ */
+Mapa* gerarMapa(int numPaises, int numExercitos, unsigned long long semente, int numThreads) {
+    Mapa* mapa = (Mapa*)calloc(1, sizeof(Mapa));
+    if (mapa == NULL) return NULL;
+    
+    mapa->numPaises = numPaises;
+    mapa->numExercitos = numExercitos;
+    mapa->semente = semente;
+    mapa->largura = 1;
+    while ((long long)mapa->largura * mapa->largura < numPaises) mapa->largura++;
+    mapa->paises = (Pais*)malloc((size_t)numPaises * sizeof(Pais));
+    mapa->inicioVizinhos = (int*)calloc((size_t)numPaises + 1, sizeof(int));
+    if (mapa->paises == NULL || mapa->inicioVizinhos == NULL) {
+        liberarMapa(mapa);
+        return NULL;
+    }
+    
+    pthread_t threads[numThreads];
+    TarefaGeracao tarefas[numThreads];
+    for (int etapa = 1; etapa <= 2; etapa++) {
+        if (etapa == 2) {
+            // Soma de prefixos: grau de cada territorio -> inicio da sua lista
+            for (int i = 0; i < numPaises; i++) {
+                mapa->inicioVizinhos[i + 1] += mapa->inicioVizinhos[i];
+            }
+            mapa->vizinhos = (int*)malloc(((size_t)mapa->inicioVizinhos[numPaises] + 1) * sizeof(int));
+            if (mapa->vizinhos == NULL) {
+                liberarMapa(mapa);
+                return NULL;
+            }
+        }
+        int criadas = 0;
+        for (; criadas < numThreads; criadas++) {
+            TarefaGeracao* tarefa = &tarefas[criadas];
+            tarefa->mapa = mapa;
+            tarefa->etapa = etapa;
+            tarefa->inicio = (int)((long long)numPaises * criadas / numThreads);
+            tarefa->fim = (int)((long long)numPaises * (criadas + 1) / numThreads);
+            if (pthread_create(&threads[criadas], NULL, executarGeracao, tarefa) != 0) break;
+        }
+        for (int t = 0; t < criadas; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        if (criadas < numThreads) {
+            liberarMapa(mapa);
+            return NULL;
+        }
+    }
+    return mapa;
+}
+
+/*
+ * Funcao que confere um mapa gerado: adjacencia simetrica, sem lacos, todo
+ * territorio com vizinho e todo exercito com pelo menos um territorio.
+ * Retorna o numero de problemas encontrados (0 = mapa valido).
+ */
+int verificarMapa(const Mapa* mapa) {
+    int problemas = 0;
+    int* territoriosPorExercito = (int*)calloc(mapa->numExercitos, sizeof(int));
+    if (territoriosPorExercito == NULL) return -1;
+    
+    for (int i = 0; i < mapa->numPaises; i++) {
+        int inicio = mapa->inicioVizinhos[i], fim = mapa->inicioVizinhos[i + 1];
+        if (fim == inicio && mapa->numPaises > 1) problemas++;
+        
+        for (int k = inicio; k < fim; k++) {
+            int j = mapa->vizinhos[k];
+            if (j == i || (k > inicio && mapa->vizinhos[k - 1] >= j)) problemas++;
+            
+            // Busca i na lista de j (listas em ordem crescente)
+            int a = mapa->inicioVizinhos[j], b = mapa->inicioVizinhos[j + 1];
+            while (a < b) {
+                int meio = (a + b) / 2;
+                if (mapa->vizinhos[meio] < i) a = meio + 1;
+                else b = meio;
+            }
+            if (a == mapa->inicioVizinhos[j + 1] || mapa->vizinhos[a] != i) problemas++;
+        }
+        
+        const char* cor = mapa->paises[i].cor;
+        int exercito = -1;
+        if (mapa->numExercitos <= NUM_CORES_DISPONIVEIS) {
+            for (int c = 0; c < mapa->numExercitos; c++) {
+                if (strcmp(cor, CORES_DISPONIVEIS[c]) == 0) exercito = c;
+            }
+        } else if (sscanf(cor, "Cor %d", &exercito) == 1) {
+            exercito--;
+        }
+        if (exercito < 0 || exercito >= mapa->numExercitos) problemas++;
+        else territoriosPorExercito[exercito]++;
+    }
+    for (int c = 0; c < mapa->numExercitos; c++) {
+        if (territoriosPorExercito[c] == 0) problemas++;
+    }
+    
+    free(territoriosPorExercito);
+    return problemas;
+}
+
+/*
+ * Funcao para liberar um mapa gerado
+ */
+void liberarMapa(Mapa* mapa) {
+    if (mapa == NULL) return;
+    free(mapa->paises);
+    free(mapa->inicioVizinhos);
+    free(mapa->vizinhos);
+    free(mapa);
+}
+
+/*
+ * Funcao que retorna o tempo de relogio monotonico em segundos (para medir
+ * threads e latencias, onde clock() somaria o tempo de CPU de todas)
+ */
+double agoraSegundos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Funcao do modo gerador (--gerar): gera o mapa, confere, mede a geracao e
+ * estressa o motor de batalha e as bifurcacoes no tamanho gerado
+ */
+int executarGerador(int numPaises, int numExercitos, unsigned long long semente, int numThreads, const char* regras) {
+    printf("=== GERADOR DE MAPAS ===\n");
+    printf("Territorios: %d | Exercitos: %d | Semente: %llu | Threads: %d\n",
+           numPaises, numExercitos, semente, numThreads);
+    
+    double inicio = agoraSegundos();
+    Mapa* mapa = gerarMapa(numPaises, numExercitos, semente, numThreads);
+    double segGeracao = agoraSegundos() - inicio;
+    if (mapa == NULL) {
+        printf("Erro: Falha na alocacao de memoria ou na criacao das threads!\n");
+        return 1;
+    }
+    
+    int problemas = verificarMapa(mapa);
+    printf("Mapa gerado em %.3f s (%.0f territorios/s), %d arestas, grade %d de largura\n",
+           segGeracao, segGeracao > 0 ? numPaises / segGeracao : 0,
+           mapa->inicioVizinhos[numPaises] / 2, mapa->largura);
+    printf("Verificacao: %s (%d problema(s))\n", problemas == 0 ? "OK" : "FALHOU", problemas);
+    
+    printf("\nAmostra:\n");
+    for (int k = 0; k < 5 && k < numPaises; k++) {
+        int i = (int)((long long)numPaises * k / 5);
+        printf("  ");
+        exibirPais(&mapa->paises[i], i);
+        printf("     vizinhos:");
+        for (int v = mapa->inicioVizinhos[i]; v < mapa->inicioVizinhos[i + 1]; v++) {
+            printf(" %d", mapa->vizinhos[v] + 1);
+        }
+        printf("\n");
+    }
+    
+    // Estresse do motor: batalhas seguidas nas fronteiras entre exercitos, sobre
+    // uma copia do mapa que acumula conquistas e eliminacoes (recomeca quando
+    // nao ha mais ataque possivel), com as variantes de regras pedidas
+    unsigned int sementeBatalha = (unsigned int)misturar(semente, 0xBA7A1ULL) | 1u;
+    int numFronteiras = 0;
+    for (int i = 0; i < numPaises; i++) {
+        for (int v = mapa->inicioVizinhos[i]; v < mapa->inicioVizinhos[i + 1]; v++) {
+            int j = mapa->vizinhos[v];
+            if (i < j && strcmp(mapa->paises[i].cor, mapa->paises[j].cor) != 0) numFronteiras++;
+        }
+    }
+    int* fronteiras = (int*)malloc(((size_t)numFronteiras + 1) * 2 * sizeof(int));
+    if (fronteiras != NULL && numFronteiras > 0) {
+        int f = 0;
+        for (int i = 0; i < numPaises; i++) {
+            for (int v = mapa->inicioVizinhos[i]; v < mapa->inicioVizinhos[i + 1]; v++) {
+                int j = mapa->vizinhos[v];
+                if (i < j && strcmp(mapa->paises[i].cor, mapa->paises[j].cor) != 0) {
+                    fronteiras[2 * f] = i;
+                    fronteiras[2 * f + 1] = j;
+                    f++;
+                }
+            }
+        }
+        
+        printf("\nFronteiras: %d arestas entre exercitos\n", numFronteiras);
+        compararVariantes(mapa->paises, fronteiras, numFronteiras, regras, sementeBatalha);
+    }
+    free(fronteiras);
+    
+    // Bifurcacoes do mapa inteiro: copy-on-write contra copia completa
+    EstadoJogo* base = criarEstado(mapa->paises, numPaises);
+    if (base != NULL) {
+        int forks = 1000;
+        inicio = agoraSegundos();
+        for (int f = 0; f < forks; f++) {
+            EstadoJogo* futuro = bifurcarEstado(base);
+            if (futuro == NULL) break;
+            for (int k = 0; k < 10; k++) {
+                Pais* p = alterarPaisEstado(futuro, sortear(&sementeBatalha, numPaises));
+                if (p != NULL) p->tropas++;
+            }
+            liberarEstado(futuro);
+        }
+        double segForks = agoraSegundos() - inicio;
+        inicio = agoraSegundos();
+        EstadoJogo* copia = criarEstado(mapa->paises, numPaises); // Sem copy-on-write: copia tudo
+        double segCopia = agoraSegundos() - inicio;
+        liberarEstado(copia);
+        printf("Bifurcacao com 10 alteracoes: %.1f us (copia completa: %.1f us)\n",
+               segForks / forks * 1e6, segCopia * 1e6);
+        liberarEstado(base);
+    }
+    
+    liberarMapa(mapa);
+    return problemas == 0 ? 0 : 1;
+}
+
+/*
+ * Funcao que monta uma partida nova na sessao: paises e cores distintos,
+ * tropas, poder e vida sorteados com a semente da sessao
+ */
+void iniciarSessao(Sessao* sessao, int numPaises, unsigned int semente) {
+    int nomes[NUM_PAISES_DISPONIVEIS], cores[NUM_CORES_DISPONIVEIS];
+    for (int i = 0; i < NUM_PAISES_DISPONIVEIS; i++) nomes[i] = i;
+    for (int i = 0; i < NUM_CORES_DISPONIVEIS; i++) cores[i] = i;
+    
+    sessao->semente = semente;
+    sessao->numPaises = numPaises;
+    for (int i = 0; i < numPaises; i++) {
+        // Embaralhamento parcial: o i-esimo pais e a i-esima cor sao sorteados entre os restantes
+        int n = i + sortear(&sessao->semente, NUM_PAISES_DISPONIVEIS - i);
+        int c = i + sortear(&sessao->semente, NUM_CORES_DISPONIVEIS - i);
+        int tmp = nomes[i]; nomes[i] = nomes[n]; nomes[n] = tmp;
+        tmp = cores[i]; cores[i] = cores[c]; cores[c] = tmp;
+        
+        Pais* pais = &sessao->paises[i];
+        memset(pais, 0, sizeof(Pais));
+        strcpy(pais->nome, PAISES_DISPONIVEIS[nomes[i]]);
+        strcpy(pais->cor, CORES_DISPONIVEIS[cores[i]]);
+        pais->tropas = MIN_TROPAS + sortear(&sessao->semente, MAX_TROPAS - MIN_TROPAS + 1);
+        pais->poder = sortear(&sessao->semente, 5) + 3;  // Mesmas faixas de inicializarPais
+        pais->vida = sortear(&sessao->semente, 30) + 70;
+        pais->ativo = 1;
+        for (int k = 0; k < MAX_ALIADOS; k++) {
+            pais->aliados[k] = -1;
+        }
+    }
+    sessao->estado = SESSAO_JOGANDO;
+}
+
+/*
+ * Funcao que escolhe a jogada da IA: entre os ataques validos, o de maior
+ * vantagem de bonus nos dados e de tropas. Retorna 0 se nao ha ataque possivel.
+ */
+int escolherJogadaIA(const Sessao* sessao, int* atacante, int* defensor) {
+    int melhor = 0, achou = 0;
+    
+    for (int a = 0; a < sessao->numPaises; a++) {
+        const Pais* pa = &sessao->paises[a];
+        if (!pa->ativo || pa->tropas <= 1) continue;
+        for (int d = 0; d < sessao->numPaises; d++) {
+            const Pais* pd = &sessao->paises[d];
+            if (d == a || !pd->ativo || !validarAtaque(pa, pd)) continue;
+            int pontos = 4 * (bonusPoder(pa->poder, sessao->regras->divAtaque) - bonusPoder(pd->poder, sessao->regras->divDefesa)) +
+                         pa->tropas - pd->tropas;
+            if (!achou || pontos > melhor) {
+                melhor = pontos;
+                *atacante = a;
+                *defensor = d;
+                achou = 1;
+            }
+        }
+    }
+    return achou;
+}
+
+/*
+ * Funcao que encerra a partida quando sobra um exercito ou quando nenhum
+ * ataque eh mais possivel. Retorna o indice de um pais do exercito vencedor,
+ * -1 se a partida continua e -2 se terminou sem vencedor.
+ */
+int verificarFimSessao(Sessao* sessao) {
+    int vencedor = -1;
+    for (int i = 0; i < sessao->numPaises; i++) {
+        if (!sessao->paises[i].ativo) continue;
+        if (vencedor >= 0 && strcmp(sessao->paises[i].cor, sessao->paises[vencedor].cor) != 0) {
+            int a, d;
+            if (escolherJogadaIA(sessao, &a, &d)) return -1;
+            sessao->estado = SESSAO_ENCERRADA;
+            return -2;
+        }
+        if (vencedor < 0) vencedor = i;
+    }
+    sessao->estado = SESSAO_ENCERRADA;
+    return vencedor >= 0 ? vencedor : -2;
+}
+
+/*
+ * Funcao que executa um evento na sua sessao e escreve a resposta.
+ * Comandos (paises numerados a partir de 1):
+ *   NOVA <paises> [semente [regras]]  inicia uma partida (3 a MAX_PAISES
+ *                            paises); sem regras usa as do hospedeiro (--regras)
+ *   ATACAR <atacante> <defensor>
+ *   IA                       a IA escolhe e faz um ataque
+ *   ESTADO                   nome:cor:tropas:poder:vida:ativo de cada pais
+ *   FIM                      libera a sessao e informa as latencias dela
+ *   STATS                    estatisticas do hospedeiro (qualquer sessao, ou 0)
+ * Respostas: "<sessao> OK ..." ou "<sessao> ERR <motivo>"; um ataque que
+ * encerra a partida termina com "FIM <cor vencedora>" ou "FIM sem vencedor".
+ * Retorna 1 quando o evento foi uma jogada (conta na latencia da sessao).
+ */
+int processarEvento(Hospedeiro* h, Evento* ev, char* resposta, size_t tamanho) {
+    char comando[16] = "";
+    char nomeRegras[16] = "";
+    long arg1 = 0, arg2 = 0;
+    int campos = sscanf(ev->linha, "%*d %15s %ld %ld %15s", comando, &arg1, &arg2, nomeRegras);
+    Sessao* sessao = &h->sessoes[ev->sessao];
+    int atacante, defensor;
+    
+    if (ev->longa) {
+        snprintf(resposta, tamanho, "%d ERR linha longa demais\n", ev->sessao);
+        return 0;
+    }
+    if (campos < 1) {
+        snprintf(resposta, tamanho, "%d ERR comando vazio\n", ev->sessao);
+        return 0;
+    }
+    
+    if (strcmp(comando, "STATS") == 0) {
+        long eventos, latencias[FAIXAS_LATENCIA];
+        double maxima;
+        resumirLatencias(h, &eventos, latencias, &maxima);
+        snprintf(resposta, tamanho, "%d OK sessoes=%d eventos=%ld p50<=%.0fus p99<=%.0fus max=%.0fus\n",
+                 ev->sessao, __atomic_load_n(&h->sessoesAtivas, __ATOMIC_RELAXED), eventos,
+                 percentilLatencia(latencias, eventos, 0.50), percentilLatencia(latencias, eventos, 0.99),
+                 maxima * 1e6);
+        return 0;
+    }
+    if (ev->sessao == 0) {
+        snprintf(resposta, tamanho, "0 ERR sessao 0 so aceita STATS\n");
+        return 0;
+    }
+    
+    if (strcmp(comando, "NOVA") == 0) {
+        int variante = campos >= 4 ? buscarVariante(nomeRegras) : (int)(regrasJogo - VARIANTES);
+        if (campos < 2 || arg1 < MIN_PAISES || arg1 > MAX_PAISES) {
+            snprintf(resposta, tamanho, "%d ERR uso: NOVA <%d-%d> [semente [regras]]\n", ev->sessao, MIN_PAISES, MAX_PAISES);
+            return 0;
+        }
+        if (variante < 0) {
+            snprintf(resposta, tamanho, "%d ERR regras desconhecidas\n", ev->sessao);
+            return 0;
+        }
+        if (sessao->estado == SESSAO_LIVRE) __atomic_add_fetch(&h->sessoesAtivas, 1, __ATOMIC_RELAXED);
+        unsigned long long base = campos >= 3 ? (unsigned long long)arg2 : 0x5E55A0ULL;
+        iniciarSessao(sessao, (int)arg1, (unsigned int)misturar(base, (unsigned long long)ev->sessao) | 1u);
+        sessao->regras = &VARIANTES[variante];
+        sessao->jogadas = 0;
+        sessao->latenciaTotal = 0;
+        sessao->latenciaMaxima = 0;
+        snprintf(resposta, tamanho, "%d OK %d\n", ev->sessao, sessao->numPaises);
+        return 0;
+    }
+    
+    if (sessao->estado == SESSAO_LIVRE) {
+        snprintf(resposta, tamanho, "%d ERR sessao sem partida (use NOVA)\n", ev->sessao);
+        return 0;
+    }
+    
+    if (strcmp(comando, "ESTADO") == 0) {
+        int n = snprintf(resposta, tamanho, "%d OK %s %d ", ev->sessao,
+                         sessao->estado == SESSAO_JOGANDO ? "JOGANDO" : "ENCERRADA", sessao->numPaises);
+        for (int i = 0; i < sessao->numPaises && n < (int)tamanho; i++) {
+            const Pais* p = &sessao->paises[i];
+            n += snprintf(resposta + n, tamanho - n, "%s:%s:%d:%d:%d:%d%s", p->nome, p->cor, p->tropas,
+                          p->poder, p->vida, p->ativo, i + 1 < sessao->numPaises ? ";" : "\n");
+        }
+        return 0;
+    }
+    
+    if (strcmp(comando, "FIM") == 0) {
+        snprintf(resposta, tamanho, "%d OK jogadas=%ld media=%.0fus max=%.0fus\n", ev->sessao, sessao->jogadas,
+                 sessao->jogadas > 0 ? sessao->latenciaTotal / sessao->jogadas * 1e6 : 0, sessao->latenciaMaxima * 1e6);
+        sessao->estado = SESSAO_LIVRE;
+        __atomic_sub_fetch(&h->sessoesAtivas, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    
+    if (strcmp(comando, "ATACAR") == 0 || strcmp(comando, "IA") == 0) {
+        int ia = (comando[0] == 'I');
+        if (sessao->estado == SESSAO_ENCERRADA) {
+            snprintf(resposta, tamanho, "%d ERR partida encerrada\n", ev->sessao);
+            return 0;
+        }
+        if (ia) {
+            if (!escolherJogadaIA(sessao, &atacante, &defensor)) {
+                snprintf(resposta, tamanho, "%d ERR nenhum ataque possivel\n", ev->sessao);
+                return 0;
+            }
+        } else {
+            // Mesmas validacoes do menu
+            atacante = (int)arg1 - 1;
+            defensor = (int)arg2 - 1;
+            if (campos < 3 || atacante < 0 || atacante >= sessao->numPaises ||
+                defensor < 0 || defensor >= sessao->numPaises || atacante == defensor) {
+                snprintf(resposta, tamanho, "%d ERR uso: ATACAR <1-%d> <1-%d>\n", ev->sessao,
+                         sessao->numPaises, sessao->numPaises);
+                return 0;
+            }
+            Pais* pa = &sessao->paises[atacante];
+            Pais* pd = &sessao->paises[defensor];
+            const char* motivo = NULL;
+            if (!pa->ativo || !pd->ativo) motivo = "pais inativo";
+            else if (!validarAtaque(pa, pd)) motivo = "mesma cor ou aliado";
+            else if (pa->tropas <= 1) motivo = "atacante precisa de 2 tropas";
+            if (motivo != NULL) {
+                snprintf(resposta, tamanho, "%d ERR %s\n", ev->sessao, motivo);
+                return 0;
+            }
+        }
+        
+        int dadoA, dadoD;
+        int resultado = sessao->regras->batalha(&sessao->paises[atacante], &sessao->paises[defensor],
+                                                &sessao->semente, &dadoA, &dadoD);
+        int n = snprintf(resposta, tamanho, "%d OK ", ev->sessao);
+        if (ia) n += snprintf(resposta + n, tamanho - n, "IA %d %d ", atacante + 1, defensor + 1);
+        n += snprintf(resposta + n, tamanho - n, "%s %d %d",
+                      resultado > 0 ? "VITORIA" : resultado < 0 ? "DERROTA" : "EMPATE", dadoA, dadoD);
+        int vencedor = verificarFimSessao(sessao);
+        if (vencedor >= 0) n += snprintf(resposta + n, tamanho - n, " FIM %s", sessao->paises[vencedor].cor);
+        else if (vencedor == -2) n += snprintf(resposta + n, tamanho - n, " FIM sem vencedor");
+        snprintf(resposta + n, tamanho - n, "\n");
+        return 1;
+    }
+    
+    snprintf(resposta, tamanho, "%d ERR comando desconhecido: %s\n", ev->sessao, comando);
+    return 0;
+}
+
+/*
+ * Funcao executada por cada trabalhador: retira eventos da sua fila, executa,
+ * responde e registra a latencia (da chegada do evento ate a resposta)
+ */
+void* executarTrabalhador(void* arg) {
+    Trabalhador* t = (Trabalhador*)arg;
+    Hospedeiro* h = t->hospedeiro;
+    Evento ev;
+    char resposta[RESPOSTA_EVENTO];
+    
+    pthread_mutex_lock(&t->trava);
+    for (;;) {
+        while (t->quantidade == 0 && !t->encerrar) {
+            pthread_cond_wait(&t->temEvento, &t->trava);
+        }
+        if (t->quantidade == 0) break; // Encerrando e sem eventos pendentes
+        
+        ev = t->fila[t->inicio];
+        t->inicio = (t->inicio + 1) % FILA_EVENTOS;
+        t->quantidade--;
+        pthread_cond_signal(&t->temEspaco);
+        pthread_mutex_unlock(&t->trava);
+        
+        int jogada = processarEvento(h, &ev, resposta, sizeof(resposta));
+        responderEvento(h, ev.conexao, ev.geracao, resposta);
+        double latencia = agoraSegundos() - ev.chegada;
+        if (jogada) {
+            Sessao* sessao = &h->sessoes[ev.sessao];
+            sessao->jogadas++;
+            sessao->latenciaTotal += latencia;
+            if (latencia > sessao->latenciaMaxima) sessao->latenciaMaxima = latencia;
+        }
+        
+        int faixa = 0;
+        for (long us = (long)(latencia * 1e6); us > 1 && faixa < FAIXAS_LATENCIA - 1; us >>= 1) faixa++;
+        pthread_mutex_lock(&t->trava);
+        t->eventos++;
+        t->latencias[faixa]++;
+        if (latencia > t->latenciaMaxima) t->latenciaMaxima = latencia;
+    }
+    pthread_mutex_unlock(&t->trava);
+    return NULL;
+}
+
+/*
+ * Funcao que cria o hospedeiro: sessoes pre-alocadas (memoria fixa por
+ * sessao) e os trabalhadores ja rodando. Retorna NULL sem memoria ou se
+ * alguma thread nao pode ser criada (as ja criadas sao encerradas).
+ */
+Hospedeiro* criarHospedeiro(int numTrabalhadores, int maxSessoes, FILE* saida) {
+    Hospedeiro* h = (Hospedeiro*)calloc(1, sizeof(Hospedeiro));
+    if (h == NULL) return NULL;
+    h->sessoes = (Sessao*)calloc((size_t)maxSessoes + 1, sizeof(Sessao));
+    h->trabalhadores = (Trabalhador*)calloc(numTrabalhadores, sizeof(Trabalhador));
+    if (h->sessoes == NULL || h->trabalhadores == NULL) {
+        free(h->sessoes);
+        free(h->trabalhadores);
+        free(h);
+        return NULL;
+    }
+    h->maxSessoes = maxSessoes;
+    h->numTrabalhadores = numTrabalhadores;
+    h->saida = saida;
+    pthread_mutex_init(&h->travaSaida, NULL);
+    h->despertar[0] = h->despertar[1] = -1;
+    for (int c = 0; c < MAX_CONEXOES; c++) {
+        h->conexoes[c].fd = -1;
+    }
+    
+    for (int i = 0; i < numTrabalhadores; i++) {
+        Trabalhador* t = &h->trabalhadores[i];
+        t->hospedeiro = h;
+        pthread_mutex_init(&t->trava, NULL);
+        pthread_cond_init(&t->temEvento, NULL);
+        pthread_cond_init(&t->temEspaco, NULL);
+        if (pthread_create(&t->thread, NULL, executarTrabalhador, t) != 0) {
+            pthread_mutex_destroy(&t->trava);
+            pthread_cond_destroy(&t->temEvento);
+            pthread_cond_destroy(&t->temEspaco);
+            h->numTrabalhadores = i;
+            pararTrabalhadores(h);
+            liberarHospedeiro(h);
+            return NULL;
+        }
+    }
+    return h;
+}
+
+/*
+ * Funcao que espera os trabalhadores esvaziarem as filas e terminarem
+ */
+void pararTrabalhadores(Hospedeiro* h) {
+    for (int i = 0; i < h->numTrabalhadores; i++) {
+        Trabalhador* t = &h->trabalhadores[i];
+        pthread_mutex_lock(&t->trava);
+        t->encerrar = 1;
+        pthread_cond_signal(&t->temEvento);
+        pthread_mutex_unlock(&t->trava);
+    }
+    for (int i = 0; i < h->numTrabalhadores; i++) {
+        pthread_join(h->trabalhadores[i].thread, NULL);
+    }
+}
+
+/*
+ * Funcao para liberar o hospedeiro (depois de pararTrabalhadores)
+ */
+void liberarHospedeiro(Hospedeiro* h) {
+    for (int i = 0; i < h->numTrabalhadores; i++) {
+        Trabalhador* t = &h->trabalhadores[i];
+        pthread_mutex_destroy(&t->trava);
+        pthread_cond_destroy(&t->temEvento);
+        pthread_cond_destroy(&t->temEspaco);
+    }
+    for (int c = 0; c < MAX_CONEXOES; c++) {
+        if (h->conexoes[c].fd >= 0) close(h->conexoes[c].fd);
+    }
+    if (h->despertar[0] >= 0) {
+        close(h->despertar[0]);
+        close(h->despertar[1]);
+    }
+    pthread_mutex_destroy(&h->travaSaida);
+    free(h->trabalhadores);
+    free(h->sessoes);
+    free(h);
+}
+
+/*
+ * Funcao que entrega uma resposta para a origem do evento. No socket, a
+ * resposta vai para a saida do cliente e o laco de eventos envia (os
+ * trabalhadores nunca esperam um cliente). Se o cliente ja saiu, ou a posicao
+ * eh de outro cliente agora, a resposta eh descartada; se o cliente nao le e
+ * a saida enche, ele eh desconectado.
+ */
+void responderEvento(Hospedeiro* h, int conexao, unsigned int geracao, const char* texto) {
+    pthread_mutex_lock(&h->travaSaida);
+    if (conexao < 0) {
+        fputs(texto, h->saida);
+    } else {
+        Conexao* con = &h->conexoes[conexao];
+        size_t tam = strlen(texto);
+        if (con->fd >= 0 && con->geracao == geracao) con->eventosPendentes--;
+        if (con->fd >= 0 && con->geracao == geracao && !con->lenta) {
+            if (con->tamSaida + tam > SAIDA_CONEXAO) {
+                con->lenta = 1;
+            } else {
+                memcpy(con->saida + con->tamSaida, texto, tam);
+                con->tamSaida += tam;
+            }
+            if (con->tamSaida == tam || con->lenta) {
+                char sinal = 1; // Saida estava vazia: acorda o poll
+                if (write(h->despertar[1], &sinal, 1) < 0) { /* pipe cheio: o poll ja vai acordar */ }
+            }
+        }
+    }
+    pthread_mutex_unlock(&h->travaSaida);
+}
+
+/*
+ * Funcao que le o numero da sessao de uma linha e coloca o evento na fila do
+ * trabalhador dono da sessao. No modo arquivo espera se a fila estiver cheia;
+ * no socket responde "ERR ocupado" na hora, para o laco de eventos nunca
+ * parar os outros clientes atras de uma sessao sobrecarregada.
+ */
+void despacharEvento(Hospedeiro* h, const char* linha, int conexao, unsigned int geracao) {
+    char erro[RESPOSTA_EVENTO];
+    char* fim;
+    
+    while (*linha == ' ' || *linha == '\t') linha++;
+    if (*linha == '\0') return; // Linha em branco
+    if (conexao >= 0) {
+        // Toda linha do cliente recebe uma resposta: conta ate ela chegar
+        pthread_mutex_lock(&h->travaSaida);
+        h->conexoes[conexao].eventosPendentes++;
+        pthread_mutex_unlock(&h->travaSaida);
+    }
+    long sessao = strtol(linha, &fim, 10);
+    if (fim == linha || sessao < 0 || sessao > h->maxSessoes) {
+        snprintf(erro, sizeof(erro), "? ERR sessao invalida (0-%d)\n", h->maxSessoes);
+        responderEvento(h, conexao, geracao, erro);
+        return;
+    }
+    
+    Trabalhador* t = &h->trabalhadores[sessao % h->numTrabalhadores];
+    pthread_mutex_lock(&t->trava);
+    if (conexao >= 0 && t->quantidade == FILA_EVENTOS) {
+        pthread_mutex_unlock(&t->trava);
+        snprintf(erro, sizeof(erro), "%ld ERR ocupado\n", sessao);
+        responderEvento(h, conexao, geracao, erro);
+        return;
+    }
+    while (t->quantidade == FILA_EVENTOS) {
+        pthread_cond_wait(&t->temEspaco, &t->trava);
+    }
+    Evento* ev = &t->fila[(t->inicio + t->quantidade) % FILA_EVENTOS];
+    ev->sessao = (int)sessao;
+    ev->conexao = conexao;
+    ev->geracao = geracao;
+    ev->chegada = agoraSegundos();
+    ev->longa = (strlen(linha) >= LINHA_EVENTO);
+    if (ev->longa) ev->linha[0] = '\0';
+    else strcpy(ev->linha, linha);
+    t->quantidade++;
+    pthread_cond_signal(&t->temEvento);
+    pthread_mutex_unlock(&t->trava);
+}
+
+/*
+ * Funcao que retorna o limite superior (us) da faixa do histograma que
+ * contem a fracao pedida dos eventos
+ */
+double percentilLatencia(const long* latencias, long total, double fracao) {
+    long acumulado = 0;
+    for (int f = 0; f < FAIXAS_LATENCIA; f++) {
+        acumulado += latencias[f];
+        if (acumulado > 0 && acumulado >= fracao * total) return (double)(2L << f);
+    }
+    return 0;
+}
+
+/*
+ * Funcao que soma as estatisticas de latencia de todos os trabalhadores
+ */
+void resumirLatencias(Hospedeiro* h, long* eventos, long* latencias, double* maxima) {
+    *eventos = 0;
+    *maxima = 0;
+    memset(latencias, 0, FAIXAS_LATENCIA * sizeof(long));
+    for (int i = 0; i < h->numTrabalhadores; i++) {
+        Trabalhador* t = &h->trabalhadores[i];
+        pthread_mutex_lock(&t->trava);
+        *eventos += t->eventos;
+        for (int f = 0; f < FAIXAS_LATENCIA; f++) latencias[f] += t->latencias[f];
+        if (t->latenciaMaxima > *maxima) *maxima = t->latenciaMaxima;
+        pthread_mutex_unlock(&t->trava);
+    }
+}
+
+/*
+ * Funcao que exibe no stderr o resumo do hospedeiro (com os trabalhadores
+ * ja parados): vazao, sessoes e latencia por evento
+ */
+void exibirResumoHospedeiro(Hospedeiro* h, double segundos) {
+    long eventos, latencias[FAIXAS_LATENCIA];
+    double maxima;
+    resumirLatencias(h, &eventos, latencias, &maxima);
+    fflush(h->saida);
+    
+    fprintf(stderr, "Hospedeiro: %ld eventos em %.3f s (%.0f eventos/s), %d trabalhadores\n",
+            eventos, segundos, segundos > 0 ? eventos / segundos : 0, h->numTrabalhadores);
+    fprintf(stderr, "Sessoes: %d ativas ao fim, capacidade %d, %zu bytes por sessao\n",
+            h->sessoesAtivas, h->maxSessoes, sizeof(Sessao));
+    fprintf(stderr, "Latencia por evento: p50 <= %.0f us, p99 <= %.0f us, maxima %.0f us\n",
+            percentilLatencia(latencias, eventos, 0.50), percentilLatencia(latencias, eventos, 0.99), maxima * 1e6);
+}
+
+/*
+ * Funcao do modo arquivo (--sessoes): cada linha da entrada eh um evento;
+ * as respostas vao para a saida do hospedeiro e o resumo para stderr
+ */
+int hospedarArquivo(Hospedeiro* h, FILE* entrada) {
+    char linha[4 * LINHA_EVENTO];
+    double inicio = agoraSegundos();
+    
+    while (fgets(linha, sizeof(linha), entrada) != NULL) {
+        size_t tam = strlen(linha);
+        if (tam > 0 && linha[tam - 1] != '\n' && !feof(entrada)) {
+            // Linha maior que o buffer: descarta o resto
+            int ch;
+            while ((ch = fgetc(entrada)) != '\n' && ch != EOF);
+        }
+        linha[strcspn(linha, "\r\n")] = '\0';
+        despacharEvento(h, linha, -1, 0);
+    }
+    
+    // Espera as filas esvaziarem antes de medir
+    pararTrabalhadores(h);
+    exibirResumoHospedeiro(h, agoraSegundos() - inicio);
+    liberarHospedeiro(h);
+    return 0;
+}
+
+// Pedido de encerramento do modo socket (SIGINT/SIGTERM). O tratador so marca
+// e escreve no pipe do hospedeiro para acordar o poll.
+static volatile sig_atomic_t encerrarSocket = 0;
+static int despertarSinal = -1;
+
+/*
+ * Funcao que trata SIGINT/SIGTERM no modo socket
+ */
+void tratarSinalEncerrar(int sinal) {
+    (void)sinal;
+    int errnoSalvo = errno;
+    char byte = 1;
+    encerrarSocket = 1;
+    if (despertarSinal >= 0 && write(despertarSinal, &byte, 1) < 0) { /* pipe cheio: o poll ja vai acordar */ }
+    errno = errnoSalvo;
+}
+
+/*
+ * Funcao que cria o socket Unix de escuta e o pipe que acorda o laco de
+ * eventos. Retorna o descritor do socket ou -1.
+ */
+int abrirSocketSessoes(Hospedeiro* h, const char* caminho) {
+    struct sockaddr_un end;
+    if (strlen(caminho) >= sizeof(end.sun_path)) {
+        fprintf(stderr, "Caminho de socket longo demais.\n");
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    memset(&end, 0, sizeof(end));
+    end.sun_family = AF_UNIX;
+    strcpy(end.sun_path, caminho);
+    unlink(caminho);
+    if (bind(fd, (struct sockaddr*)&end, sizeof(end)) < 0 || listen(fd, 64) < 0) {
+        perror("bind/listen");
+        close(fd);
+        return -1;
+    }
+    if (pipe(h->despertar) < 0) {
+        perror("pipe");
+        h->despertar[0] = h->despertar[1] = -1;
+        close(fd);
+        unlink(caminho);
+        return -1;
+    }
+    fcntl(h->despertar[0], F_SETFL, O_NONBLOCK);
+    fcntl(h->despertar[1], F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+/*
+ * Funcao do modo socket (--sessoes-socket): laco de eventos com poll sobre
+ * o socket Unix e ate MAX_CONEXOES clientes. Cada linha completa vira um
+ * evento; a resposta volta ao cliente que enviou. SIGINT/SIGTERM encerram:
+ * as filas sao esvaziadas, os trabalhadores terminam, o hospedeiro eh
+ * liberado e o socket sai do disco.
+ */
+int hospedarSocket(Hospedeiro* h, const char* caminho) {
+    int fd = abrirSocketSessoes(h, caminho);
+    if (fd < 0) {
+        pararTrabalhadores(h);
+        liberarHospedeiro(h);
+        return 1;
+    }
+    
+    struct sigaction acao, anteriorInt, anteriorTerm;
+    memset(&acao, 0, sizeof(acao));
+    acao.sa_handler = tratarSinalEncerrar;
+    sigemptyset(&acao.sa_mask);
+    encerrarSocket = 0;
+    despertarSinal = h->despertar[1];
+    sigaction(SIGINT, &acao, &anteriorInt);
+    sigaction(SIGTERM, &acao, &anteriorTerm);
+    
+    fprintf(stderr, "Hospedeiro de sessoes ouvindo em %s (%d trabalhadores, %d sessoes)\n",
+            caminho, h->numTrabalhadores, h->maxSessoes);
+    
+    double inicio = agoraSegundos();
+    int status = 0;
+    struct pollfd fds[MAX_CONEXOES + 2];
+    int posicoes[MAX_CONEXOES + 2];
+    while (!encerrarSocket) {
+        int n = 0;
+        fds[n].fd = fd;
+        fds[n].events = POLLIN;
+        posicoes[n++] = -1;
+        fds[n].fd = h->despertar[0];
+        fds[n].events = POLLIN;
+        posicoes[n++] = -1;
+        pthread_mutex_lock(&h->travaSaida);
+        for (int c = 0; c < MAX_CONEXOES; c++) {
+            Conexao* con = &h->conexoes[c];
+            if (con->fd < 0) continue;
+            // Nao le as respostas, ou ja fechou a escrita e recebeu tudo: desconecta
+            if (con->lenta || (con->fimEntrada && con->eventosPendentes == 0 && con->tamSaida == 0)) {
+                close(con->fd);
+                con->fd = -1;
+                continue;
+            }
+            fds[n].fd = con->fd;
+            // Cliente com muitas linhas sem resposta ou saida acumulada deixa de ser
+            // lido ate os trabalhadores alcancarem (as respostas acordam o poll)
+            int ler = !con->fimEntrada && con->eventosPendentes < PENDENTES_CONEXAO && con->tamSaida < SAIDA_CONEXAO / 2;
+            fds[n].events = (ler ? POLLIN : 0) | (con->tamSaida > 0 ? POLLOUT : 0);
+            posicoes[n++] = c;
+        }
+        pthread_mutex_unlock(&h->travaSaida);
+        
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            status = 1;
+            break;
+        }
+        
+        if (fds[1].revents & POLLIN) {
+            char sinais[64];
+            while (read(h->despertar[0], sinais, sizeof(sinais)) > 0);
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            int cli = accept(fd, NULL, NULL);
+            int livre = -1;
+            for (int c = 0; c < MAX_CONEXOES && livre < 0; c++) {
+                if (h->conexoes[c].fd < 0) livre = c;
+            }
+            if (cli >= 0 && livre < 0) {
+                close(cli); // Sem posicao livre
+            } else if (cli >= 0) {
+                pthread_mutex_lock(&h->travaSaida);
+                Conexao* con = &h->conexoes[livre];
+                con->fd = cli;
+                con->geracao++;
+                con->lenta = 0;
+                con->descartando = 0;
+                con->fimEntrada = 0;
+                con->eventosPendentes = 0;
+                con->pendente = 0;
+                con->tamSaida = 0;
+                pthread_mutex_unlock(&h->travaSaida);
+            }
+        }
+        
+        for (int k = 2; k < n; k++) {
+            int c = posicoes[k];
+            Conexao* con = &h->conexoes[c];
+            int caiu = 0;
+            
+            if (fds[k].revents & POLLOUT) {
+                // Envia o que couber; o resto fica para o proximo POLLOUT
+                pthread_mutex_lock(&h->travaSaida);
+                ssize_t enviados = send(con->fd, con->saida, con->tamSaida, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (enviados > 0) {
+                    con->tamSaida -= (size_t)enviados;
+                    memmove(con->saida, con->saida + enviados, con->tamSaida);
+                } else if (enviados < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    caiu = 1;
+                }
+                pthread_mutex_unlock(&h->travaSaida);
+            }
+            if (con->fimEntrada && (fds[k].revents & (POLLHUP | POLLERR))) caiu = 1;
+            if (!caiu && (!(fds[k].events & POLLIN) || !(fds[k].revents & (POLLIN | POLLHUP | POLLERR)))) continue;
+            
+            ssize_t lidos = caiu ? -1 : read(con->fd, con->entrada + con->pendente, sizeof(con->entrada) - 1 - con->pendente);
+            if (lidos < 0 && errno == EINTR && !caiu) continue;
+            if (lidos == 0) {
+                // Fim da escrita do cliente: a ultima linha pode vir sem '\n' (como no
+                // modo arquivo); a conexao fica ate as respostas pendentes sairem
+                if (con->pendente > 0 && !con->descartando) {
+                    con->entrada[con->pendente] = '\0';
+                    if (con->entrada[con->pendente - 1] == '\r') con->entrada[con->pendente - 1] = '\0';
+                    despacharEvento(h, con->entrada, c, con->geracao);
+                }
+                con->pendente = 0;
+                pthread_mutex_lock(&h->travaSaida);
+                con->fimEntrada = 1;
+                pthread_mutex_unlock(&h->travaSaida);
+                continue;
+            }
+            if (lidos < 0) {
+                // Cliente saiu: as sessoes continuam; respostas pendentes sao descartadas
+                pthread_mutex_lock(&h->travaSaida);
+                close(con->fd);
+                con->fd = -1;
+                pthread_mutex_unlock(&h->travaSaida);
+                continue;
+            }
+            
+            size_t tam = con->pendente + (size_t)lidos;
+            con->entrada[tam] = '\0';
+            char* ini = con->entrada;
+            char* nl;
+            if (con->descartando) {
+                // Resto de uma linha longa demais, ja respondida
+                nl = strchr(ini, '\n');
+                if (nl == NULL) {
+                    con->pendente = 0;
+                    continue;
+                }
+                ini = nl + 1;
+                con->descartando = 0;
+            }
+            while ((nl = strchr(ini, '\n')) != NULL) {
+                *nl = '\0';
+                if (nl > ini && nl[-1] == '\r') nl[-1] = '\0';
+                despacharEvento(h, ini, c, con->geracao);
+                ini = nl + 1;
+            }
+            con->pendente = tam - (size_t)(ini - con->entrada);
+            if (con->pendente == sizeof(con->entrada) - 1) {
+                // Linha maior que o buffer: o inicio vai como evento longo (erro na
+                // ordem da sessao, como no modo arquivo) e o resto eh descartado
+                despacharEvento(h, ini, c, con->geracao);
+                con->pendente = 0;
+                con->descartando = 1;
+            }
+            memmove(con->entrada, ini, con->pendente);
+        }
+    }
+    
+    // Encerramento: os trabalhadores esvaziam as filas e as ultimas respostas
+    // vao para os clientes sem esperar os que nao leem
+    pararTrabalhadores(h);
+    for (int c = 0; c < MAX_CONEXOES; c++) {
+        Conexao* con = &h->conexoes[c];
+        if (con->fd >= 0 && con->tamSaida > 0 && !con->lenta) {
+            if (send(con->fd, con->saida, con->tamSaida, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) { /* cliente ja saiu */ }
+        }
+    }
+    sigaction(SIGINT, &anteriorInt, NULL);
+    sigaction(SIGTERM, &anteriorTerm, NULL);
+    despertarSinal = -1;
+    close(fd);
+    unlink(caminho);
+    exibirResumoHospedeiro(h, agoraSegundos() - inicio);
+    liberarHospedeiro(h);
+    return status;
 }
 
 /*
@@ -686,7 +2651,8 @@ void exibirMenu() {
     printf("3. Gerenciar aliados\n");
     printf("4. Ver ranking de vitorias\n");
     printf("5. Ver estatisticas detalhadas\n");
-    printf("6. Sair do programa\n");
+    printf("6. Analisar ataques possiveis (simulacao de futuros)\n");
+    printf("7. Sair do programa\n");
     printf("Escolha uma opcao: ");
 }
 